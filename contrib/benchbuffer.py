@@ -0,0 +1,57 @@
+#!/usr/bin/env python3
+
+# Compares the growth policies of the capture buffers. Every command writes a large
+# output that cronsh captures but doesn't report (sendif-status with status 0), so
+# the time is spent reading the pipe and growing the buffer.
+#
+# The policies of one binary:
+#   geometric  the default, double the size, at most CRONSH_BUFFER_MAXGROWTH at once
+#   64K steps  CRONSH_BUFFER_MAXGROWTH=64K, the fixed steps cronsh used to grow by
+#   hinted     CRONSH_BUFFER_HINT preallocates the whole output
+#
+# usage: benchbuffer.py [path to cronsh] [path to another cronsh ...]
+#
+# Further binaries run once as they are built, e.g. a cronsh built from an older
+# revision that doesn't know the variables:
+#   git show <rev>:cronsh.c > /tmp/old.c && cc -O2 -o /tmp/old /tmp/old.c
+
+import os
+import subprocess
+import sys
+import time
+
+SIZES = (16, 256, 1024)	# MB
+RUNS = 3
+
+def run(cronsh, size, env):
+	best = None
+	maxrss = 0
+
+	for i in range(RUNS):
+		start = time.perf_counter()
+		p = subprocess.Popen([cronsh, "-V", "critical", "-c", "head -c %dM /dev/zero #bench capture-stdout sendto-stdout sendif-status" % size], stdout = subprocess.DEVNULL, env = dict(os.environ, **env))
+		pid, status, rusage = os.wait4(p.pid, 0)
+		elapsed = time.perf_counter() - start
+
+		if best is None or elapsed < best:
+			best = elapsed
+
+		maxrss = max(maxrss, rusage.ru_maxrss)
+
+	return best, maxrss
+
+binaries = sys.argv[1:] if len(sys.argv) > 1 else ["./cronsh"]
+
+policies = (
+	("geometric", lambda size: {}),
+	("64K steps", lambda size: {"CRONSH_BUFFER_MAXGROWTH": "64K"}),
+	("hinted", lambda size: {"CRONSH_BUFFER_HINT": "%dM" % size}),
+)
+
+print("%-6s %-30s %-10s %8s %10s %10s" % ("MB", "cronsh", "policy", "seconds", "MB/s", "maxrss KB"))
+
+for size in SIZES:
+	for n, cronsh in enumerate(binaries):
+		for name, env in policies if n == 0 else (("as built", lambda size: {}),):
+			elapsed, maxrss = run(cronsh, size, env(size))
+			print("%-6d %-30s %-10s %8.3f %10.1f %10d" % (size, cronsh, name, elapsed, size / elapsed, maxrss))
@@ -0,0 +1,73 @@
+#!/usr/bin/env python3
+
+# Measures how fast cronsh turns large captured outputs into a YAML report. Every
+# command writes 100 MB of synthetic output that cronsh captures and reports to
+# /dev/null, so the time is dominated by capturing and escaping.
+#
+# usage: benchyaml.py [path to cronsh] [path to another cronsh ...]
+#
+# Pass a cronsh built from an older revision as a second binary to compare them,
+# e.g. git show <rev>:cronsh.c > /tmp/old.c && cc -O2 -o /tmp/old /tmp/old.c
+
+import os
+import random
+import subprocess
+import sys
+import tempfile
+import time
+
+SIZE = 100 * 1024 * 1024
+RUNS = 3
+
+def lines(size, length):
+	# printable lines of random length around length, the literal block path
+	random.seed(1)
+	words = [b"x" * n for n in range(1, 2 * length)]
+	chunk = b"\n".join(random.choice(words) for i in range(65536)) + b"\n"
+	return (chunk * (size // len(chunk) + 1))[:size]
+
+def quotes(size):
+	# no control characters but many quotes, the quoted string path
+	chunk = b"it's a 'quoted' string " * 4096
+	return (chunk * (size // len(chunk) + 1))[:size]
+
+def control(size):
+	# tabs and other control characters that are escaped inline
+	chunk = b"key\tvalue\x01\x02 " * 4096
+	return (chunk * (size // len(chunk) + 1))[:size]
+
+def run(cronsh, path):
+	best = None
+
+	for i in range(RUNS):
+		start = time.perf_counter()
+		subprocess.run([cronsh, "-V", "critical", "-c", "cat " + path + " #bench sendto-stdout sendif-any capture-stdout"], stdout = subprocess.DEVNULL, check = True)
+		elapsed = time.perf_counter() - start
+
+		if best is None or elapsed < best:
+			best = elapsed
+
+	return best
+
+binaries = sys.argv[1:] if len(sys.argv) > 1 else ["./cronsh"]
+
+datasets = (
+	("short lines", lines(SIZE, 20)),
+	("long lines", lines(SIZE, 2000)),
+	("quotes", quotes(SIZE)),
+	("control", control(SIZE)),
+)
+
+with tempfile.TemporaryDirectory() as tmp:
+	print("%-12s %-30s %8s %10s" % ("output", "cronsh", "seconds", "MB/s"))
+
+	for name, data in datasets:
+		path = os.path.join(tmp, name.replace(" ", "_"))
+		with open(path, "wb") as fp:
+			fp.write(data)
+
+		for cronsh in binaries:
+			elapsed = run(cronsh, path)
+			print("%-12s %-30s %8.2f %10.1f" % (name, cronsh, elapsed, SIZE / elapsed / 1024 / 1024))
+
+		os.unlink(path)
@@ -0,0 +1,162 @@
+#!/usr/bin/env python3
+
+# Runs a command through cronsh once for every report format and checks that the
+# CBOR and MessagePack reports carry the same fields and values as the YAML report.
+#
+# usage: testformat.py [path to cronsh] [command]
+#
+# Needs PyYAML, the binary formats are decoded by the minimal readers below.
+
+import struct
+import subprocess
+import sys
+
+import yaml
+
+VOLATILE = ("starttime", "runtime", "pid", "ppid", "rusage", "timeline", "profile", "cgroup")
+
+def cbor(data, pos = 0):
+	ib = data[pos]
+	major, info = ib >> 5, ib & 0x1f
+	pos += 1
+
+	if ib == 0xf6:
+		return None, pos
+
+	if info < 24:
+		value = info
+	else:
+		n = 1 << (info - 24)
+		value = int.from_bytes(data[pos:pos + n], "big")
+		pos += n
+
+	if major == 0:
+		return value, pos
+	if major == 1:
+		return -1 - value, pos
+	if major == 2:
+		return data[pos:pos + value], pos + value
+	if major == 3:
+		return data[pos:pos + value].decode("utf-8"), pos + value
+	if major == 4:
+		items = []
+		for i in range(value):
+			item, pos = cbor(data, pos)
+			items.append(item)
+		return items, pos
+	if major == 5:
+		items = {}
+		for i in range(value):
+			key, pos = cbor(data, pos)
+			items[key], pos = cbor(data, pos)
+		return items, pos
+
+	raise ValueError("unexpected CBOR major type %d at %d" % (major, pos - 1))
+
+def msgpack(data, pos = 0):
+	b = data[pos]
+	pos += 1
+
+	def length(n):
+		return int.from_bytes(data[pos:pos + n], "big"), pos + n
+
+	if b == 0xc0:
+		return None, pos
+	if b < 0x80:
+		return b, pos
+	if b >= 0xe0:
+		return b - 0x100, pos
+	if b in (0xcc, 0xcd, 0xce, 0xcf):
+		n = 1 << (b - 0xcc)
+		return int.from_bytes(data[pos:pos + n], "big"), pos + n
+	if b in (0xd0, 0xd1, 0xd2, 0xd3):
+		n = 1 << (b - 0xd0)
+		return int.from_bytes(data[pos:pos + n], "big", signed = True), pos + n
+
+	if 0xa0 <= b <= 0xbf:
+		n = b & 0x1f
+		return data[pos:pos + n].decode("utf-8"), pos + n
+	if b in (0xd9, 0xda, 0xdb):
+		n, pos = length(1 << (b - 0xd9))
+		return data[pos:pos + n].decode("utf-8"), pos + n
+	if b in (0xc4, 0xc5, 0xc6):
+		n, pos = length(1 << (b - 0xc4))
+		return data[pos:pos + n], pos + n
+
+	if 0x90 <= b <= 0x9f or b in (0xdc, 0xdd):
+		if b < 0xa0:
+			n = b & 0x0f
+		else:
+			n, pos = length(2 if b == 0xdc else 4)
+		items = []
+		for i in range(n):
+			item, pos = msgpack(data, pos)
+			items.append(item)
+		return items, pos
+	if 0x80 <= b <= 0x8f or b in (0xde, 0xdf):
+		if b < 0x90:
+			n = b & 0x0f
+		else:
+			n, pos = length(2 if b == 0xde else 4)
+		items = {}
+		for i in range(n):
+			key, pos = msgpack(data, pos)
+			items[key], pos = msgpack(data, pos)
+		return items, pos
+
+	raise ValueError("unexpected MessagePack type 0x%02x at %d" % (b, pos - 1))
+
+def run(cronsh, command, format):
+	options = " sendto-stdout sendif-any capture-all format=" + format
+	if "#" not in command:
+		command += " #"
+	return subprocess.run([cronsh, "-V", "critical", "-c", command + options], stdout = subprocess.PIPE).stdout
+
+def normalize(report):
+	# the YAML literal blocks are stripped of trailing newlines, the binary formats keep them
+	for key in ("stdout", "stderr"):
+		value = report.get(key)
+		if value is None:
+			value = b""
+		elif isinstance(value, str):
+			value = value.encode("utf-8")
+		report[key] = value.rstrip(b"\n")
+
+	report["rawcommand"] = report["rawcommand"].rsplit(" format=", 1)[0]
+
+	for key in VOLATILE:
+		if key not in report:
+			continue
+		if key in ("rusage", "profile", "cgroup"):
+			report[key] = sorted(report[key].keys())
+		else:
+			report[key] = type(report[key]).__name__
+
+	return report
+
+cronsh = sys.argv[1] if len(sys.argv) > 1 else "./cronsh"
+command = sys.argv[2] if len(sys.argv) > 2 else "printf 'hello\\nworld\\n'; printf 'caf\\303\\251' >&2 #test"
+
+reference = normalize(yaml.safe_load(run(cronsh, command, "yaml")))
+
+failed = 0
+
+for format, decode in (("cbor", cbor), ("msgpack", msgpack)):
+	data = run(cronsh, command, format)
+	report, end = decode(data)
+
+	if end != len(data):
+		print("%s: %d trailing bytes" % (format, len(data) - end))
+		failed = 1
+
+	report = normalize(report)
+
+	for key in sorted(set(reference) | set(report)):
+		if reference.get(key) != report.get(key):
+			print("%s: %s differs: %r != %r" % (format, key, report.get(key), reference.get(key)))
+			failed = 1
+
+	if failed == 0:
+		print("%s: %d bytes, same as YAML" % (format, len(data)))
+
+sys.exit(failed)
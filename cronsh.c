@@ -2,12 +2,18 @@
 	#define _GNU_SOURCE
 #endif
 
-#include <sys/select.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <sys/time.h>
 #include <sys/resource.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+#include <sys/uio.h>
 #include <sys/errno.h>
+#include <sys/file.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -17,9 +23,48 @@
 #include <ctype.h>
 #include <time.h>
 #include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <dirent.h>
+#include <limits.h>
+#include <spawn.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && !defined(CRONSH_SCAN_PORTABLE)
+	#define CRONSH_SCAN_X86
+	#include <immintrin.h>
+#endif
+
+#ifdef CRONSH_WITH_ZLIB
+	#include <zlib.h>
+#endif
+#ifdef CRONSH_WITH_ZSTD
+	#include <zstd.h>
+#endif
+#ifdef CRONSH_WITH_LZ4
+	#include <lz4frame.h>
+#endif
+
+#ifdef __linux__
+	#include <sys/signalfd.h>
+	#include <sys/syscall.h>
+	#include <linux/sched.h>
+#endif
+
+#if defined(__linux__) && !defined(CRONSH_EVENT_POLL)
+	#define CRONSH_EVENT_EPOLL
+	#include <sys/epoll.h>
+	#include <sys/syscall.h>
+#else
+	#include <poll.h>
+#endif
 
 // gcc cronsh.c -o cronsh -O2 -Wall
 // __linux__: add -lrt for clock_gettime()
+// -DCRONSH_EVENT_POLL: use poll() instead of epoll on Linux
+// -DCRONSH_SCAN_PORTABLE: don't use SSE2/AVX2 for scanning the output
+// -DCRONSH_WITH_ZLIB: add -lz for compress=gzip
+// -DCRONSH_WITH_ZSTD: add -lzstd for compress=zstd
+// -DCRONSH_WITH_LZ4: add -llz4 for compress=lz4
 
 #define CRONSH_LOGLEVEL_DEBUG		1
 #define CRONSH_LOGLEVEL_NOTICE		2
@@ -35,6 +80,7 @@
 #define CRONSH_YAML_STRING		2
 
 #define CRONSH_SHELL_DEFAULT		"/bin/sh"
+#define CRONSH_SHELL_SPECIAL		"|&;<>()$`\\\"'*?[]{}~!\n"	// commands with any of these need the shell
 
 #define CRONSH_OPTION_NONE			0
 #define CRONSH_OPTION_SILENT			(1 <<  0)
@@ -62,39 +108,383 @@
 #define CRONSH_OPTION_SENDIF_STDERR_NONE	(1 << 14)	// stderr == ''
 #define CRONSH_OPTION_SENDIF_STDERR_ANY		(CRONSH_OPTION_SENDIF_STDERR | CRONSH_OPTION_SENDIF_STDERR_NONE)
 #define CRONSH_OPTION_SENDIF_ANY		(CRONSH_OPTION_SENDIF_STATUS_ANY | CRONSH_OPTION_SENDIF_SIGNAL_ANY | CRONSH_OPTION_SENDIF_STDOUT_ANY | CRONSH_OPTION_SENDIF_STDERR_ANY)
+// capture modes
+#define CRONSH_OPTION_CAPTURE_SPOOL		(1 << 15)	// splice into a memory file instead of copying
+// exec modes
+#define CRONSH_OPTION_DIRECT_EXEC		(1 << 16)	// execute simple commands without the shell
+// delivery modes
+#define CRONSH_OPTION_SPOOL			(1 << 17)	// hand the YAML for the pipe to a flusher via CRONSH_SPOOL
+#define CRONSH_OPTION_STREAM			(1 << 18)	// forward the output to file and pipe while the command runs
+#define CRONSH_OPTION_CAPTURE_TIMELINE		(1 << 19)	// remember when which stream got how many bytes
+#define CRONSH_OPTION_PROFILE			(1 << 20)	// sample CPU, memory and I/O of the process tree
+#define CRONSH_OPTION_CGROUP			(1 << 21)	// run the command in its own cgroup v2
+#define CRONSH_OPTION_SENDIF_SLOW		(1 << 22)	// runtime > p95 of the history * slow-factor
+#define CRONSH_OPTION_SENDIF_RSS_REGRESSION	(1 << 23)	// maxrss > p95 of the history * slow-factor
+#define CRONSH_OPTION_KILL_GROUP		(1 << 24)	// run the command in its own process group and signal all of it
+#define CRONSH_OPTION_SENDIF_OVERLAP		(1 << 25)	// the run waited for, killed, or was skipped because of the previous one
 // cron default options
 #define CRONSH_OPTION_CRONDEFAULT		(CRONSH_OPTION_CAPTURE_ALL | CRONSH_OPTION_SENDTO_STDOUT | CRONSH_OPTION_SENDIF_STDOUT | CRONSH_OPTION_SENDIF_STDERR)
 
 #define CRONSH_OPTION(a, o) ((((a) & CRONSH_OPTION_ ## o) == CRONSH_OPTION_ ## o))
 
 #define CRONSH_BUFFER_STEPSIZE		(64 * 1024)
+#define CRONSH_BUFFER_MAXGROWTH		(64 * 1024 * 1024)	// grow by at most this much at once
+#define CRONSH_BUFFER_MAPSIZE		(1024 * 1024)		// above this size buffers are kept in anonymous mappings
+
+#define CRONSH_EVENT_READ		(1 << 0)
+#define CRONSH_EVENT_WRITE		(1 << 1)
+#define CRONSH_EVENT_HANGUP		(1 << 2)
+#define CRONSH_EVENT_ERROR		(1 << 3)
+
+#define CRONSH_EVENT_MAXITEMS		64
+
+#define CRONSH_KILL_AFTER		10000	// milliseconds between SIGTERM and SIGKILL
+#define CRONSH_REAP_POLL		100	// milliseconds between looking for the exit of a timed out command without a pidfd
+
+#define CRONSH_TIMEOUT_NONE		0
+#define CRONSH_TIMEOUT_RUNTIME		1	// timeout= expired
+#define CRONSH_TIMEOUT_IDLE		2	// idle-timeout= expired
+
+#define CRONSH_OVERLAP_RUN		0	// no lock, runs of the same tag overlap
+#define CRONSH_OVERLAP_SKIP		1
+#define CRONSH_OVERLAP_WAIT		2
+#define CRONSH_OVERLAP_KILL		3	// kill-previous
+
+#define CRONSH_OVERLAP_ACQUIRED		0	// the lock was free
+#define CRONSH_OVERLAP_SKIPPED		1
+#define CRONSH_OVERLAP_WAITED		2
+#define CRONSH_OVERLAP_KILLED		3	// the previous run was killed for the lock
+
+#define CRONSH_OVERLAP_QUEUE		1	// runs of a tag that may wait for the lock at once
+#define CRONSH_OVERLAP_MAXQUEUE		64
+#define CRONSH_OVERLAP_POLL		100	// milliseconds between attempts after kill-previous
+#define CRONSH_OVERLAP_GRACE		5000	// milliseconds after kill-after until kill-previous gives up
+
+#define CRONSH_BATCH_POLL		100	// milliseconds between attempts of a manifest to start the jobs waiting for a lock
+
+#define CRONSH_TIMELINE_MAXENTRIES	16384	// reads recorded with capture-timeline, later reads are only counted
+
+#define CRONSH_PROFILE_INTERVAL		1000	// milliseconds between two samples of the process tree
+#define CRONSH_PROFILE_MININTERVAL	10
+
+#define CRONSH_HISTORY_SIZE		64		// runs kept per tag
+#define CRONSH_HISTORY_MINRUNS		5		// runs before sendif-slow and sendif-rss-regression trigger
+#define CRONSH_HISTORY_FACTOR		1.5
+#define CRONSH_HISTORY_MAGIC		"CRONSHH1"
+
+#define CRONSH_FILE_ATOMIC		(1024 * 1024)	// documents up to this size are written with a single write()
+#define CRONSH_FILE_KEEP		5		// rotated files to keep
+
+#define CRONSH_SPOOL_BATCH		256	// documents per consumer invocation
+#define CRONSH_SPOOL_RETRIES		8	// failed deliveries in a row before the flusher gives up
+#define CRONSH_SPOOL_MAXBACKOFF		300	// seconds
+
+#define CRONSH_FRAME_NONE		0	// one document per consumer
+#define CRONSH_FRAME_NUL		1	// every document is followed by a \0
+#define CRONSH_FRAME_LENGTH		2	// every document is preceded by its length in decimal and a newline
+
+#define CRONSH_ITEM_NUMBER		0	// the CBOR major types, MessagePack maps them to its own families
+#define CRONSH_ITEM_BYTES		2
+#define CRONSH_ITEM_TEXT		3
+#define CRONSH_ITEM_ARRAY		4
+#define CRONSH_ITEM_MAP			5
+
+#define CRONSH_FORMAT_YAML		0
+#define CRONSH_FORMAT_CBOR		1	// RFC 8949, one data item per report
+#define CRONSH_FORMAT_MSGPACK		2
+#define CRONSH_FORMAT_NDJSON		3	// one JSON object per line
+
+#define CRONSH_CODEC_NONE		0
+#define CRONSH_CODEC_GZIP		1
+#define CRONSH_CODEC_ZSTD		2
+#define CRONSH_CODEC_LZ4		3
+
+#define CRONSH_CODEC_CHUNK		(64 * 1024)	// compressed output is appended in pieces of this size
+
+#define CRONSH_SINK_FD			1
+#define CRONSH_SINK_FILE		2
+#define CRONSH_SINK_COMMAND		3
+
+typedef struct codec_s {
+	int type;
+	size_t bytes;		// uncompressed bytes that went in
+	void *stream;		// state of the compressor, NULL before the first and after the last bytes
+} codec_t;
 
 typedef struct {
 	char *data;
 	size_t size;
 	size_t used;
 	size_t step;
+
+	struct sink_s *sink;	// where to flush the data to if the buffer is full
+
+	int fd;			// spool file, -1 if the data is kept on the heap
+	int mapped;		// data is a mapping of the spool file or of anonymous memory
+
+	int limited;		// only the first limit and the last ringsize bytes are kept
+	size_t limit;		// keep at most this many bytes from the start
+	size_t total;		// number of bytes appended overall
+	size_t dropped;		// number of bytes that have been discarded
+	char *ring;		// the last bytes beyond the limit
+	size_t ringsize;
+	size_t ringused;
+	size_t ringpos;
+
+	codec_t *codec;		// compresses everything that is read, NULL = keep it as it is
 } buffer_t;
 
+typedef struct {
+	int capturelimit;	// capture-limit is set, either of head and tail may be 0
+	size_t capturehead;	// bytes to keep from the start of stdout and stderr each
+	size_t capturetail;	// bytes to keep from the end of stdout and stderr each
+	int compress;		// codec for the captured stdout and stderr
+	int pipeframe;		// keep the pipe consumer running and separate the documents like this
+	int format;		// encoding of the report
+	unsigned int profileinterval;	// milliseconds, 0 = CRONSH_PROFILE_INTERVAL
+	unsigned int cpuquota;	// percent of one CPU for cpu.max, 0 = unlimited
+	size_t memorymax;	// bytes for memory.max, 0 = unlimited
+	char iomax[64];		// major:minor,key=value,... for io.max, empty = unlimited
+	double slowfactor;	// for sendif-slow and sendif-rss-regression, 0 = CRONSH_HISTORY_FACTOR
+	unsigned long timeout;	// milliseconds the command may run, 0 = forever
+	unsigned long idletimeout;	// milliseconds without output, 0 = forever
+	unsigned long killafter;	// milliseconds from SIGTERM to SIGKILL, 0 = CRONSH_KILL_AFTER
+	int overlap;		// what to do if the previous run of the tag still holds the lock
+	unsigned int overlapqueue;	// runs that may wait, 0 = CRONSH_OVERLAP_QUEUE
+	unsigned long splay;	// milliseconds the start is delayed by at most, 0 = not at all
+} settings_t;
+
+typedef struct {
+	buffer_t *dst;
+	int format;
+
+	unsigned int depth;	// JSON objects and arrays that are still open below the report
+	char closers[16];	// how to close them
+	int first;		// nothing has been written to the innermost one yet
+} emitter_t;
+
+typedef struct {
+	uint64_t time;		// nanoseconds since the command was started
+	uint32_t length;
+	uint32_t stream;	// 1 = stdout, 2 = stderr
+} timelineentry_t;
+
+typedef struct {
+	timelineentry_t *entries;	// in the order of the reads, grows by doubling
+	size_t size;
+	size_t used;
+	size_t dropped;			// reads after CRONSH_TIMELINE_MAXENTRIES
+	struct timespec start;
+} timeline_t;
+
+typedef struct {
+	uint64_t start;		// CLOCK_MONOTONIC in nanoseconds, 0 = no timeout
+	uint64_t output;	// last read from stdout or stderr
+	uint64_t kill;		// when SIGKILL follows, 0 = SIGTERM not sent yet
+	int expired;		// CRONSH_TIMEOUT_*
+	int killed;		// SIGKILL has been sent
+} deadline_t;
+
+typedef struct {
+	pid_t pid;
+	uint64_t cpu;		// utime + stime in clock ticks
+	uint64_t read;		// bytes from and to the storage layer
+	uint64_t write;
+	uint64_t wait;		// nanoseconds spent waiting on a run queue
+} profileproc_t;
+
+typedef struct {
+	uint32_t time;		// milliseconds since the command was started
+	uint32_t cpu;		// percent of one CPU since the previous sample
+	uint32_t rss;		// KB of all processes
+	uint32_t processes;
+} profilesample_t;
+
+typedef struct {
+	uint64_t start;		// CLOCK_MONOTONIC in nanoseconds
+	uint64_t last;		// time of the previous sample
+	uint64_t next;		// time of the next sample
+
+	profileproc_t *procs;	// counters of the previous sample, for the deltas
+	size_t nprocs;
+	pid_t *pids;		// scratch for walking the process tree
+	size_t pidssize;
+
+	profilesample_t *samples;	// grows by doubling
+	size_t size;
+	size_t used;
+
+	uint64_t cpu;		// clock ticks of all processes
+	uint64_t read;
+	uint64_t write;
+	uint64_t wait;
+	uint64_t sumrss;	// for the average
+	uint32_t peakcpu;
+	uint32_t peakrss;
+	uint32_t peakprocesses;
+} profile_t;
+
+typedef struct {
+	char *path;		// the cgroup of the command, NULL = none could be created
+	char *self;		// the cgroup of cronsh
+	int entered;		// cronsh is in path for spawning the child
+
+	uint64_t memorypeak;	// bytes
+	uint64_t cpuusage;	// microseconds
+	uint64_t cpuuser;
+	uint64_t cpusystem;
+	uint64_t throttled;	// periods
+	uint64_t throttledtime;	// microseconds
+	uint64_t ioread;	// bytes of all devices
+	uint64_t iowrite;
+	uint64_t ioreads;	// operations
+	uint64_t iowrites;
+	uint64_t pressure[3];	// microseconds some process stalled on cpu, memory and io
+} cgroup_t;
+
+typedef struct {
+	int64_t starttime;
+	uint32_t runtime;	// milliseconds
+	uint32_t maxrss;	// KB
+	uint32_t cpu;		// milliseconds of user and system time
+	int32_t status;
+	int32_t signal;
+	uint32_t reserved;
+} historyrecord_t;
+
+typedef struct {
+	char magic[8];		// CRONSH_HISTORY_MAGIC
+	uint32_t size;		// records in the ring
+	uint32_t reserved;
+	uint64_t count;		// runs recorded ever, the next one goes to count % size
+	historyrecord_t records[CRONSH_HISTORY_SIZE];
+} historyfile_t;
+
+typedef struct {
+	unsigned long runs;	// previous runs in the history
+	unsigned long runtime;	// p95 of the previous runs
+	unsigned long maxrss;
+	int slow;
+	int rssregression;
+} history_t;
+
+typedef struct {
+	int fd;			// cronsh_<tag>.lock, held until the command has exited
+	int slot;		// cronsh_<tag>.lock.<n> while waiting, -1 = none
+	int result;		// CRONSH_OVERLAP_ACQUIRED, ...
+	unsigned long waited;	// milliseconds until the lock was taken
+	pid_t previous;		// the command of the run that held the lock
+	pid_t target;		// previous, negative for its process group
+	uint64_t start;		// when the lock was tried first, 0 = not yet
+	uint64_t signalled;	// when SIGTERM was sent to target, 0 = not yet
+	int killed;		// SIGKILL was sent to target
+	int locked;		// fd is locked
+} overlap_t;
+
+typedef struct {
+	unsigned long splay;	// milliseconds the start was delayed
+	int fd;			// cronsh.slot.<n> in CRONSH_LOCKDIR, held until the command has exited
+	long slot;		// -1 = no CRONSH_MAXJOBS
+	unsigned long waited;	// milliseconds until a slot was free
+	uint64_t start;		// when a slot was tried first, 0 = not yet
+} admission_t;
+
+typedef struct {
+	int fd;
+	unsigned int events;
+	void *data;
+} eventitem_t;
+
+typedef struct {
+	void **data;		// registered data, indexed by descriptor
+	size_t datasize;
+#ifdef CRONSH_EVENT_EPOLL
+	int epollfd;
+#else
+	struct pollfd *pollfds;
+	size_t *index;		// position in pollfds, indexed by descriptor
+	size_t indexsize;
+	size_t nfds;
+	size_t size;
+#endif
+} event_t;
+
 typedef struct {
 	unsigned int options;
-	char *argv[4];
+	settings_t settings;
+	char **argv;
+	char *path;		// resolved executable for direct exec, NULL if argv[0] is looked up in PATH
 	
 	char *tag;
 
 	pid_t pid;
 	pid_t ppid;
 
+	int stdinfd;
+	int stdoutfd;
+	int stderrfd;
+	int pidfd;
+	size_t stdinbytes;
+
 	int status;
 	int signal;
 
 	struct rusage rusage;
 
 	buffer_t *stdinbuffer;
+	int stdinstream;	// stdin is written to through a sink
 	buffer_t stdoutbuffer;
 	buffer_t stderrbuffer;
+
+	deadline_t deadline;		// timeout= and idle-timeout=
+
+	struct stream_s *stream;	// the output is forwarded chunk by chunk, NULL = captured as a whole
+	timeline_t *timeline;		// every read from stdout and stderr, NULL = not recorded
+	profile_t *profile;		// samples of the process tree, NULL = not profiled
+	cgroup_t *cgroup;		// the command's own cgroup, NULL = runs in the one of cronsh
+	history_t *history;		// comparison with the previous runs, NULL = no CRONSH_HISTORY
+	overlap_t *overlap;		// the lock of the tag, NULL = runs may overlap
+	admission_t *admission;		// splay and CRONSH_MAXJOBS, NULL = started right away
 } command_t;
 
+typedef struct sink_s {
+	int type;
+
+	int fd;
+	FILE *fp;
+
+	command_t *command;
+	event_t *event;
+} sink_t;
+
+typedef struct stream_s {
+	command_t *pipe;	// CRONSH_PIPE, kept running until the summary has been written
+	event_t event;
+	sink_t sink;
+	int failed;		// the pipe didn't take a record, don't try again
+
+	time_t starttime;
+	unsigned long records;
+	size_t bytes[2];	// forwarded from stdout and stderr
+} stream_t;
+
+typedef struct {
+	const char *rawcommand;
+	command_t *command;
+
+	time_t starttime;
+	unsigned long runtime;	// milliseconds
+} report_t;
+
+typedef struct {
+	report_t report;
+
+	int started;		// 0 = it waits for the lock of its tag in a batch
+
+	struct timespec starttime;
+	struct timespec stoptime;
+} job_t;
+
 typedef struct {
 	char *shell;
 
@@ -103,9 +493,31 @@ typedef struct {
 	FILE *logfp;
 
 	char *file;
+	size_t filemaxsize;
+	unsigned int filesync;
 	char *pipe;
 
 	unsigned int options;
+	settings_t settings;
+
+	size_t bufferhint;
+
+	long concurrency;
+
+	char *daemon;
+
+	char *spool;
+
+	char *cgroup;
+	char *cgroupleave;	// the cgroup of cronsh, while cronsh is stuck in the one of a command
+
+	char *metrics;
+
+	char *history;
+
+	char *lockdir;
+
+	long maxjobs;
 
 	char thisuser[256];
 	char thishostname[256];
@@ -115,32 +527,191 @@ typedef struct {
 
 config_t config;
 
+typedef struct {
+	char *rawcommand;	// the pipe consumer that is kept running by the daemon
+	int frame;
+	char *lock;		// serializes the documents of the workers
+	int fd;			// stdin of the consumer, -1 if it isn't running
+	command_t *command;
+	time_t started;
+} consumer_t;
+
+consumer_t consumer = {NULL, CRONSH_FRAME_NONE, NULL, -1, NULL, 0};
+
+typedef struct {
+	char path[PATH_MAX];	// CRONSH_FILE with the time filled in
+	int fd;
+	unsigned int unsynced;	// documents written since the last fdatasync()
+} reportfile_t;
+
+reportfile_t reportfile = {"", -1, 0};
+
 void cronsh_init(void);
 void cronsh_help(void);
-int cronsh_pipe(const char *rawpipecommand, buffer_t *buffer);
+int cronsh_pipe(const char *rawpipecommand, report_t *report);
+int cronsh_file(const char *file, report_t *report);
+void cronsh_file_close(void);
+int cronsh_metrics(const char *dir, report_t *report);
+int cronsh_history(const char *dir, report_t *report);
+int cronsh_spool(const char *spool, const char *rawpipecommand, report_t *report);
+int cronsh_send(sink_t *sink, report_t *report);
+int cronsh_report(buffer_t *dst, report_t *report);
+void cronsh_deliver(report_t *report);
+int cronsh_batch(const char *manifest);
+int cronsh_run(const char *rawcommand);
+int cronsh_daemon(const char *path);
+int cronsh_submit(const char *path, const char *rawcommand);
+static int cronsh_daemon_worker(int fd);
+static int cronsh_consumer_start(event_t *event);
+static void cronsh_consumer_handle(event_t *event, int fd, unsigned int events);
+static int cronsh_consumer_send(report_t *report);
+static void cronsh_consumer_check(event_t *event, pid_t pid);
+static int cronsh_consumer_write(const char *bytes, size_t nbytes);
+static int cronsh_frame_write(sink_t *sink, int frame, const char *bytes, size_t nbytes);
+static int cronsh_frame_send(sink_t *sink, int frame, report_t *report);
+static int cronsh_spool_init(const char *dir, const char *rawpipecommand);
+static void cronsh_spool_flusher(const char *dir, const char *rawpipecommand);
+static void cronsh_spool_closefrom(int fd);
+static int cronsh_spool_flush(const char *dir, const char *rawpipecommand);
+static int cronsh_spool_batch(const char *dir, const char *rawpipecommand);
+static int cronsh_stream_forward(command_t *command);
+static int cronsh_stream_send(command_t *command, report_t *report);
+static int cronsh_stream_close(command_t *command);
+static char **cronsh_command_split(const char *string, char **path);
+static char *cronsh_command_which(const char *name);
+
+job_t *cronsh_job_init(const char *rawcommand);
+int cronsh_job_start(job_t *job, event_t *event, int wait);
+void cronsh_job_finish(job_t *job);
+void cronsh_job_deliver(job_t *job);
+void cronsh_job_free(job_t *job);
 void cronsh_log(int loglevel, const char *format, ...);
 
-unsigned int cronsh_options(unsigned int prevoptions, const char *options);
+unsigned int cronsh_options(unsigned int prevoptions, settings_t *settings, const char *options);
+size_t cronsh_parse_size(const char *value);
+unsigned long cronsh_parse_duration(const char *value);
+uint64_t cronsh_hash(const char *string);
 
 command_t *cronsh_command_init(const char *rawcommand, buffer_t *stdinbuffer);
 void cronsh_command_free(command_t *command);
 void cronsh_command_options(command_t *command);
 void cronsh_command_spawn(command_t *command);
+int cronsh_command_start(command_t *command, event_t *event);
+void cronsh_command_handle(command_t *command, event_t *event, int fd, unsigned int events);
+int cronsh_command_running(command_t *command);
+void cronsh_command_run(command_t *command, event_t *event);
+void cronsh_command_closestdin(command_t *command, event_t *event);
+void cronsh_command_wait(command_t *command);
+int cronsh_command_timeout(command_t *command);
+void cronsh_command_tick(command_t *command, event_t *event);
+static void cronsh_command_close(event_t *event, int *fd);
+static uint64_t cronsh_now(void);
+static void cronsh_profile_start(command_t *command);
+static ssize_t cronsh_profile_read(const char *path, char *data, size_t size);
+static void cronsh_profile_sample(command_t *command, int last);
+static int cronsh_cgroup_init(command_t *command);
+static int cronsh_cgroup_spawn(command_t *command, pid_t *pid, posix_spawn_file_actions_t *actions, posix_spawnattr_t *attr, int childfds[3]);
+static int cronsh_cgroup_left(void);
+static void cronsh_cgroup_enter(command_t *command);
+static void cronsh_cgroup_leave(command_t *command, pid_t pid);
+static void cronsh_cgroup_collect(command_t *command);
+static int cronsh_overlap_lock(command_t *command, int wait);
+static void cronsh_overlap_owner(command_t *command);
+static void cronsh_overlap_unlock(command_t *command);
+static void cronsh_admission_splay(command_t *command);
+static int cronsh_admission_acquire(admission_t *admission, int wait);
+static void cronsh_admission_release(admission_t *admission);
+
+int cronsh_fd_pipe(int fds[2]);
+int cronsh_fd_nonblock(int fd);
+
+
+/* event facility */
+
+int eventInit(event_t *event);
+int eventFree(event_t *event);
+int eventAdd(event_t *event, int fd, unsigned int events, void *data);
+int eventModify(event_t *event, int fd, unsigned int events, void *data);
+int eventDelete(event_t *event, int fd);
+int eventWait(event_t *event, eventitem_t *items, int nitems, int timeout);
+
+
+/* sink facility */
+
+int sinkInitFD(sink_t *sink, int fd);
+int sinkInitFile(sink_t *sink, FILE *fp);
+int sinkInitCommand(sink_t *sink, command_t *command, event_t *event);
+int sinkWrite(sink_t *sink, const char *bytes, size_t nbytes);
+int sinkWritev(sink_t *sink, struct iovec *iov, int iovcnt);
 
 
 /* buffer facility */
 
 int bufferInit(buffer_t *buffer, size_t nbytes);
+int bufferInitSink(buffer_t *buffer, size_t nbytes, sink_t *sink);
+int bufferFlush(buffer_t *buffer);
 int bufferFree(buffer_t *buffer);
 int bufferReset(buffer_t *buffer);
 int bufferAppendBuffer(buffer_t *dst, buffer_t *src);
 int bufferAppendString(buffer_t *dst, const char *format, ...);
 int bufferAppendBytes(buffer_t *dst, const char *bytes, size_t nbytes);
 
+int bufferReserve(buffer_t *dst, size_t nbytes);
+ssize_t bufferRead(buffer_t *dst, int fd, size_t nbytes);
+void bufferSetMaxGrowth(size_t nbytes);
+
+int bufferInitSpool(buffer_t *buffer);
+ssize_t bufferSplice(buffer_t *dst, int fd, size_t nbytes);
+int bufferMap(buffer_t *buffer);
+static int bufferUnspool(buffer_t *buffer);
+
+int bufferSetLimit(buffer_t *buffer, size_t head, size_t tail);
+int bufferCompact(buffer_t *buffer);
+
+int bufferSetCodec(buffer_t *buffer, int type);
+int bufferCompress(buffer_t *dst, const char *bytes, size_t nbytes);
+int bufferCompressEnd(buffer_t *dst);
+const char *bufferCodecName(int type);
+static void bufferFreeCodec(buffer_t *buffer);
+int bufferAppendBase64(buffer_t *dst, const char *bytes, size_t len, const char *newline, size_t newlinelen);
+
 int bufferStartYAML(buffer_t *dst);
 int bufferEndYAML(buffer_t *dst);
 int bufferAppendYAML(buffer_t *dst, unsigned int level, const char *key, const char *format, int type, ...);
 int bufferAppendYAMLList(buffer_t *dst, unsigned int level, const char *key, int type, char **list);
+int bufferAppendYAMLKey(buffer_t *dst, unsigned int level, const char *key);
+int bufferAppendYAMLNumber(buffer_t *dst, unsigned int level, const char *key, long value);
+int bufferAppendYAMLString(buffer_t *dst, unsigned int level, const char *key, const char *string, size_t len);
+int bufferAppendYAMLBinary(buffer_t *dst, unsigned int level, const char *key, const char *bytes, size_t len);
+
+int bufferAppendJSONString(buffer_t *dst, const char *string, size_t len);
+int bufferAppendJSONNumber(buffer_t *dst, long value);
+
+int bufferAppendCBORHead(buffer_t *dst, unsigned int major, uint64_t value);
+int bufferAppendCBORNumber(buffer_t *dst, long value);
+int bufferAppendCBORString(buffer_t *dst, unsigned int major, const char *string, size_t len);
+
+int bufferAppendMsgpackHead(buffer_t *dst, unsigned int type, uint64_t value);
+int bufferAppendMsgpackNumber(buffer_t *dst, long value);
+int bufferAppendMsgpackString(buffer_t *dst, unsigned int type, const char *string, size_t len);
+
+char *bufferSpace(buffer_t *dst, size_t nbytes);
+void bufferAdvance(buffer_t *dst, size_t nbytes);
+
+
+/* emitter facility */
+
+void emitterInit(emitter_t *emitter, buffer_t *dst, int format);
+int emitterStart(emitter_t *emitter, size_t nitems);
+int emitterEnd(emitter_t *emitter);
+int emitterMap(emitter_t *emitter, unsigned int level, const char *key, size_t nitems);
+int emitterNumber(emitter_t *emitter, unsigned int level, const char *key, long value);
+int emitterString(emitter_t *emitter, unsigned int level, const char *key, const char *string, size_t len);
+int emitterBytes(emitter_t *emitter, unsigned int level, const char *key, const char *bytes, size_t len);
+int emitterBinary(emitter_t *emitter, unsigned int level, const char *key, const char *bytes, size_t len);
+int emitterList(emitter_t *emitter, unsigned int level, const char *key, char **list);
+int emitterSequence(emitter_t *emitter, unsigned int level, const char *key, size_t nitems);
+int emitterTuple(emitter_t *emitter, unsigned int level, const long *values, size_t nvalues);
 
 float difftimespec(struct timespec *start, struct timespec *stop) {
 	struct timespec t;
@@ -160,19 +731,22 @@ float difftimespec(struct timespec *start, struct timespec *stop) {
 int main(int argc, char **argv) {
 	int c;
 	char *rawcommand = NULL;
-	command_t *command;
-	time_t utcstarttime;
-	struct timespec starttime;
-	struct timespec stoptime;
-	buffer_t outbuffer;
+	char *manifest = NULL;
+	int daemon = 0;
 
 	opterr = 0;
 
-	while((c = getopt(argc, argv, ":c: :s: :V: :l: :f: :p: :o: :H: h")) != -1) {
+	while((c = getopt(argc, argv, ":c: :m: :j: :s: :V: :l: :f: :p: :o: :H: D h")) != -1) {
 		switch(c) {
 			case 'c':
 				rawcommand = optarg;
 				break;
+			case 'm':
+				manifest = optarg;
+				break;
+			case 'j':
+				setenv("CRONSH_CONCURRENCY", optarg, 1);
+				break;
 			case 's':
 				setenv("CRONSH_SHELL", optarg, 1);
 				break;
@@ -194,6 +768,9 @@ int main(int argc, char **argv) {
 			case 'H':
 				setenv("CRONSH_HOSTNAME", optarg, 1);
 				break;
+			case 'D':
+				daemon = 1;
+				break;
 			case 'h':
 				cronsh_help();
 				return 0;
@@ -207,1196 +784,8956 @@ int main(int argc, char **argv) {
 	
 	cronsh_init();
 
+	if(daemon != 0) {
+		if(config.daemon == NULL) {
+			cronsh_log(CRONSH_LOGLEVEL_CRITICAL, "no socket given. Set CRONSH_DAEMON to the path of the socket.");
+
+			return 1;
+		}
+
+		return (cronsh_daemon(config.daemon) == 0) ? 0 : 1;
+	}
+
+	if(manifest != NULL) {
+		cronsh_batch(manifest);
+
+		cronsh_log(CRONSH_LOGLEVEL_DEBUG, "done");
+
+		return 0;
+	}
+
 	if(rawcommand == NULL) {
-		cronsh_log(CRONSH_LOGLEVEL_CRITICAL, "no command given. Use -c to give a command to execute or check -h for help.");
+		cronsh_log(CRONSH_LOGLEVEL_CRITICAL, "no command given. Use -c or -m to give a command to execute or check -h for help.");
 
 		return 0;
 	}
 
-	utcstarttime = time(NULL);
+	// hand the command over to the daemon, run it ourselves if there's none
+	if(config.daemon == NULL || cronsh_submit(config.daemon, rawcommand) == 1) {
+		cronsh_run(rawcommand);
+	}
 
-	cronsh_log(CRONSH_LOGLEVEL_DEBUG, "rawcommand: %s", rawcommand);
+	cronsh_log(CRONSH_LOGLEVEL_DEBUG, "done");
 
-	// parse command
-	command = cronsh_command_init(rawcommand, NULL);
-	if(command == NULL) {
+	return 0;
+}
+
+int cronsh_run(const char *rawcommand) {
+	job_t *job;
+	event_t event;
+
+	job = cronsh_job_init(rawcommand);
+	if(job == NULL) {
 		cronsh_log(CRONSH_LOGLEVEL_CRITICAL, "failed parsing command.");
 
-		return 0;
+		return -1;
 	}
-	
-	cronsh_log(CRONSH_LOGLEVEL_DEBUG, "tag: %s", (command->tag != NULL) ? command->tag : "[none]");
 
-	cronsh_log(CRONSH_LOGLEVEL_DEBUG, "options: %d", command->options);
-	cronsh_log(CRONSH_LOGLEVEL_DEBUG, "   silent                      = %s", CRONSH_OPTION(command->options, SILENT) ? "yes" : "no");
-	cronsh_log(CRONSH_LOGLEVEL_DEBUG, "   crondefault                 = %s", CRONSH_OPTION(command->options, CRONDEFAULT) ? "yes" : "no");
-	cronsh_log(CRONSH_LOGLEVEL_DEBUG, "   capture stdout              = %s", CRONSH_OPTION(command->options, CAPTURE_STDOUT) ? "yes" : "no");
-	cronsh_log(CRONSH_LOGLEVEL_DEBUG, "   capture stderr              = %s", CRONSH_OPTION(command->options, CAPTURE_STDERR) ? "yes" : "no");
-	cronsh_log(CRONSH_LOGLEVEL_DEBUG, "   send to stdout              = %s", CRONSH_OPTION(command->options, SENDTO_STDOUT) ? "yes" : "no");
-	cronsh_log(CRONSH_LOGLEVEL_DEBUG, "   send to log                 = %s", CRONSH_OPTION(command->options, SENDTO_FILE) ? "yes" : "no");
-	cronsh_log(CRONSH_LOGLEVEL_DEBUG, "   send to pipe                = %s", CRONSH_OPTION(command->options, SENDTO_PIPE) ? "yes" : "no");
-	cronsh_log(CRONSH_LOGLEVEL_DEBUG, "   send to fallback            = %s", CRONSH_OPTION(command->options, SENDTO_FALLBACK) ? "yes" : "no");
-	cronsh_log(CRONSH_LOGLEVEL_DEBUG, "   send if status is not 0     = %s", CRONSH_OPTION(command->options, SENDIF_STATUS) ? "yes" : "no");
-	cronsh_log(CRONSH_LOGLEVEL_DEBUG, "   send if status is 0         = %s", CRONSH_OPTION(command->options, SENDIF_STATUS_OK) ? "yes" : "no");
-	cronsh_log(CRONSH_LOGLEVEL_DEBUG, "   send if status is anything  = %s", CRONSH_OPTION(command->options, SENDIF_STATUS_ANY) ? "yes" : "no");
-	cronsh_log(CRONSH_LOGLEVEL_DEBUG, "   send if signal is not 0     = %s", CRONSH_OPTION(command->options, SENDIF_SIGNAL) ? "yes" : "no");
-	cronsh_log(CRONSH_LOGLEVEL_DEBUG, "   send if signal is 0         = %s", CRONSH_OPTION(command->options, SENDIF_SIGNAL_OK) ? "yes" : "no");
-	cronsh_log(CRONSH_LOGLEVEL_DEBUG, "   send if signal is anything  = %s", CRONSH_OPTION(command->options, SENDIF_SIGNAL_ANY) ? "yes" : "no");
-	cronsh_log(CRONSH_LOGLEVEL_DEBUG, "   send if stdout is not empty = %s", CRONSH_OPTION(command->options, SENDIF_STDOUT) ? "yes" : "no");
-	cronsh_log(CRONSH_LOGLEVEL_DEBUG, "   send if stdout is empty     = %s", CRONSH_OPTION(command->options, SENDIF_STDOUT_NONE) ? "yes" : "no");
-	cronsh_log(CRONSH_LOGLEVEL_DEBUG, "   send if stdout is anything  = %s", CRONSH_OPTION(command->options, SENDIF_STDOUT_ANY) ? "yes" : "no");
-	cronsh_log(CRONSH_LOGLEVEL_DEBUG, "   send if stderr is not empty = %s", CRONSH_OPTION(command->options, SENDIF_STDERR) ? "yes" : "no");
-	cronsh_log(CRONSH_LOGLEVEL_DEBUG, "   send if stderr is empty     = %s", CRONSH_OPTION(command->options, SENDIF_STDERR_NONE) ? "yes" : "no");
-	cronsh_log(CRONSH_LOGLEVEL_DEBUG, "   send if stderr is anything  = %s", CRONSH_OPTION(command->options, SENDIF_STDERR_ANY) ? "yes" : "no");
-	cronsh_log(CRONSH_LOGLEVEL_DEBUG, "   send in any case            = %s", CRONSH_OPTION(command->options, SENDIF_ANY) ? "yes" : "no");
+	if(eventInit(&event) != 0) {
+		cronsh_log(CRONSH_LOGLEVEL_CRITICAL, "failed creating event loop: %s", strerror(errno));
+
+		cronsh_job_free(job);
 
+		return -1;
+	}
 
 	// execute the actual command
 
-	clock_gettime(CLOCK_MONOTONIC, &starttime);
+	if(cronsh_job_start(job, &event, 1) == 0) {
+		cronsh_command_run(job->report.command, &event);
+	}
 
-	cronsh_command_spawn(command);
-	
-	clock_gettime(CLOCK_MONOTONIC, &stoptime);
+	cronsh_job_finish(job);
+	cronsh_job_deliver(job);
 
 	// finished executing the actual command
 
+	eventFree(&event);
 
-	cronsh_log(CRONSH_LOGLEVEL_DEBUG, "status: %d", command->status);
-	cronsh_log(CRONSH_LOGLEVEL_DEBUG, "signal: %d", command->signal);
-	cronsh_log(CRONSH_LOGLEVEL_DEBUG, "stdout: (%d) %s", command->stdoutbuffer.used, command->stdoutbuffer.data);
-	cronsh_log(CRONSH_LOGLEVEL_DEBUG, "stderr: (%d) %s", command->stderrbuffer.used, command->stderrbuffer.data);
+	cronsh_job_free(job);
 
-	cronsh_log(CRONSH_LOGLEVEL_DEBUG, "runtime: %dms", (int)(difftimespec(&starttime, &stoptime) * 1000));
+	cronsh_file_close();
 
-	bufferInit(&outbuffer, CRONSH_BUFFER_STEPSIZE);
-	
-	bufferStartYAML(&outbuffer);
-	bufferAppendYAML(&outbuffer, 0, "hostname", "%s", CRONSH_YAML_STRING, config.thishostname);
-	bufferAppendYAML(&outbuffer, 0, "user", "%s", CRONSH_YAML_STRING, config.thisuser);
-	bufferAppendYAML(&outbuffer, 0, "rawcommand", "%s", CRONSH_YAML_STRING, rawcommand);
+	return 0;
+}
 
-	bufferAppendYAMLList(&outbuffer, 0, "command", CRONSH_YAML_STRING, command->argv);
+// The daemon accepts commands from cronsh -c on a UNIX socket. For every command a worker is forked that
+// takes over the environment, the working directory, stdout and stderr of the submitting cronsh.
+int cronsh_daemon(const char *path) {
+	int i, n, fd, listenfd, sigfd = -1, timeout;
+	pid_t pid;
+	int status;
+	struct sockaddr_un addr;
+	event_t event;
+	eventitem_t items[CRONSH_EVENT_MAXITEMS];
+#ifdef __linux__
+	sigset_t sigs;
+	struct signalfd_siginfo info;
+#endif
 
-	bufferAppendYAML(&outbuffer, 0, "tag", "%s", CRONSH_YAML_STRING, (command->tag != NULL) ? command->tag : "");
-	bufferAppendYAML(&outbuffer, 0, "starttime", "%ld", CRONSH_YAML_NUMBER, utcstarttime);
-	bufferAppendYAML(&outbuffer, 0, "runtime", "%ld", CRONSH_YAML_NUMBER, (unsigned long)(difftimespec(&starttime, &stoptime) * 1000));
-	bufferAppendYAML(&outbuffer, 0, "pid", "%u", CRONSH_YAML_NUMBER, command->pid);
-	bufferAppendYAML(&outbuffer, 0, "ppid", "%u", CRONSH_YAML_NUMBER, command->ppid);
-	bufferAppendYAML(&outbuffer, 0, "status", "%d", CRONSH_YAML_NUMBER, command->status);
-	bufferAppendYAML(&outbuffer, 0, "signal", "%d", CRONSH_YAML_NUMBER, command->signal);
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
 
-	if(!CRONSH_OPTION(command->options, CAPTURE_STDOUT)) {
-		bufferReset(&command->stdoutbuffer);
-	}
-	
-	bufferAppendYAML(&outbuffer, 0, "stdout", "%s", CRONSH_YAML_STRING, command->stdoutbuffer.data);
+	if(strlen(path) >= sizeof(addr.sun_path)) {
+		cronsh_log(CRONSH_LOGLEVEL_CRITICAL, "socket path too long: %s", path);
 
-	if(!CRONSH_OPTION(command->options, CAPTURE_STDERR)) {
-		bufferReset(&command->stderrbuffer);
+		return -1;
 	}
-	
-	bufferAppendYAML(&outbuffer, 0, "stderr", "%s", CRONSH_YAML_STRING, command->stderrbuffer.data);
-
-	bufferAppendYAML(&outbuffer, 0, "rusage", "", CRONSH_YAML_NONE);
-
-	bufferAppendYAML(&outbuffer, 1, "utime", "%ld", CRONSH_YAML_NUMBER, command->rusage.ru_utime.tv_sec * 1000 + command->rusage.ru_utime.tv_usec / 1000);	// user time used
-	bufferAppendYAML(&outbuffer, 1, "stime", "%ld", CRONSH_YAML_NUMBER, command->rusage.ru_stime.tv_sec * 1000 + command->rusage.ru_stime.tv_usec / 1000);	// system time used
-	bufferAppendYAML(&outbuffer, 1, "maxrss", "%ld", CRONSH_YAML_NUMBER, command->rusage.ru_maxrss);		// max resident set size
-	bufferAppendYAML(&outbuffer, 1, "ixrss", "%ld", CRONSH_YAML_NUMBER, command->rusage.ru_ixrss);		// integral shared text memory size
-	bufferAppendYAML(&outbuffer, 1, "idrss", "%ld", CRONSH_YAML_NUMBER, command->rusage.ru_idrss);		// integral unshared data size
-	bufferAppendYAML(&outbuffer, 1, "isrss", "%ld", CRONSH_YAML_NUMBER, command->rusage.ru_isrss);		// integral unshared stack size
-	bufferAppendYAML(&outbuffer, 1, "minflt", "%ld", CRONSH_YAML_NUMBER, command->rusage.ru_minflt);		// page reclaims
-	bufferAppendYAML(&outbuffer, 1, "majflt", "%ld", CRONSH_YAML_NUMBER, command->rusage.ru_majflt);		// page faults
-	bufferAppendYAML(&outbuffer, 1, "nswap", "%ld", CRONSH_YAML_NUMBER, command->rusage.ru_nswap);		// swaps
-	bufferAppendYAML(&outbuffer, 1, "inblock", "%ld", CRONSH_YAML_NUMBER, command->rusage.ru_inblock);		// block input operations
-	bufferAppendYAML(&outbuffer, 1, "oublock", "%ld", CRONSH_YAML_NUMBER, command->rusage.ru_oublock);		// block output operations
-	bufferAppendYAML(&outbuffer, 1, "msgsnd", "%ld", CRONSH_YAML_NUMBER, command->rusage.ru_msgsnd);		// messages sent
-	bufferAppendYAML(&outbuffer, 1, "msgrcv", "%ld", CRONSH_YAML_NUMBER, command->rusage.ru_msgrcv);		// messages received
-	bufferAppendYAML(&outbuffer, 1, "nsignals", "%ld", CRONSH_YAML_NUMBER, command->rusage.ru_nsignals);	// signals received
-	bufferAppendYAML(&outbuffer, 1, "nvcsw", "%ld", CRONSH_YAML_NUMBER, command->rusage.ru_nvcsw);		// voluntary context switches
-	bufferAppendYAML(&outbuffer, 1, "nivcsw", "%ld", CRONSH_YAML_NUMBER, command->rusage.ru_nivcsw);		// involuntary context switches
-
-	bufferEndYAML(&outbuffer);
-
-	// check if we have to send anything
-	int sendif = 0;
-
-	if(CRONSH_OPTION(command->options, SENDIF_STATUS)) { if(command->status != 0) { sendif = 1; } }
-	if(CRONSH_OPTION(command->options, SENDIF_STATUS_OK)) { if(command->status == 0) { sendif = 1; } }
-
-	if(CRONSH_OPTION(command->options, SENDIF_SIGNAL)) { if(command->signal != 0) { sendif = 1; } }
-	if(CRONSH_OPTION(command->options, SENDIF_SIGNAL_OK)) { if(command->signal == 0) { sendif = 1; } }
 
-	if(CRONSH_OPTION(command->options, SENDIF_STDOUT)) { if(command->stdoutbuffer.used != 0) { sendif = 1; } }
-	if(CRONSH_OPTION(command->options, SENDIF_STDOUT_NONE)) { if(command->stdoutbuffer.used == 0) { sendif = 1; } }
+	strcpy(addr.sun_path, path);
 
-	if(CRONSH_OPTION(command->options, SENDIF_STDERR)) { if(command->stderrbuffer.used != 0) { sendif = 1; } }
-	if(CRONSH_OPTION(command->options, SENDIF_STDERR_NONE)) { if(command->stderrbuffer.used == 0) { sendif = 1; } }
+	listenfd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if(listenfd == -1) {
+		cronsh_log(CRONSH_LOGLEVEL_CRITICAL, "failed creating socket: %s", strerror(errno));
 
-	// if we don't have to send anything, we're going into silent mode
-	if(sendif == 0) {
-		cronsh_log(CRONSH_LOGLEVEL_DEBUG, "we shall not send anything");
-		command->options |= CRONSH_OPTION_SILENT;
+		return -1;
 	}
 
-	if(!CRONSH_OPTION(command->options, SILENT)) {
-		// write to pipe
-		if(CRONSH_OPTION(command->options, SENDTO_PIPE)) {
-			cronsh_log(CRONSH_LOGLEVEL_DEBUG, "sending to pipe");
+	// don't take the socket away from a daemon that is still running
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if(fd != -1) {
+		if(connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0) {
+			cronsh_log(CRONSH_LOGLEVEL_CRITICAL, "another daemon is listening on %s", path);
 
-			int rv = cronsh_pipe(config.pipe, &outbuffer);
-			if(rv == 0) {
-				// if the fallback option was set, don't send it any further
-				if(CRONSH_OPTION(command->options, SENDTO_FALLBACK)) {
-					command->options &= ~CRONSH_OPTION_SENDTO_ALL;
-				}
-			}
-			else {
-				cronsh_log(CRONSH_LOGLEVEL_CRITICAL, "failed sending to pipe (%d)", rv);
-			}
+			close(fd);
+			close(listenfd);
+
+			return -1;
 		}
 
-		// write to file
-		if(CRONSH_OPTION(command->options, SENDTO_FILE)) {
-			cronsh_log(CRONSH_LOGLEVEL_DEBUG, "sending to file");
+		close(fd);
+	}
 
-			FILE *fp = fopen(config.file, "a");
-			if(fp != NULL) {
-				fprintf(fp, "%s", outbuffer.data);
-				fclose(fp);
+	// nobody answers, it's left over from a daemon that is gone
+	unlink(path);
 
-				// if the fallback option was set, don't send it any further
-				if(CRONSH_OPTION(command->options, SENDTO_FALLBACK)) {
-					command->options &= ~CRONSH_OPTION_SENDTO_ALL;
-				}
-			}
-			else {
-				cronsh_log(CRONSH_LOGLEVEL_CRITICAL, "failed sending to file (%s)", strerror(errno));
-			}
-		}
+	if(bind(listenfd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || chmod(path, 0600) != 0 || listen(listenfd, 128) != 0) {
+		cronsh_log(CRONSH_LOGLEVEL_CRITICAL, "failed listening on %s: %s", path, strerror(errno));
 
-		// write to stdout
-		if(CRONSH_OPTION(command->options, SENDTO_STDOUT)) {
-			cronsh_log(CRONSH_LOGLEVEL_DEBUG, "sending to stdout");
+		close(listenfd);
 
-			fprintf(stdout, "%s", outbuffer.data);
-		}
+		return -1;
 	}
-	
-	cronsh_command_free(command);
 
-	bufferFree(&outbuffer);
+	cronsh_fd_nonblock(listenfd);
 
-	cronsh_log(CRONSH_LOGLEVEL_DEBUG, "done");
+	if(eventInit(&event) != 0 || eventAdd(&event, listenfd, CRONSH_EVENT_READ, NULL) != 0) {
+		cronsh_log(CRONSH_LOGLEVEL_CRITICAL, "failed creating event loop: %s", strerror(errno));
 
-	return 0;
-}
+		close(listenfd);
 
-int cronsh_pipe(const char *rawpipecommand, buffer_t *buffer) {
-	int rv;
-	command_t *command;
-	
-	if(rawpipecommand == NULL) {
 		return -1;
 	}
 
-	cronsh_log(CRONSH_LOGLEVEL_DEBUG, "sending to: %s", rawpipecommand);
+	cronsh_log(CRONSH_LOGLEVEL_NOTICE, "listening on %s", path);
 
-	command = cronsh_command_init(rawpipecommand, buffer);
-	if(command == NULL) {
-		return -1;
-	}
-
-	cronsh_command_spawn(command);
-
-	rv = command->status;
-
-	cronsh_log(CRONSH_LOGLEVEL_DEBUG, "status: %d", command->status);
-	cronsh_log(CRONSH_LOGLEVEL_DEBUG, "signal: %d", command->signal);
-	cronsh_log(CRONSH_LOGLEVEL_DEBUG, "stdout: (%d) %s", command->stdoutbuffer.used, command->stdoutbuffer.data);
-	cronsh_log(CRONSH_LOGLEVEL_DEBUG, "stderr: (%d) %s", command->stderrbuffer.used, command->stderrbuffer.data);
-
-	cronsh_command_free(command);
-
-	return rv;
-}
-
-void cronsh_command_spawn(command_t *command) {
-/*
-	- pipes for stdin, stdout, stderr
-	- init the buffers
-	- fork
-	- dup2 for descriptors
-	- execve
-	- select on stdin, stdout, stderr to write to stdin of child, read from stdout, stderr from child, non-blocking
-	- waitpid for child
-	- capture the exit code
-*/
-	pid_t pid;
-	int childstdinfd[2], childstdoutfd[2], childstderrfd[2];
-
-	pipe(childstdinfd);
-	pipe(childstdoutfd);
-	pipe(childstderrfd);
-
-	pid = fork();
-
-	if(pid < 0) {
-		cronsh_log(CRONSH_LOGLEVEL_CRITICAL, "failed spawning child: %s", strerror(errno));
+#ifdef __linux__
+	// the exits of the workers wake us up for reaping them
+	sigemptyset(&sigs);
+	sigaddset(&sigs, SIGCHLD);
+
+	if(sigprocmask(SIG_BLOCK, &sigs, NULL) == 0) {
+		sigfd = signalfd(-1, &sigs, SFD_NONBLOCK | SFD_CLOEXEC);
+		if(sigfd != -1 && eventAdd(&event, sigfd, CRONSH_EVENT_READ, NULL) != 0) {
+			close(sigfd);
+			sigfd = -1;
+		}
 
-		command->status = -1;
+		if(sigfd == -1) {
+			cronsh_log(CRONSH_LOGLEVEL_DEBUG, "no signalfd (%s)", strerror(errno));
 
-		return;
+			sigprocmask(SIG_UNBLOCK, &sigs, NULL);
+		}
 	}
+#endif
 
-	if(pid == 0) {
-		// redirect stdin
-		dup2(childstdinfd[0], 0);
-		close(childstdinfd[1]);
-
-		// redirect stdout
-		close(childstdoutfd[0]);
-		dup2(childstdoutfd[1], 1);
-
-		// redirect stderr
-		close(childstderrfd[0]);
-		dup2(childstderrfd[1], 2);
+	// keep the pipe consumer running if the documents can be told apart
+	if(config.pipe != NULL && config.settings.pipeframe != CRONSH_FRAME_NONE) {
+		consumer.rawcommand = config.pipe;
+		consumer.frame = config.settings.pipeframe;
 
-		execvp(command->argv[0], command->argv);
+		if(asprintf(&consumer.lock, "%s.lock", path) == -1 || (fd = open(consumer.lock, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600)) == -1) {
+			cronsh_log(CRONSH_LOGLEVEL_CRITICAL, "failed creating lock for the consumer: %s", strerror(errno));
 
-		fprintf(stderr, "failed to execute '%s': %s (%d)", command->argv[0], strerror(errno), errno);
+			consumer.rawcommand = NULL;
+		}
+		else {
+			close(fd);
 
-		_exit(-1);
+			cronsh_consumer_start(&event);
+		}
 	}
-	
-	command->pid = pid;
 
-	cronsh_log(CRONSH_LOGLEVEL_DEBUG, "spawned child (%d)", pid);
+	for(;;) {
+		// without a signalfd, wake up once in a while for reaping the workers. A consumer that exited is restarted after a second.
+		timeout = -1;
+		if(sigfd == -1 || (consumer.rawcommand != NULL && consumer.command == NULL)) {
+			timeout = 1000;
+		}
 
-	close(childstdinfd[0]);
-	close(childstdoutfd[1]);
-	close(childstderrfd[1]);
+		n = eventWait(&event, items, CRONSH_EVENT_MAXITEMS, timeout);
 
-	struct timeval timeout;
+#ifdef __linux__
+		// before reaping, so a worker that exits in between wakes us up again
+		if(sigfd != -1) {
+			while(read(sigfd, &info, sizeof(info)) > 0);
+		}
+#endif
 
-	fd_set readfds;
-	fd_set writefds;
+		while((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+			if(consumer.command != NULL && pid == consumer.command->pid) {
+				// the consumer is collected later on
+				consumer.command->status = WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+				consumer.command->signal = WIFSIGNALED(status) ? WTERMSIG(status) : 0;
+				consumer.command->pid = 0;
+			}
+			else {
+				if(WIFSIGNALED(status)) {
+					cronsh_log(CRONSH_LOGLEVEL_NOTICE, "worker (%d) killed by signal %d", pid, WTERMSIG(status));
+				}
+				else {
+					cronsh_log(CRONSH_LOGLEVEL_DEBUG, "worker (%d) exited", pid);
+				}
 
-	size_t stdinbytes = 0;
-	if(command->stdinbuffer != NULL) {
-		stdinbytes = command->stdinbuffer->used;
-	}
-	
-	if(stdinbytes == 0) {
-		close(childstdinfd[1]);
-	}
+				cronsh_consumer_check(&event, pid);
+			}
+		}
 
-	int rv, bytes, nfds;
-	char buffer[64 * 1024];
+		if(n == -1) {
+			if(errno == EINTR) {
+				continue;
+			}
 
-	while(1) {
-		FD_ZERO(&readfds);
-		FD_ZERO(&writefds);
+			cronsh_log(CRONSH_LOGLEVEL_CRITICAL, "waiting for events failed: %s", strerror(errno));
 
-		FD_SET(childstdoutfd[0], &readfds);
-		FD_SET(childstderrfd[0], &readfds);
-		
-		nfds = 0;
-		nfds = (childstdoutfd[0] > nfds) ? childstdoutfd[0] : nfds;
-		nfds = (childstderrfd[0] > nfds) ? childstderrfd[0] : nfds;
-		
-		if(stdinbytes != 0) {
-			FD_SET(childstdinfd[1], &writefds);
-			
-			nfds = (childstdinfd[1] > nfds) ? childstdinfd[1] : nfds;
+			break;
 		}
-		
-		timeout.tv_sec = 1;
-		timeout.tv_usec = 0;
 
-		rv = select(nfds + 1, &readfds, &writefds, NULL, &timeout);
-		if(rv == 0) {
-			continue;
-		}
+		for(i = 0; i < n; i++) {
+			// the workers have been reaped already
+			if(items[i].fd == sigfd) {
+				continue;
+			}
+
+			if(items[i].fd != listenfd) {
+				if(consumer.command != NULL && items[i].data == consumer.command) {
+					cronsh_consumer_handle(&event, items[i].fd, items[i].events);
+				}
 
-		if(rv == -1) {
-			if(errno == EAGAIN) {
 				continue;
 			}
 
-			cronsh_log(CRONSH_LOGLEVEL_CRITICAL, "select failed: %s", strerror(errno));
+			while((fd = accept4(listenfd, NULL, NULL, SOCK_CLOEXEC)) != -1) {
+				pid = fork();
+				if(pid == 0) {
+					close(listenfd);
+					eventFree(&event);
 
-			break;
-		}
+#ifdef __linux__
+					if(sigfd != -1) {
+						close(sigfd);
+						sigprocmask(SIG_UNBLOCK, &sigs, NULL);
+					}
+#endif
+
+					// the worker only writes to the consumer
+					if(consumer.command != NULL) {
+						close(consumer.command->stdoutfd);
+						close(consumer.command->stderrfd);
+						close(consumer.command->pidfd);
+					}
 
-		if(stdinbytes != 0) {
-			if(FD_ISSET(childstdinfd[1], &writefds)) {
-				bytes = write(childstdinfd[1], &command->stdinbuffer->data[command->stdinbuffer->used - stdinbytes], stdinbytes);
-				if(bytes > 0) {
-					stdinbytes -= bytes;
+					_exit(cronsh_daemon_worker(fd));
 				}
 
-				if(stdinbytes == 0) {
-					close(childstdinfd[1]);
+				if(pid < 0) {
+					cronsh_log(CRONSH_LOGLEVEL_CRITICAL, "failed spawning worker: %s", strerror(errno));
+				}
+				else {
+					cronsh_log(CRONSH_LOGLEVEL_DEBUG, "spawned worker (%d)", pid);
 				}
-			}
-		}
 
-		if(FD_ISSET(childstdoutfd[0], &readfds)) {
-			bytes = read(childstdoutfd[0], buffer, sizeof(buffer));
-			if(bytes > 0) {
-				bufferAppendBytes(&command->stdoutbuffer, buffer, bytes);
-			}
-			else {
-				break;
+				close(fd);
 			}
 		}
 
-		if(FD_ISSET(childstderrfd[0], &readfds)) {
-			bytes = read(childstderrfd[0], buffer, sizeof(buffer));
-			if(bytes > 0) {
-				bufferAppendBytes(&command->stderrbuffer, buffer, bytes);
-			}
-			else {
-				break;
-			}
+		if(consumer.rawcommand != NULL && consumer.command == NULL && time(NULL) > consumer.started) {
+			cronsh_consumer_start(&event);
 		}
 	}
 
-	close(childstdoutfd[0]);
-	close(childstderrfd[0]);
+	eventFree(&event);
+
+	if(sigfd != -1) {
+		close(sigfd);
+	}
 
-	cronsh_log(CRONSH_LOGLEVEL_DEBUG, "waitpid(%d)", pid);
+	close(listenfd);
+	unlink(path);
 
-	int status;
+	return -1;
+}
 
-	wait4(pid, &status, 0, &command->rusage);
+static int cronsh_daemon_peer(int fd) {
+#ifdef SO_PEERCRED
+	struct ucred cred;
+	socklen_t len = sizeof(cred);
 
-	if(WIFEXITED(status)) {
-		command->status = WEXITSTATUS(status);
-	}
-	else {
-		command->status = -1;
+	if(getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) != 0) {
+		return -1;
 	}
 
-	if(WIFSIGNALED(status)) {
-		command->signal = WTERMSIG(status);
+	return (cred.uid == getuid()) ? 0 : -1;
+#else
+	uid_t uid;
+	gid_t gid;
+
+	if(getpeereid(fd, &uid, &gid) != 0) {
+		return -1;
 	}
 
-	return;
+	return (uid == getuid()) ? 0 : -1;
+#endif
 }
 
-void cronsh_init(void) {
-	char *env;
+static int cronsh_daemon_worker(int fd) {
+/*
+	- receive stdout and stderr of the client together with the first bytes
+	- read the rest of the request: rawcommand, cwd, and the environment, each terminated by \0
+	- acknowledge and run the command in the client's environment
+*/
+	int i, fds[2];
+	ssize_t bytes;
+	char *p, *end, *rawcommand, *cwd;
+	buffer_t request;
+	struct iovec iov;
+	struct msghdr msg;
+	struct cmsghdr *cmsg;
+	union {
+		char buf[CMSG_SPACE(sizeof(fds))];
+		struct cmsghdr align;
+	} control;
+
+	if(cronsh_daemon_peer(fd) != 0) {
+		cronsh_log(CRONSH_LOGLEVEL_CRITICAL, "rejected a request from a different user");
 
-	memset(&config, 0, sizeof(config_t));
-	
-	config.pid = getpid();
+		return 1;
+	}
 
+	if(bufferInit(&request, 4096) != 0) {
+		return 1;
+	}
 
-	/* DEBUG */
+	iov.iov_base = request.data;
+	iov.iov_len = request.size - 1;
 
-	env = getenv("CRONSH_LOGLEVEL");
-	if(env != NULL) {
-		if(!strcmp("debug", env)) {
-			config.loglevel = CRONSH_LOGLEVEL_DEBUG;
-		}
-		else if(!strcmp("notice", env)) {
-			config.loglevel = CRONSH_LOGLEVEL_NOTICE;
-		}
-		else if(!strcmp("critical", env)) {
-			config.loglevel = CRONSH_LOGLEVEL_CRITICAL;
-		}
-		else {
-			config.loglevel = CRONSH_LOGLEVEL_DEFAULT;
-		}
-	}
-	else {
-		config.loglevel = CRONSH_LOGLEVEL_DEFAULT;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control.buf;
+	msg.msg_controllen = sizeof(control.buf);
+
+	do {
+		bytes = recvmsg(fd, &msg, MSG_CMSG_CLOEXEC);
+	} while(bytes == -1 && errno == EINTR);
+
+	// e.g. another daemon that checks whether this one is still running
+	if(bytes == 0) {
+		cronsh_log(CRONSH_LOGLEVEL_DEBUG, "connection closed without a request");
+
+		return 1;
 	}
 
-	env = getenv("CRONSH_LOG");
-	if(env != NULL) {
-		config.log = strdup(env);
-		config.logfp = fopen(config.log, "a");
+	if(bytes < 0) {
+		cronsh_log(CRONSH_LOGLEVEL_CRITICAL, "failed receiving request: %s", strerror(errno));
+
+		return 1;
 	}
 
-	cronsh_log(CRONSH_LOGLEVEL_DEBUG, "init start");
+	request.used = bytes;
+	request.data[request.used] = '\0';
 
+	// without the client's stdout and stderr the output would end up with the daemon's
+	cmsg = CMSG_FIRSTHDR(&msg);
+	if((msg.msg_flags & MSG_CTRUNC) != 0 || cmsg == NULL || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS || cmsg->cmsg_len != CMSG_LEN(sizeof(fds))) {
+		cronsh_log(CRONSH_LOGLEVEL_CRITICAL, "rejected a request without stdout and stderr");
 
-	/* SHELL */
+		return 1;
+	}
 
-	env = getenv("CRONSH_SHELL");
-	if(env != NULL) {
-		config.shell = strdup(env);
+	memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+
+	for(i = 0; i < 2; i++) {
+		dup2(fds[i], i + 1);
+		close(fds[i]);
 	}
-	else {
-		config.shell = CRONSH_SHELL_DEFAULT;
+
+	while((bytes = bufferRead(&request, fd, 4096)) != 0) {
+		if(bytes == -1) {
+			if(errno == EINTR) {
+				continue;
+			}
+
+			cronsh_log(CRONSH_LOGLEVEL_CRITICAL, "failed receiving request: %s", strerror(errno));
+
+			return 1;
+		}
 	}
 
-	cronsh_log(CRONSH_LOGLEVEL_DEBUG, "SHELL: %s", config.shell);
+	p = request.data;
+	end = &request.data[request.used];
 
+	rawcommand = p;
+	p += strlen(p) + 1;
 
-	/* FILE */
+	if(p >= end) {
+		cronsh_log(CRONSH_LOGLEVEL_CRITICAL, "incomplete request");
 
-	env = getenv("CRONSH_FILE");
-	if(env != NULL) {
-		config.file = strdup(env);
-		cronsh_log(CRONSH_LOGLEVEL_DEBUG, "FILE: %s", config.file);
+		return 1;
 	}
 
+	cwd = p;
+	p += strlen(p) + 1;
 
-	/* PIPE */
+	// the strings stay in the request buffer for as long as the worker lives
+	clearenv();
 
-	env = getenv("CRONSH_PIPE");
-	if(env != NULL) {
-		config.pipe = strdup(env);
-		cronsh_log(CRONSH_LOGLEVEL_DEBUG, "PIPE: %s", config.pipe);
+	while(p < end) {
+		putenv(p);
+		p += strlen(p) + 1;
 	}
-	
-	
-	/* OPTIONS */
-	
-	env = getenv("CRONSH_OPTIONS");
-	if(env != NULL) {
-		config.options = cronsh_options(CRONSH_OPTION_NONE, env);
+
+	// relative paths in the command must not act on the daemon's directory
+	if(chdir(cwd) != 0) {
+		cronsh_log(CRONSH_LOGLEVEL_CRITICAL, "rejected a request, failed changing into %s: %s", cwd, strerror(errno));
+
+		return 1;
 	}
-	else {
-		config.options = CRONSH_OPTION_NONE;
+
+	if(write(fd, "OK", 2) != 2) {
+		return 1;
 	}
-	
-	cronsh_log(CRONSH_LOGLEVEL_DEBUG, "OPTIONS: %d", config.options);
 
+	close(fd);
 
-	/* HOSTNAME */
+	cronsh_init();
 
-	env = getenv("CRONSH_HOSTNAME");
-	if(env != NULL) {
-		strncpy(config.thishostname, env, sizeof(config.thishostname));
-	}
-	else if(gethostname(config.thishostname, sizeof(config.thishostname)) != 0) {
-		strncpy(config.thishostname, "unknown", sizeof(config.thishostname));
-	}
+	cronsh_run(rawcommand);
 
-	config.thishostname[sizeof(config.thishostname) - 1] = '\0';
+	// the worker leaves with _exit()
+	fflush(stdout);
 
-	cronsh_log(CRONSH_LOGLEVEL_DEBUG, "HOSTNAME: %s", config.thishostname);
-	
+	return 0;
+}
 
-	/* USER */
-	
-	env = getenv("USER");
-	if(env != NULL) {
-		strncpy(config.thisuser, env, sizeof(config.thisuser));
+static int cronsh_consumer_start(event_t *event) {
+	int flags;
+
+	consumer.started = time(NULL);
+
+	consumer.command = cronsh_command_init(consumer.rawcommand, NULL);
+	if(consumer.command == NULL) {
+		return -1;
 	}
-	else {
-		env = getenv("LOGNAME");
-		if(env != NULL) {
-			strncpy(config.thisuser, env, sizeof(config.thisuser));
-		}
-		else {
-			strncpy(config.thisuser, "unknown", sizeof(config.thisuser));
-		}
+
+	consumer.command->stdinstream = 1;
+
+	if(cronsh_command_start(consumer.command, event) != 0) {
+		cronsh_command_free(consumer.command);
+		consumer.command = NULL;
+
+		return -1;
 	}
 
-	config.thisuser[sizeof(config.thisuser) - 1] = '\0';
-	
-	cronsh_log(CRONSH_LOGLEVEL_DEBUG, "USER: %s", config.thisuser);
+	// only the workers write to the consumer and they are fine with blocking
+	consumer.fd = consumer.command->stdinfd;
 
+	flags = fcntl(consumer.fd, F_GETFL);
+	if(flags != -1) {
+		fcntl(consumer.fd, F_SETFL, flags & ~O_NONBLOCK);
+	}
 
-	cronsh_log(CRONSH_LOGLEVEL_DEBUG, "init done");
+	cronsh_log(CRONSH_LOGLEVEL_NOTICE, "started consumer (%d): %s", consumer.command->pid, consumer.rawcommand);
 
-	return;
+	return 0;
 }
 
-command_t *cronsh_command_init(const char *rawcommand, buffer_t *stdinbuffer) {
-	if(rawcommand == NULL) {
-		cronsh_log(CRONSH_LOGLEVEL_CRITICAL, "No command given.");
+static void cronsh_consumer_handle(event_t *event, int fd, unsigned int events) {
+	command_t *command = consumer.command;
 
-		return NULL;
+	cronsh_command_handle(command, event, fd, events);
+
+	// the output of the consumer is only logged
+	if(command->stdoutbuffer.used != 0) {
+		cronsh_log(CRONSH_LOGLEVEL_DEBUG, "consumer stdout: (%d) %s", command->stdoutbuffer.used, command->stdoutbuffer.data);
+		bufferReset(&command->stdoutbuffer);
 	}
-	
-	command_t *command = (command_t *)calloc(1, sizeof(command_t));
-	if(command == NULL) {
-		cronsh_log(CRONSH_LOGLEVEL_CRITICAL, "Not enough memory for command structure!");
 
-		return NULL;
+	if(command->stderrbuffer.used != 0) {
+		cronsh_log(CRONSH_LOGLEVEL_DEBUG, "consumer stderr: (%d) %s", command->stderrbuffer.used, command->stderrbuffer.data);
+		bufferReset(&command->stderrbuffer);
 	}
-	
-	command->ppid = config.pid;
 
-	/*
-		behavior
+	if(cronsh_command_running(command)) {
+		return;
+	}
 
-		look for '#' and split the command there.
-		if '#' is escaped with '\', don't split there.
-		unescape escaped '#'.
+	cronsh_command_wait(command);
 
-		-> command, hash-options
+	cronsh_log(CRONSH_LOGLEVEL_NOTICE, "consumer exited (status %d, signal %d), restarting it", command->status, command->signal);
 
-		strip trailing spaces from the command.
-		execute command with /bin/sh -c 'command'.
-		parse hash-options.
-	*/
+	cronsh_command_free(command);
 
-	int len = strlen(rawcommand);
+	consumer.command = NULL;
+	consumer.fd = -1;
 
-	char *tcommand = (char *)calloc(len + 1, sizeof(char));
-	if(tcommand == NULL) {
-		cronsh_log(CRONSH_LOGLEVEL_CRITICAL, "Not enough memory for temporary command string!");
+	return;
+}
 
-		return NULL;
+// The consumer and the worker named in the lock, 0 if no document is being written
+static pid_t cronsh_consumer_writer(int fd, pid_t *command) {
+	char line[64];
+	ssize_t n;
+	int c, w;
+
+	n = pread(fd, line, sizeof(line) - 1, 0);
+	if(n <= 0) {
+		return 0;
 	}
 
-	command->argv[0] = config.shell;
-	command->argv[1] = "-c";
-	command->argv[2] = NULL;
-	command->argv[3] = NULL;
+	line[n] = '\0';
 
-	char *hashoptions = NULL;
+	if(sscanf(line, "%d %d", &c, &w) != 2) {
+		return 0;
+	}
 
-	int i = 0, j = 0;
-	for(i = 0; i < len; i++) {
-		if(rawcommand[i] == '\\' && rawcommand[i + 1] == '#') {
-			i++;
+	*command = c;
 
-			tcommand[j++] = '#';
+	return w;
+}
 
-			continue;
-		}
-		else if(rawcommand[i] == '#') {
-			if(hashoptions == NULL) {
-				hashoptions = &tcommand[j];
-			}
-		}
+/*
+	A worker that went away while it was writing to the consumer left a partial document
+	behind. The consumer is abandoned, the workers that still have it stop writing to it,
+	and a new one is started.
+*/
+static void cronsh_consumer_check(event_t *event, pid_t pid) {
+	int fd;
+	pid_t writer, command = 0;
 
-		tcommand[j++] = rawcommand[i];
+	if(consumer.command == NULL || consumer.lock == NULL) {
+		return;
 	}
 
-	if(hashoptions != NULL) {
-		char *options = NULL;
+	fd = open(consumer.lock, O_RDONLY | O_CLOEXEC);
+	if(fd == -1) {
+		return;
+	}
 
-		if(hashoptions[0] == '#') {
-			char *tag = &hashoptions[1];
+	writer = cronsh_consumer_writer(fd, &command);
 
-			len = strlen(hashoptions);
-			for(i = 0; i < len; i++) {
-				if(isspace(hashoptions[i])) {
-					hashoptions[i] = '\0';
-					options = &hashoptions[i + 1];
-					break;
-				}
-			}
+	close(fd);
 
-			if(strlen(tag) != 0) {
-				command->tag = strdup(tag);
-			}
-		}
-		else {
-			options = hashoptions;
+	if(writer != pid || command != consumer.command->pid) {
+		return;
+	}
+
+	cronsh_log(CRONSH_LOGLEVEL_NOTICE, "worker (%d) went away in the middle of a document, restarting the consumer (%d)", pid, command);
+
+	// it sees the end of its input once the other workers are done with it, and is reaped like them
+	cronsh_command_close(event, &consumer.command->stdinfd);
+	cronsh_command_close(event, &consumer.command->stdoutfd);
+	cronsh_command_close(event, &consumer.command->stderrfd);
+	cronsh_command_close(event, &consumer.command->pidfd);
+
+	cronsh_command_free(consumer.command);
+
+	consumer.command = NULL;
+	consumer.fd = -1;
+	consumer.started = 0;
+
+	return;
+}
+
+// Write a complete document with its frame
+static int cronsh_frame_write(sink_t *sink, int frame, const char *bytes, size_t nbytes) {
+	char header[32];
+	struct iovec iov[2];
+
+	switch(frame) {
+		case CRONSH_FRAME_LENGTH:
+			iov[0].iov_base = header;
+			iov[0].iov_len = snprintf(header, sizeof(header), "%lu\n", (unsigned long)nbytes);
+			iov[1].iov_base = (void *)bytes;
+			iov[1].iov_len = nbytes;
+
+			return sinkWritev(sink, iov, 2);
+		case CRONSH_FRAME_NUL:
+			iov[0].iov_base = (void *)bytes;
+			iov[0].iov_len = nbytes;
+			iov[1].iov_base = "";
+			iov[1].iov_len = 1;
+
+			return sinkWritev(sink, iov, 2);
+	}
+
+	return sinkWrite(sink, bytes, nbytes);
+}
+
+// Write a report with its frame. Only the length frame needs the report in memory.
+static int cronsh_frame_send(sink_t *sink, int frame, report_t *report) {
+	int rv;
+	buffer_t buffer;
+
+	if(frame == CRONSH_FRAME_LENGTH) {
+		bufferInit(&buffer, CRONSH_BUFFER_STEPSIZE);
+
+		rv = cronsh_report(&buffer, report);
+		if(rv == 0) {
+			rv = cronsh_frame_write(sink, frame, buffer.data, buffer.used);
 		}
 
-		cronsh_log(CRONSH_LOGLEVEL_DEBUG, "options: %s", (options != NULL) ? options : "");
-	
-		// set the individual options
-		command->options = cronsh_options(config.options, options);
+		bufferFree(&buffer);
 
-		hashoptions[0] = '\0';
+		return rv;
 	}
-	else {
-		command->options = config.options;
+
+	rv = cronsh_send(sink, report);
+	if(rv == 0 && frame == CRONSH_FRAME_NUL) {
+		rv = sinkWrite(sink, "", 1);
 	}
 
-	len = strlen(tcommand);
-	for(i = (len - 1); i > 0; i--) {
-		if(!isspace(tcommand[i])) {
-			break;
-		}
+	return rv;
+}
 
-		tcommand[i] = '\0';
+/*
+	The workers of the daemon take turns in writing to the consumer. The writer leaves the
+	consumer and itself in the lock until its document is complete. If a previous writer
+	didn't get that far, the consumer is refused.
+*/
+static int cronsh_consumer_lock(void) {
+	int lockfd, err, n;
+	char line[64];
+	pid_t command = 0;
+
+	if(consumer.command == NULL) {
+		errno = EPIPE;
+		return -1;
 	}
 
-	command->argv[2] = strdup(tcommand);
+	lockfd = open(consumer.lock, O_RDWR | O_CLOEXEC);
+	if(lockfd == -1) {
+		return -1;
+	}
 
-	free(tcommand);
+	while(flock(lockfd, LOCK_EX) == -1) {
+		if(errno != EINTR) {
+			err = errno;
+			close(lockfd);
+			errno = err;
 
-	for(i = 0; command->argv[i] != NULL; i++) {
-		cronsh_log(CRONSH_LOGLEVEL_DEBUG, "argv[%d]: %s", i, command->argv[i]);
+			return -1;
+		}
 	}
 
-	command->stdinbuffer = stdinbuffer;
-	bufferInit(&command->stdoutbuffer, CRONSH_BUFFER_STEPSIZE);
-	bufferInit(&command->stderrbuffer, CRONSH_BUFFER_STEPSIZE);
+	if(cronsh_consumer_writer(lockfd, &command) != 0 && command == consumer.command->pid) {
+		close(lockfd);
+		errno = EPIPE;
 
-	return command;
-}
+		return -1;
+	}
 
-void cronsh_command_free(command_t *command) {
-	if(command == NULL) {
-		return;
+	n = snprintf(line, sizeof(line), "%d %d\n", consumer.command->pid, (int)getpid());
+
+	if(ftruncate(lockfd, 0) != 0 || pwrite(lockfd, line, n, 0) != n) {
+		err = errno;
+		close(lockfd);
+		errno = err;
+
+		return -1;
 	}
-	
-	bufferFree(&command->stdoutbuffer);
-	bufferFree(&command->stderrbuffer);
 
-	if(command->argv[2] != NULL) {
-		free(command->argv[2]);
+	return lockfd;
+}
+
+// A document that wasn't written completely stays in the lock
+static void cronsh_consumer_unlock(int lockfd, int complete) {
+	if(complete != 0 && ftruncate(lockfd, 0) != 0) {
+		cronsh_log(CRONSH_LOGLEVEL_DEBUG, "failed clearing the lock of the consumer");
 	}
 
-	free(command);
-	
+	close(lockfd);
+
 	return;
 }
 
-unsigned int cronsh_options(unsigned int inoptions, const char *options) {
-	int negate, exclusive;
-	unsigned int outoptions = inoptions, toption;
-	char *ref, *string, *token;
+// Write a framed document to the consumer of the daemon. The document is rendered before the lock is taken.
+static int cronsh_consumer_send(report_t *report) {
+	int rv, lockfd, err;
+	buffer_t buffer;
+	sink_t sink;
 
-	if(options == NULL) {
-		return outoptions;
+	bufferInit(&buffer, CRONSH_BUFFER_STEPSIZE);
+
+	if(cronsh_report(&buffer, report) != 0) {
+		bufferFree(&buffer);
+
+		return -1;
 	}
-	
-	ref = string = strdup(options);
-	if(ref == NULL) {
-		return outoptions;
+
+	lockfd = cronsh_consumer_lock();
+	if(lockfd == -1) {
+		err = errno;
+		bufferFree(&buffer);
+		errno = err;
+
+		return -1;
 	}
-	
-	/*
-		silent, !silent
-		// default cron behaviour. silent if no stdout and stderr
-		crondefault, !crondefault
-		// what to capture
-		capture-stdout, !capture-stdout
-		capture-stderr, !capture-stderr
-		capture-all, !capture-all
-		// where to send to
-		sendto-stdout, !sendto-stdout
-		sendto-file, !sendto-file
-		sendto-pipe, !sendto-pipe
-		sendto-all, !sendto-all
-		sendto-fallback, !sendto-fallback
-		// when to send
-		sendif-status, !sendif-status
-		sendif-status-ok, !sendif-status-ok
-		sendif-status-any, !sendif-status-any
-		sendif-signal, !sendif-signal
-		sendif-signal-ok, !sendif-signal-ok
-		sendif-signal-any, !sendif-signal-any
-		sendif-stdout, !sendif-stdout
-		sendif-stdout-none, !sendif-stdout-none
-		sendif-stdout-any, !sendif-stdout-any
-		sendif-stderr, !sendif-stderr
-		sendif-stderr-none, !sendif-stderr-none
-		sendif-stderr-any, !sendif-stderr-any
-		sendif-any, !sendif-any
-	*/
 
-	while((token = strsep(&string, " ")) != NULL) {
-		negate = 0;
-		exclusive = 0;
+	sinkInitFD(&sink, consumer.fd);
 
-		if(token[0] == '!' || token[0] == '*') {
-			if(token[0] == '!') {
-				negate = 1;
-			}
-			else if(token[0] == '*') {
-				exclusive = 1;
-			}
+	rv = cronsh_frame_write(&sink, consumer.frame, buffer.data, buffer.used);
 
-			token = &token[1];
-		}
+	err = errno;
 
-		if(strlen(token) == 0) {
-			continue;
-		}
-		
-		if(!strcmp(token, "silent")) { toption = CRONSH_OPTION_SILENT; }
-		else if(!strcmp(token, "crondefault")) { toption = CRONSH_OPTION_CRONDEFAULT; }
+	cronsh_consumer_unlock(lockfd, rv == 0);
+	bufferFree(&buffer);
 
-		else if(!strcmp(token, "capture-stdout")) { toption = CRONSH_OPTION_CAPTURE_STDOUT; }
-		else if(!strcmp(token, "capture-stderr")) { toption = CRONSH_OPTION_CAPTURE_STDERR; }
-		else if(!strcmp(token, "capture-all")) { toption = CRONSH_OPTION_CAPTURE_ALL; }
+	errno = err;
 
-		else if(!strcmp(token, "sendto-stdout")) { toption = CRONSH_OPTION_SENDTO_STDOUT; }
-		else if(!strcmp(token, "sendto-file")) { toption = CRONSH_OPTION_SENDTO_FILE; }
-		else if(!strcmp(token, "sendto-pipe")) { toption = CRONSH_OPTION_SENDTO_PIPE; }
-		else if(!strcmp(token, "sendto-all")) { toption = CRONSH_OPTION_SENDTO_ALL; }
-		else if(!strcmp(token, "sendto-fallback")) { toption = CRONSH_OPTION_SENDTO_FALLBACK; }
+	return (rv == 0) ? 0 : -1;
+}
 
-		else if(!strcmp(token, "sendif-status")) { toption = CRONSH_OPTION_SENDIF_STATUS; }
-		else if(!strcmp(token, "sendif-status-ok")) { toption = CRONSH_OPTION_SENDIF_STATUS_OK; }
-		else if(!strcmp(token, "sendif-status-any")) { toption = CRONSH_OPTION_SENDIF_STATUS_ANY; }
+static int cronsh_consumer_write(const char *bytes, size_t nbytes) {
+	int rv, lockfd, err;
+	sink_t sink;
 
-		else if(!strcmp(token, "sendif-signal")) { toption = CRONSH_OPTION_SENDIF_SIGNAL; }
-		else if(!strcmp(token, "sendif-signal-ok")) { toption = CRONSH_OPTION_SENDIF_SIGNAL_OK; }
-		else if(!strcmp(token, "sendif-signal-any")) { toption = CRONSH_OPTION_SENDIF_SIGNAL_ANY; }
+	lockfd = cronsh_consumer_lock();
+	if(lockfd == -1) {
+		return -1;
+	}
 
-		else if(!strcmp(token, "sendif-stdout")) { toption = CRONSH_OPTION_SENDIF_STDOUT; }
-		else if(!strcmp(token, "sendif-stdout-none")) { toption = CRONSH_OPTION_SENDIF_STDOUT_NONE; }
-		else if(!strcmp(token, "sendif-stdout-any")) { toption = CRONSH_OPTION_SENDIF_STDOUT_ANY; }
+	sinkInitFD(&sink, consumer.fd);
 
-		else if(!strcmp(token, "sendif-stderr")) { toption = CRONSH_OPTION_SENDIF_STDERR; }
-		else if(!strcmp(token, "sendif-stderr-none")) { toption = CRONSH_OPTION_SENDIF_STDERR_NONE; }
-		else if(!strcmp(token, "sendif-stderr-any")) { toption = CRONSH_OPTION_SENDIF_STDERR_ANY; }
-		
-		else if(!strcmp(token, "sendif-any")) { toption = CRONSH_OPTION_SENDIF_ANY; }
+	rv = cronsh_frame_write(&sink, consumer.frame, bytes, nbytes);
 
-		else {
-			toption = CRONSH_OPTION_NONE;
-			cronsh_log(CRONSH_LOGLEVEL_NOTICE, "unknown option: %s", token);
-		}
-		
-		if(negate == 1) {
-			outoptions &= ~toption;
-		}
-		else if(exclusive == 1) {
-			outoptions = toption;
-		}
-		else {
-			outoptions |= toption;
-		}
-	}
-	
-	free(ref);
+	err = errno;
 
-	return outoptions;
+	cronsh_consumer_unlock(lockfd, rv == 0);
+
+	errno = err;
+
+	return (rv == 0) ? 0 : -1;
 }
 
-void cronsh_log(int loglevel, const char *format, ...) {
-	char message[1024 + 1], *l;
-	va_list ap;
+// Returns 0 if the daemon accepted the command, 1 if there's no daemon, and -1 if the hand over failed
+int cronsh_submit(const char *path, const char *rawcommand) {
+	int fd, fds[2] = {1, 2};
+	char ack[2], *cwd;
+	char **env;
+	buffer_t request;
+	struct sockaddr_un addr;
+	struct iovec iov;
+	struct msghdr msg;
+	struct cmsghdr *cmsg;
+	union {
+		char buf[CMSG_SPACE(sizeof(fds))];
+		struct cmsghdr align;
+	} control;
+	sink_t sink;
+	ssize_t bytes;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+
+	if(strlen(path) >= sizeof(addr.sun_path)) {
+		cronsh_log(CRONSH_LOGLEVEL_NOTICE, "socket path too long: %s", path);
 
-	if(loglevel < config.loglevel) {
-		return;
+		return 1;
 	}
 
-	if(config.logfp == NULL) {
-		config.logfp = stderr;
+	strcpy(addr.sun_path, path);
+
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if(fd == -1) {
+		return 1;
 	}
-	
-	time_t clock = time(NULL);
-	struct tm timeptr;
-	char datetime[32];
 
-	gmtime_r(&clock, &timeptr);
-	strftime(datetime, sizeof(datetime), "%F %T", &timeptr);
+	if(connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+		cronsh_log(CRONSH_LOGLEVEL_NOTICE, "no daemon on %s (%s), running the command myself", path, strerror(errno));
 
-	va_start(ap, format);
-	vsnprintf(message, sizeof(message), format, ap);
-	va_end(ap);
+		close(fd);
 
-	switch(loglevel) {
-		case CRONSH_LOGLEVEL_DEBUG: l = "DEBUG"; break;
-		case CRONSH_LOGLEVEL_NOTICE: l = "NOTICE"; break;
-		case CRONSH_LOGLEVEL_CRITICAL: l = "CRITICAL"; break;
-		default: l = "UNKNOWN"; break;
+		return 1;
 	}
 
-	fprintf(config.logfp, "[%s] %s %u: %s\n", datetime, l, config.pid, message);
-	
-	fflush(config.logfp);
+	bufferInit(&request, 4096);
 
-	return;
-}
+	bufferAppendBytes(&request, rawcommand, strlen(rawcommand) + 1);
 
-void cronsh_help(void) {
-	fprintf(stderr, "NAME\n");
-	fprintf(stderr, "\tcronsh - a shell for executing cron jobs\n");
-	fprintf(stderr, "\n");
+	cwd = getcwd(NULL, 0);
+	if(cwd != NULL) {
+		bufferAppendBytes(&request, cwd, strlen(cwd) + 1);
+		free(cwd);
+	}
+	else {
+		bufferAppendBytes(&request, "/", 2);
+	}
+
+	for(env = environ; *env != NULL; env++) {
+		bufferAppendBytes(&request, *env, strlen(*env) + 1);
+	}
+
+	// the first byte carries our stdout and stderr
+	iov.iov_base = request.data;
+	iov.iov_len = 1;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control.buf;
+	msg.msg_controllen = sizeof(control.buf);
+
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+	memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+	do {
+		bytes = sendmsg(fd, &msg, 0);
+	} while(bytes == -1 && errno == EINTR);
+
+	sinkInitFD(&sink, fd);
+
+	if(bytes != 1 || sinkWrite(&sink, &request.data[1], request.used - 1) != 0 || shutdown(fd, SHUT_WR) != 0) {
+		cronsh_log(CRONSH_LOGLEVEL_CRITICAL, "failed handing the command over to the daemon: %s", strerror(errno));
+
+		bufferFree(&request);
+		close(fd);
+
+		return -1;
+	}
+
+	bufferFree(&request);
+
+	do {
+		bytes = recv(fd, ack, sizeof(ack), MSG_WAITALL);
+	} while(bytes == -1 && errno == EINTR);
+
+	close(fd);
+
+	if(bytes != 2 || memcmp(ack, "OK", 2) != 0) {
+		cronsh_log(CRONSH_LOGLEVEL_CRITICAL, "the daemon didn't accept the command");
+
+		return -1;
+	}
+
+	cronsh_log(CRONSH_LOGLEVEL_DEBUG, "handed the command over to the daemon");
+
+	return 0;
+}
+
+void cronsh_command_options(command_t *command) {
+	cronsh_log(CRONSH_LOGLEVEL_DEBUG, "tag: %s", (command->tag != NULL) ? command->tag : "[none]");
+
+	cronsh_log(CRONSH_LOGLEVEL_DEBUG, "options: %d", command->options);
+	cronsh_log(CRONSH_LOGLEVEL_DEBUG, "   silent                      = %s", CRONSH_OPTION(command->options, SILENT) ? "yes" : "no");
+	cronsh_log(CRONSH_LOGLEVEL_DEBUG, "   crondefault                 = %s", CRONSH_OPTION(command->options, CRONDEFAULT) ? "yes" : "no");
+	cronsh_log(CRONSH_LOGLEVEL_DEBUG, "   capture stdout              = %s", CRONSH_OPTION(command->options, CAPTURE_STDOUT) ? "yes" : "no");
+	cronsh_log(CRONSH_LOGLEVEL_DEBUG, "   capture stderr              = %s", CRONSH_OPTION(command->options, CAPTURE_STDERR) ? "yes" : "no");
+	cronsh_log(CRONSH_LOGLEVEL_DEBUG, "   capture to spool            = %s", CRONSH_OPTION(command->options, CAPTURE_SPOOL) ? "yes" : "no");
+	cronsh_log(CRONSH_LOGLEVEL_DEBUG, "   capture timeline            = %s", CRONSH_OPTION(command->options, CAPTURE_TIMELINE) ? "yes" : "no");
+	cronsh_log(CRONSH_LOGLEVEL_DEBUG, "   profile                     = %s", CRONSH_OPTION(command->options, PROFILE) ? "yes" : "no");
+	cronsh_log(CRONSH_LOGLEVEL_DEBUG, "   cgroup                      = %s", CRONSH_OPTION(command->options, CGROUP) ? "yes" : "no");
+	cronsh_log(CRONSH_LOGLEVEL_DEBUG, "   kill group                  = %s", CRONSH_OPTION(command->options, KILL_GROUP) ? "yes" : "no");
+	cronsh_log(CRONSH_LOGLEVEL_DEBUG, "   direct exec                 = %s", CRONSH_OPTION(command->options, DIRECT_EXEC) ? "yes" : "no");
+	cronsh_log(CRONSH_LOGLEVEL_DEBUG, "   send to stdout              = %s", CRONSH_OPTION(command->options, SENDTO_STDOUT) ? "yes" : "no");
+	cronsh_log(CRONSH_LOGLEVEL_DEBUG, "   send to log                 = %s", CRONSH_OPTION(command->options, SENDTO_FILE) ? "yes" : "no");
+	cronsh_log(CRONSH_LOGLEVEL_DEBUG, "   send to pipe                = %s", CRONSH_OPTION(command->options, SENDTO_PIPE) ? "yes" : "no");
+	cronsh_log(CRONSH_LOGLEVEL_DEBUG, "   send to fallback            = %s", CRONSH_OPTION(command->options, SENDTO_FALLBACK) ? "yes" : "no");
+	cronsh_log(CRONSH_LOGLEVEL_DEBUG, "   stream                      = %s", CRONSH_OPTION(command->options, STREAM) ? "yes" : "no");
+	cronsh_log(CRONSH_LOGLEVEL_DEBUG, "   send if status is not 0     = %s", CRONSH_OPTION(command->options, SENDIF_STATUS) ? "yes" : "no");
+	cronsh_log(CRONSH_LOGLEVEL_DEBUG, "   send if status is 0         = %s", CRONSH_OPTION(command->options, SENDIF_STATUS_OK) ? "yes" : "no");
+	cronsh_log(CRONSH_LOGLEVEL_DEBUG, "   send if status is anything  = %s", CRONSH_OPTION(command->options, SENDIF_STATUS_ANY) ? "yes" : "no");
+	cronsh_log(CRONSH_LOGLEVEL_DEBUG, "   send if signal is not 0     = %s", CRONSH_OPTION(command->options, SENDIF_SIGNAL) ? "yes" : "no");
+	cronsh_log(CRONSH_LOGLEVEL_DEBUG, "   send if signal is 0         = %s", CRONSH_OPTION(command->options, SENDIF_SIGNAL_OK) ? "yes" : "no");
+	cronsh_log(CRONSH_LOGLEVEL_DEBUG, "   send if signal is anything  = %s", CRONSH_OPTION(command->options, SENDIF_SIGNAL_ANY) ? "yes" : "no");
+	cronsh_log(CRONSH_LOGLEVEL_DEBUG, "   send if stdout is not empty = %s", CRONSH_OPTION(command->options, SENDIF_STDOUT) ? "yes" : "no");
+	cronsh_log(CRONSH_LOGLEVEL_DEBUG, "   send if stdout is empty     = %s", CRONSH_OPTION(command->options, SENDIF_STDOUT_NONE) ? "yes" : "no");
+	cronsh_log(CRONSH_LOGLEVEL_DEBUG, "   send if stdout is anything  = %s", CRONSH_OPTION(command->options, SENDIF_STDOUT_ANY) ? "yes" : "no");
+	cronsh_log(CRONSH_LOGLEVEL_DEBUG, "   send if stderr is not empty = %s", CRONSH_OPTION(command->options, SENDIF_STDERR) ? "yes" : "no");
+	cronsh_log(CRONSH_LOGLEVEL_DEBUG, "   send if stderr is empty     = %s", CRONSH_OPTION(command->options, SENDIF_STDERR_NONE) ? "yes" : "no");
+	cronsh_log(CRONSH_LOGLEVEL_DEBUG, "   send if stderr is anything  = %s", CRONSH_OPTION(command->options, SENDIF_STDERR_ANY) ? "yes" : "no");
+	cronsh_log(CRONSH_LOGLEVEL_DEBUG, "   send in any case            = %s", CRONSH_OPTION(command->options, SENDIF_ANY) ? "yes" : "no");
+	cronsh_log(CRONSH_LOGLEVEL_DEBUG, "   send if slower than usual   = %s", CRONSH_OPTION(command->options, SENDIF_SLOW) ? "yes" : "no");
+	cronsh_log(CRONSH_LOGLEVEL_DEBUG, "   send if bigger than usual   = %s", CRONSH_OPTION(command->options, SENDIF_RSS_REGRESSION) ? "yes" : "no");
+	cronsh_log(CRONSH_LOGLEVEL_DEBUG, "   send if runs overlapped     = %s", CRONSH_OPTION(command->options, SENDIF_OVERLAP) ? "yes" : "no");
+
+	return;
+}
+
+job_t *cronsh_job_init(const char *rawcommand) {
+	job_t *job;
+
+	cronsh_log(CRONSH_LOGLEVEL_DEBUG, "rawcommand: %s", rawcommand);
+
+	job = (job_t *)calloc(1, sizeof(job_t));
+	if(job == NULL) {
+		cronsh_log(CRONSH_LOGLEVEL_CRITICAL, "Not enough memory for job structure!");
+
+		return NULL;
+	}
+
+	// parse command
+	job->report.command = cronsh_command_init(rawcommand, NULL);
+	if(job->report.command == NULL) {
+		free(job);
+
+		return NULL;
+	}
+
+	job->report.rawcommand = strdup(rawcommand);
+
+	// only the jobs stream, not the pipe commands that get their records
+	if(CRONSH_OPTION(job->report.command->options, STREAM)) {
+		job->report.command->stream = (stream_t *)calloc(1, sizeof(stream_t));
+	}
+
+	if(CRONSH_OPTION(job->report.command->options, CAPTURE_TIMELINE)) {
+		job->report.command->timeline = (timeline_t *)calloc(1, sizeof(timeline_t));
+	}
+
+	if(config.history != NULL) {
+		job->report.command->history = (history_t *)calloc(1, sizeof(history_t));
+	}
+
+	if(CRONSH_OPTION(job->report.command->options, PROFILE)) {
+		job->report.command->profile = (profile_t *)calloc(1, sizeof(profile_t));
+	}
+
+	if(CRONSH_OPTION(job->report.command->options, CGROUP) || job->report.command->settings.cpuquota != 0 || job->report.command->settings.memorymax != 0 || job->report.command->settings.iomax[0] != '\0') {
+		job->report.command->cgroup = (cgroup_t *)calloc(1, sizeof(cgroup_t));
+	}
+
+	if(job->report.command->settings.overlap != CRONSH_OVERLAP_RUN) {
+		if(config.lockdir == NULL) {
+			cronsh_log(CRONSH_LOGLEVEL_NOTICE, "overlap needs CRONSH_LOCKDIR, runs may overlap");
+		}
+		else if(job->report.command->tag == NULL || job->report.command->tag[0] == '\0') {
+			cronsh_log(CRONSH_LOGLEVEL_NOTICE, "overlap needs a tag, runs may overlap");
+		}
+		else {
+			job->report.command->overlap = (overlap_t *)calloc(1, sizeof(overlap_t));
+			if(job->report.command->overlap != NULL) {
+				job->report.command->overlap->fd = -1;
+				job->report.command->overlap->slot = -1;
+			}
+		}
+	}
+
+	if(job->report.command->settings.splay != 0 || config.maxjobs > 0) {
+		job->report.command->admission = (admission_t *)calloc(1, sizeof(admission_t));
+		if(job->report.command->admission != NULL) {
+			job->report.command->admission->fd = -1;
+			job->report.command->admission->slot = -1;
+		}
+	}
+
+	cronsh_command_options(job->report.command);
+
+	return job;
+}
+
+/*
+	Start the command of the job. Returns 0 if it runs, and -1 if it was skipped or failed to
+	start. With wait = 0, it returns 1 instead of waiting for the lock of the tag or a slot of
+	CRONSH_MAXJOBS and is called again later. The commands of a manifest aren't splayed.
+*/
+int cronsh_job_start(job_t *job, event_t *event, int wait) {
+	int skipped;
+
+	// the time waiting for the splay, the previous run, and a slot isn't part of the runtime
+	if(wait != 0) {
+		cronsh_admission_splay(job->report.command);
+	}
+
+	skipped = cronsh_overlap_lock(job->report.command, wait);
+	if(skipped == 1) {
+		return 1;
+	}
+
+	if(skipped == 0 && job->report.command->admission != NULL) {
+		if(cronsh_admission_acquire(job->report.command->admission, wait) == 1) {
+			return 1;
+		}
+	}
+
+	job->report.starttime = time(NULL);
+
+	if(job->report.command->stream != NULL) {
+		job->report.command->stream->starttime = job->report.starttime;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &job->starttime);
+
+	if(skipped != 0) {
+		return -1;
+	}
+
+	if(cronsh_command_start(job->report.command, event) != 0) {
+		return -1;
+	}
+
+	job->started = 1;
+
+	cronsh_overlap_owner(job->report.command);
+
+	return 0;
+}
+
+void cronsh_job_finish(job_t *job) {
+	command_t *command = job->report.command;
+
+	cronsh_command_wait(command);
+
+	// the next run may start while this one is reported
+	cronsh_overlap_unlock(command);
+
+	if(command->admission != NULL) {
+		cronsh_admission_release(command->admission);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &job->stoptime);
+
+	cronsh_log(CRONSH_LOGLEVEL_DEBUG, "status: %d", command->status);
+	cronsh_log(CRONSH_LOGLEVEL_DEBUG, "signal: %d", command->signal);
+	cronsh_log(CRONSH_LOGLEVEL_DEBUG, "stdout: (%d) %s", command->stdoutbuffer.used, command->stdoutbuffer.data);
+	cronsh_log(CRONSH_LOGLEVEL_DEBUG, "stderr: (%d) %s", command->stderrbuffer.used, command->stderrbuffer.data);
+
+	cronsh_log(CRONSH_LOGLEVEL_DEBUG, "runtime: %dms", (int)(difftimespec(&job->starttime, &job->stoptime) * 1000));
+
+	if(!CRONSH_OPTION(command->options, CAPTURE_STDOUT)) {
+		bufferReset(&command->stdoutbuffer);
+	}
+
+	if(!CRONSH_OPTION(command->options, CAPTURE_STDERR)) {
+		bufferReset(&command->stderrbuffer);
+	}
+
+	job->report.runtime = (unsigned long)(difftimespec(&job->starttime, &job->stoptime) * 1000);
+
+	return;
+}
+
+void cronsh_job_deliver(job_t *job) {
+	cronsh_deliver(&job->report);
+
+	cronsh_stream_close(job->report.command);
+
+	return;
+}
+
+void cronsh_job_free(job_t *job) {
+	if(job == NULL) {
+		return;
+	}
+
+	cronsh_command_free(job->report.command);
+
+	if(job->report.rawcommand != NULL) {
+		free((char *)job->report.rawcommand);
+	}
+
+	free(job);
+
+	return;
+}
+
+// Close what keeps the command of a job, its stream, or its locks going in a forked process
+static void cronsh_job_detach(job_t *job) {
+	command_t *command = job->report.command;
+
+	cronsh_command_close(NULL, &command->stdinfd);
+
+	if(command->stream != NULL && command->stream->pipe != NULL) {
+		cronsh_command_close(NULL, &command->stream->pipe->stdinfd);
+	}
+
+	cronsh_overlap_unlock(command);
+
+	if(command->admission != NULL) {
+		cronsh_admission_release(command->admission);
+	}
+
+	return;
+}
+
+// Reap the delivering children that are done, with wait != 0 the oldest one is waited for. Returns how many are left.
+static long cronsh_batch_reap(pid_t *pids, long npids, int wait) {
+	long i, n = 0;
+	pid_t rv;
+
+	for(i = 0; i < npids; i++) {
+		while((rv = waitpid(pids[i], NULL, (wait != 0 && i == 0) ? 0 : WNOHANG)) == -1 && errno == EINTR);
+
+		if(rv == 0) {
+			pids[n++] = pids[i];
+		}
+	}
+
+	return n;
+}
+
+/*
+	Deliver the report of a finished job of a manifest from a child, so a slow sink doesn't hold
+	up the running jobs and the job can be freed right away. The children deliver in the order
+	the jobs finished, each one waits until the previous one closed *after. There are at most
+	as many children as jobs, if there are more the oldest one is waited for. A streamed job is
+	delivered in place, its pipe is a child of this process.
+*/
+static void cronsh_batch_deliver(job_t *job, job_t **active, int *after, pid_t *delivering, long *ndelivering) {
+	int fds[2];
+	long j;
+	char c;
+	pid_t pid;
+
+	*ndelivering = cronsh_batch_reap(delivering, *ndelivering, (*ndelivering == config.concurrency) ? 1 : 0);
+
+	if((job->report.command->stream != NULL && job->report.command->stream->pipe != NULL) || cronsh_fd_pipe(fds) != 0) {
+		cronsh_job_deliver(job);
+		cronsh_job_free(job);
+
+		return;
+	}
+
+	// the child would write what is still buffered a second time
+	fflush(stdout);
+
+	if(config.logfp != NULL) {
+		fflush(config.logfp);
+	}
+
+	pid = fork();
+	if(pid == -1) {
+		cronsh_log(CRONSH_LOGLEVEL_NOTICE, "failed forking for the delivery, delivering in place (%s)", strerror(errno));
+
+		close(fds[0]);
+		close(fds[1]);
+
+		cronsh_job_deliver(job);
+		cronsh_job_free(job);
+
+		return;
+	}
+
+	if(pid == 0) {
+		close(fds[0]);
+
+		// the running commands mustn't wait for their stdin, their stream, or their locks to be closed here
+		for(j = 0; j < config.concurrency; j++) {
+			if(active[j] != NULL && active[j] != job) {
+				cronsh_job_detach(active[j]);
+			}
+		}
+
+		if(*after != -1) {
+			while(read(*after, &c, 1) == -1 && errno == EINTR);
+		}
+
+		cronsh_job_deliver(job);
+
+		cronsh_file_close();
+		fflush(stdout);
+
+		_exit(0);
+	}
+
+	close(fds[1]);
+
+	if(*after != -1) {
+		close(*after);
+	}
+
+	*after = fds[0];
+
+	delivering[(*ndelivering)++] = pid;
+
+	cronsh_job_free(job);
+
+	return;
+}
+
+int cronsh_batch(const char *manifest) {
+	FILE *fp;
+	char *line = NULL, **lines = NULL, **tlines;
+	size_t linesize = 0, nlines = 0, size = 0, next = 0;
+	ssize_t len;
+	long i, n, j, running = 0, pending;
+	int timeout, t, rv, after = -1;
+	job_t **active, *job;
+	pid_t *delivering;
+	long ndelivering = 0;
+	event_t event;
+	eventitem_t items[CRONSH_EVENT_MAXITEMS];
+
+	if(!strcmp(manifest, "-")) {
+		fp = stdin;
+	}
+	else {
+		fp = fopen(manifest, "r");
+		if(fp == NULL) {
+			cronsh_log(CRONSH_LOGLEVEL_CRITICAL, "failed opening manifest %s: %s", manifest, strerror(errno));
+
+			return -1;
+		}
+	}
+
+	// one raw command per line, empty lines and lines starting with # are ignored
+	while((len = getline(&line, &linesize, fp)) != -1) {
+		while(len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r')) {
+			line[--len] = '\0';
+		}
+
+		for(i = 0; isspace(line[i]); i++);
+
+		if(line[i] == '\0' || line[i] == '#') {
+			continue;
+		}
+
+		if(nlines == size) {
+			size = (size == 0) ? 16 : size * 2;
+
+			tlines = (char **)realloc(lines, size * sizeof(char *));
+			if(tlines == NULL) {
+				break;
+			}
+
+			lines = tlines;
+		}
+
+		lines[nlines] = strdup(&line[i]);
+		if(lines[nlines] == NULL) {
+			break;
+		}
+
+		nlines++;
+	}
+
+	free(line);
+
+	// a manifest is run completely or not at all
+	if(len != -1) {
+		cronsh_log(CRONSH_LOGLEVEL_CRITICAL, "Not enough memory for manifest!");
+
+		if(fp != stdin) {
+			fclose(fp);
+		}
+
+		for(next = 0; next < nlines; next++) {
+			free(lines[next]);
+		}
+
+		free(lines);
+
+		return -1;
+	}
+
+	if(fp != stdin) {
+		fclose(fp);
+	}
+
+	cronsh_log(CRONSH_LOGLEVEL_DEBUG, "manifest: %lu commands, %ld at once", (unsigned long)nlines, config.concurrency);
+
+	// at most as many delivering children as jobs
+	active = (job_t **)calloc(config.concurrency, sizeof(job_t *));
+	delivering = (pid_t *)calloc(config.concurrency, sizeof(pid_t));
+	if(active == NULL || delivering == NULL || eventInit(&event) != 0) {
+		cronsh_log(CRONSH_LOGLEVEL_CRITICAL, "failed setting up the batch: %s", strerror(errno));
+
+		for(next = 0; next < nlines; next++) {
+			free(lines[next]);
+		}
+
+		free(lines);
+		free(active);
+		free(delivering);
+
+		return -1;
+	}
+
+	while(next < nlines || running > 0) {
+		// fill the free slots, and try again to start the jobs that wait for the lock of their tag or a slot of CRONSH_MAXJOBS
+		pending = 0;
+
+		for(j = 0; j < config.concurrency; j++) {
+			if(active[j] == NULL) {
+				if(next == nlines) {
+					continue;
+				}
+
+				active[j] = cronsh_job_init(lines[next]);
+				if(active[j] == NULL) {
+					cronsh_log(CRONSH_LOGLEVEL_CRITICAL, "failed parsing command: %s", lines[next]);
+				}
+
+				free(lines[next]);
+				lines[next] = NULL;
+				next++;
+
+				// try this slot again
+				if(active[j] == NULL) {
+					j--;
+					continue;
+				}
+
+				running++;
+			}
+			else if(active[j]->started) {
+				continue;
+			}
+
+			rv = cronsh_job_start(active[j], &event, 0);
+			if(rv == 1) {
+				pending++;
+				continue;
+			}
+
+			if(rv != 0) {
+				job = active[j];
+				active[j] = NULL;
+				running--;
+
+				cronsh_job_finish(job);
+				cronsh_batch_deliver(job, active, &after, delivering, &ndelivering);
+
+				// try this slot again
+				j--;
+			}
+		}
+
+		if(running == 0) {
+			continue;
+		}
+
+		// wake up for the job that is due first
+		timeout = (pending > 0) ? CRONSH_BATCH_POLL : -1;
+		for(j = 0; j < config.concurrency; j++) {
+			if(active[j] == NULL || !active[j]->started) {
+				continue;
+			}
+
+			t = cronsh_command_timeout(active[j]->report.command);
+			if(t != -1 && (timeout == -1 || t < timeout)) {
+				timeout = t;
+			}
+		}
+
+		n = eventWait(&event, items, CRONSH_EVENT_MAXITEMS, timeout);
+		if(n == -1) {
+			if(errno == EINTR) {
+				continue;
+			}
+
+			cronsh_log(CRONSH_LOGLEVEL_CRITICAL, "waiting for events failed: %s", strerror(errno));
+
+			break;
+		}
+
+		for(i = 0; i < n; i++) {
+			// the job might have been finished by an earlier event
+			for(j = 0; j < config.concurrency; j++) {
+				if(active[j] != NULL && active[j]->report.command == items[i].data) {
+					break;
+				}
+			}
+
+			if(j == config.concurrency) {
+				continue;
+			}
+
+			cronsh_command_handle(active[j]->report.command, &event, items[i].fd, items[i].events);
+
+			if(!cronsh_command_running(active[j]->report.command)) {
+				job = active[j];
+				active[j] = NULL;
+				running--;
+
+				cronsh_job_finish(job);
+				cronsh_batch_deliver(job, active, &after, delivering, &ndelivering);
+			}
+		}
+
+		for(j = 0; j < config.concurrency; j++) {
+			if(active[j] == NULL || !active[j]->started) {
+				continue;
+			}
+
+			cronsh_command_tick(active[j]->report.command, &event);
+
+			// a timed out command whose descendants keep the pipes open
+			if(!cronsh_command_running(active[j]->report.command)) {
+				job = active[j];
+				active[j] = NULL;
+				running--;
+
+				cronsh_job_finish(job);
+				cronsh_batch_deliver(job, active, &after, delivering, &ndelivering);
+			}
+		}
+	}
+
+	// anything left if waiting failed
+	for(j = 0; j < config.concurrency; j++) {
+		if(active[j] != NULL) {
+			job = active[j];
+			active[j] = NULL;
+
+			cronsh_job_finish(job);
+			cronsh_batch_deliver(job, active, &after, delivering, &ndelivering);
+		}
+	}
+
+	eventFree(&event);
+
+	while(ndelivering > 0) {
+		ndelivering = cronsh_batch_reap(delivering, ndelivering, 1);
+	}
+
+	if(after != -1) {
+		close(after);
+	}
+
+	for(; next < nlines; next++) {
+		free(lines[next]);
+	}
+
+	free(lines);
+	free(active);
+	free(delivering);
+
+	cronsh_file_close();
+
+	return 0;
+}
+
+int cronsh_report(buffer_t *dst, report_t *report) {
+	int rv = 0;
+	size_t nitems = 14;
+	command_t *command = report->command;
+	emitter_t emitter;
+
+	emitterInit(&emitter, dst, command->settings.format);
+
+	if(command->settings.capturelimit != 0) {
+		nitems++;
+	}
+
+	if(command->stdoutbuffer.codec != NULL) {
+		nitems++;
+	}
+
+	if(command->stream != NULL) {
+		nitems++;
+	}
+
+	if(command->timeline != NULL) {
+		nitems += 2;
+	}
+
+	if(command->profile != NULL) {
+		nitems++;
+	}
+
+	if(command->cgroup != NULL && command->cgroup->path != NULL) {
+		nitems++;
+	}
+
+	if(command->history != NULL) {
+		nitems++;
+	}
+
+	if(command->settings.timeout != 0 || command->settings.idletimeout != 0) {
+		nitems++;
+	}
+
+	if(command->overlap != NULL) {
+		nitems++;
+	}
+
+	if(command->admission != NULL) {
+		nitems++;
+	}
+
+	rv += emitterStart(&emitter, nitems);
+	rv += emitterString(&emitter, 0, "hostname", config.thishostname, strlen(config.thishostname));
+	rv += emitterString(&emitter, 0, "user", config.thisuser, strlen(config.thisuser));
+	rv += emitterString(&emitter, 0, "rawcommand", report->rawcommand, strlen(report->rawcommand));
+
+	rv += emitterList(&emitter, 0, "command", command->argv);
+
+	rv += emitterString(&emitter, 0, "tag", command->tag, (command->tag != NULL) ? strlen(command->tag) : 0);
+	rv += emitterNumber(&emitter, 0, "starttime", report->starttime);
+	rv += emitterNumber(&emitter, 0, "runtime", report->runtime);
+	rv += emitterNumber(&emitter, 0, "pid", command->pid);
+	rv += emitterNumber(&emitter, 0, "ppid", command->ppid);
+	rv += emitterNumber(&emitter, 0, "status", command->status);
+	rv += emitterNumber(&emitter, 0, "signal", command->signal);
+
+	if(command->stdoutbuffer.codec != NULL) {
+		rv += emitterMap(&emitter, 0, "compress", 3);
+		rv += emitterString(&emitter, 1, "codec", bufferCodecName(command->stdoutbuffer.codec->type), strlen(bufferCodecName(command->stdoutbuffer.codec->type)));
+		rv += emitterNumber(&emitter, 1, "stdout", command->stdoutbuffer.codec->bytes);
+		rv += emitterNumber(&emitter, 1, "stderr", command->stderrbuffer.codec->bytes);
+
+		rv += emitterBinary(&emitter, 0, "stdout", command->stdoutbuffer.data, command->stdoutbuffer.used);
+
+		rv += emitterBinary(&emitter, 0, "stderr", command->stderrbuffer.data, command->stderrbuffer.used);
+	}
+	else {
+		rv += emitterBytes(&emitter, 0, "stdout", command->stdoutbuffer.data, command->stdoutbuffer.used);
+
+		rv += emitterBytes(&emitter, 0, "stderr", command->stderrbuffer.data, command->stderrbuffer.used);
+	}
+
+	if(command->settings.timeout != 0 || command->settings.idletimeout != 0) {
+		const char *expired[] = {"none", "runtime", "idle"};
+
+		rv += emitterMap(&emitter, 0, "timeout", 4);
+		rv += emitterNumber(&emitter, 1, "runtime", command->settings.timeout);
+		rv += emitterNumber(&emitter, 1, "idle", command->settings.idletimeout);
+		rv += emitterString(&emitter, 1, "expired", expired[command->deadline.expired], strlen(expired[command->deadline.expired]));
+		rv += emitterNumber(&emitter, 1, "killed", command->deadline.killed);
+	}
+
+	if(command->overlap != NULL) {
+		const char *policy[] = {"run", "skip", "wait", "kill-previous"};
+		const char *result[] = {"acquired", "skipped", "waited", "killed"};
+
+		rv += emitterMap(&emitter, 0, "overlap", 4);
+		rv += emitterString(&emitter, 1, "policy", policy[command->settings.overlap], strlen(policy[command->settings.overlap]));
+		rv += emitterString(&emitter, 1, "result", result[command->overlap->result], strlen(result[command->overlap->result]));
+		rv += emitterNumber(&emitter, 1, "waited", command->overlap->waited);
+		rv += emitterNumber(&emitter, 1, "previous", command->overlap->previous);
+	}
+
+	if(command->admission != NULL) {
+		rv += emitterMap(&emitter, 0, "admission", 4);
+		rv += emitterNumber(&emitter, 1, "splay", command->admission->splay);
+		rv += emitterNumber(&emitter, 1, "maxjobs", (command->admission->slot != -1) ? config.maxjobs : 0);
+		rv += emitterNumber(&emitter, 1, "slot", command->admission->slot);
+		rv += emitterNumber(&emitter, 1, "waited", command->admission->waited);
+	}
+
+	if(command->settings.capturelimit != 0) {
+		rv += emitterMap(&emitter, 0, "capture", 2);
+		rv += emitterMap(&emitter, 1, "stdout", 2);
+		rv += emitterNumber(&emitter, 2, "bytes", command->stdoutbuffer.total);
+		rv += emitterNumber(&emitter, 2, "truncated", command->stdoutbuffer.dropped);
+		rv += emitterMap(&emitter, 1, "stderr", 2);
+		rv += emitterNumber(&emitter, 2, "bytes", command->stderrbuffer.total);
+		rv += emitterNumber(&emitter, 2, "truncated", command->stderrbuffer.dropped);
+	}
+
+	if(command->stream != NULL) {
+		rv += emitterMap(&emitter, 0, "stream", 3);
+		rv += emitterNumber(&emitter, 1, "records", command->stream->records);
+		rv += emitterNumber(&emitter, 1, "stdout", command->stream->bytes[0]);
+		rv += emitterNumber(&emitter, 1, "stderr", command->stream->bytes[1]);
+	}
+
+	if(command->timeline != NULL) {
+		long row[3];
+		size_t i;
+		timelineentry_t *entry;
+
+		rv += emitterSequence(&emitter, 0, "timeline", command->timeline->used);
+
+		for(i = 0; i < command->timeline->used; i++) {
+			entry = &command->timeline->entries[i];
+
+			row[0] = entry->time / 1000;	// microseconds
+			row[1] = entry->stream;
+			row[2] = entry->length;
+
+			rv += emitterTuple(&emitter, 1, row, 3);
+		}
+
+		rv += emitterNumber(&emitter, 0, "timelinedropped", command->timeline->dropped);
+	}
+
+	if(command->profile != NULL) {
+		profile_t *profile = command->profile;
+		profilesample_t *sample;
+		long row[4];
+		size_t i;
+		uint64_t elapsed = profile->last - profile->start;
+
+		rv += emitterMap(&emitter, 0, "profile", 7);
+		rv += emitterNumber(&emitter, 1, "interval", command->settings.profileinterval);
+		rv += emitterMap(&emitter, 1, "cpu", 2);
+		rv += emitterNumber(&emitter, 2, "peak", profile->peakcpu);
+		rv += emitterNumber(&emitter, 2, "average", (elapsed == 0) ? 0 : (long)((profile->cpu * 1000000000ULL * 100) / ((uint64_t)sysconf(_SC_CLK_TCK) * elapsed)));
+		rv += emitterMap(&emitter, 1, "rss", 2);
+		rv += emitterNumber(&emitter, 2, "peak", profile->peakrss);
+		rv += emitterNumber(&emitter, 2, "average", (profile->used == 0) ? 0 : (long)(profile->sumrss / profile->used));
+		rv += emitterMap(&emitter, 1, "io", 2);
+		rv += emitterNumber(&emitter, 2, "read", profile->read);
+		rv += emitterNumber(&emitter, 2, "write", profile->write);
+		rv += emitterNumber(&emitter, 1, "rundelay", profile->wait / 1000000);
+		rv += emitterNumber(&emitter, 1, "processes", profile->peakprocesses);
+
+		rv += emitterSequence(&emitter, 1, "samples", profile->used);
+
+		for(i = 0; i < profile->used; i++) {
+			sample = &profile->samples[i];
+
+			row[0] = sample->time;
+			row[1] = sample->cpu;
+			row[2] = sample->rss;
+			row[3] = sample->processes;
+
+			rv += emitterTuple(&emitter, 2, row, 4);
+		}
+	}
+
+	if(command->cgroup != NULL && command->cgroup->path != NULL) {
+		cgroup_t *cgroup = command->cgroup;
+
+		rv += emitterMap(&emitter, 0, "cgroup", 5);
+		rv += emitterString(&emitter, 1, "path", cgroup->path, strlen(cgroup->path));
+		rv += emitterMap(&emitter, 1, "memory", 1);
+		rv += emitterNumber(&emitter, 2, "peak", cgroup->memorypeak);
+		rv += emitterMap(&emitter, 1, "cpu", 5);
+		rv += emitterNumber(&emitter, 2, "usage", cgroup->cpuusage / 1000);
+		rv += emitterNumber(&emitter, 2, "user", cgroup->cpuuser / 1000);
+		rv += emitterNumber(&emitter, 2, "system", cgroup->cpusystem / 1000);
+		rv += emitterNumber(&emitter, 2, "throttled", cgroup->throttled);
+		rv += emitterNumber(&emitter, 2, "throttledtime", cgroup->throttledtime / 1000);
+		rv += emitterMap(&emitter, 1, "io", 4);
+		rv += emitterNumber(&emitter, 2, "read", cgroup->ioread);
+		rv += emitterNumber(&emitter, 2, "write", cgroup->iowrite);
+		rv += emitterNumber(&emitter, 2, "reads", cgroup->ioreads);
+		rv += emitterNumber(&emitter, 2, "writes", cgroup->iowrites);
+		rv += emitterMap(&emitter, 1, "pressure", 3);
+		rv += emitterNumber(&emitter, 2, "cpu", cgroup->pressure[0] / 1000);
+		rv += emitterNumber(&emitter, 2, "memory", cgroup->pressure[1] / 1000);
+		rv += emitterNumber(&emitter, 2, "io", cgroup->pressure[2] / 1000);
+	}
+
+	if(command->history != NULL) {
+		rv += emitterMap(&emitter, 0, "history", 5);
+		rv += emitterNumber(&emitter, 1, "runs", command->history->runs);
+		rv += emitterNumber(&emitter, 1, "runtime", command->history->runtime);
+		rv += emitterNumber(&emitter, 1, "maxrss", command->history->maxrss);
+		rv += emitterNumber(&emitter, 1, "slow", command->history->slow);
+		rv += emitterNumber(&emitter, 1, "rssregression", command->history->rssregression);
+	}
+
+	rv += emitterMap(&emitter, 0, "rusage", 16);
+
+	rv += emitterNumber(&emitter, 1, "utime", command->rusage.ru_utime.tv_sec * 1000 + command->rusage.ru_utime.tv_usec / 1000);	// user time used
+	rv += emitterNumber(&emitter, 1, "stime", command->rusage.ru_stime.tv_sec * 1000 + command->rusage.ru_stime.tv_usec / 1000);	// system time used
+	rv += emitterNumber(&emitter, 1, "maxrss", command->rusage.ru_maxrss);		// max resident set size
+	rv += emitterNumber(&emitter, 1, "ixrss", command->rusage.ru_ixrss);		// integral shared text memory size
+	rv += emitterNumber(&emitter, 1, "idrss", command->rusage.ru_idrss);		// integral unshared data size
+	rv += emitterNumber(&emitter, 1, "isrss", command->rusage.ru_isrss);		// integral unshared stack size
+	rv += emitterNumber(&emitter, 1, "minflt", command->rusage.ru_minflt);		// page reclaims
+	rv += emitterNumber(&emitter, 1, "majflt", command->rusage.ru_majflt);		// page faults
+	rv += emitterNumber(&emitter, 1, "nswap", command->rusage.ru_nswap);		// swaps
+	rv += emitterNumber(&emitter, 1, "inblock", command->rusage.ru_inblock);		// block input operations
+	rv += emitterNumber(&emitter, 1, "oublock", command->rusage.ru_oublock);		// block output operations
+	rv += emitterNumber(&emitter, 1, "msgsnd", command->rusage.ru_msgsnd);		// messages sent
+	rv += emitterNumber(&emitter, 1, "msgrcv", command->rusage.ru_msgrcv);		// messages received
+	rv += emitterNumber(&emitter, 1, "nsignals", command->rusage.ru_nsignals);	// signals received
+	rv += emitterNumber(&emitter, 1, "nvcsw", command->rusage.ru_nvcsw);		// voluntary context switches
+	rv += emitterNumber(&emitter, 1, "nivcsw", command->rusage.ru_nivcsw);		// involuntary context switches
+
+	rv += emitterEnd(&emitter);
+
+	return rv;
+}
+
+void cronsh_deliver(report_t *report) {
+	command_t *command = report->command;
+
+	// every run counts, whether a report is sent or not
+	if(config.metrics != NULL) {
+		if(cronsh_metrics(config.metrics, report) != 0) {
+			cronsh_log(CRONSH_LOGLEVEL_CRITICAL, "failed updating the metrics in %s (%s)", config.metrics, strerror(errno));
+		}
+	}
+
+	if(config.history != NULL) {
+		if(cronsh_history(config.history, report) != 0) {
+			cronsh_log(CRONSH_LOGLEVEL_CRITICAL, "failed updating the history in %s (%s)", config.history, strerror(errno));
+		}
+	}
+
+	// check if we have to send anything
+	int sendif = 0;
+
+	if(CRONSH_OPTION(command->options, SENDIF_STATUS)) { if(command->status != 0) { sendif = 1; } }
+	if(CRONSH_OPTION(command->options, SENDIF_STATUS_OK)) { if(command->status == 0) { sendif = 1; } }
+
+	if(CRONSH_OPTION(command->options, SENDIF_SIGNAL)) { if(command->signal != 0) { sendif = 1; } }
+	if(CRONSH_OPTION(command->options, SENDIF_SIGNAL_OK)) { if(command->signal == 0) { sendif = 1; } }
+
+	// streamed output has already been forwarded
+	size_t stdoutbytes = command->stdoutbuffer.used + ((command->stream != NULL) ? command->stream->bytes[0] : 0);
+	size_t stderrbytes = command->stderrbuffer.used + ((command->stream != NULL) ? command->stream->bytes[1] : 0);
+
+	if(CRONSH_OPTION(command->options, SENDIF_STDOUT)) { if(stdoutbytes != 0) { sendif = 1; } }
+	if(CRONSH_OPTION(command->options, SENDIF_STDOUT_NONE)) { if(stdoutbytes == 0) { sendif = 1; } }
+
+	if(CRONSH_OPTION(command->options, SENDIF_STDERR)) { if(stderrbytes != 0) { sendif = 1; } }
+	if(CRONSH_OPTION(command->options, SENDIF_STDERR_NONE)) { if(stderrbytes == 0) { sendif = 1; } }
+
+	// compared with the history of the tag
+	if(CRONSH_OPTION(command->options, SENDIF_SLOW)) { if(command->history != NULL && command->history->slow != 0) { sendif = 1; } }
+	if(CRONSH_OPTION(command->options, SENDIF_RSS_REGRESSION)) { if(command->history != NULL && command->history->rssregression != 0) { sendif = 1; } }
+	if(CRONSH_OPTION(command->options, SENDIF_OVERLAP)) { if(command->overlap != NULL && command->overlap->result != CRONSH_OVERLAP_ACQUIRED) { sendif = 1; } }
+
+	// if we don't have to send anything, we're going into silent mode
+	if(sendif == 0) {
+		cronsh_log(CRONSH_LOGLEVEL_DEBUG, "we shall not send anything");
+		command->options |= CRONSH_OPTION_SILENT;
+	}
+
+	if(!CRONSH_OPTION(command->options, SILENT)) {
+		// write to pipe
+		if(CRONSH_OPTION(command->options, SENDTO_PIPE)) {
+			cronsh_log(CRONSH_LOGLEVEL_DEBUG, "sending to pipe");
+
+			int rv;
+
+			if(command->stream != NULL && command->stream->pipe != NULL) {
+				rv = cronsh_stream_send(command, report);
+			}
+			else if(CRONSH_OPTION(command->options, SPOOL) && config.spool != NULL) {
+				rv = cronsh_spool(config.spool, config.pipe, report);
+			}
+			else {
+				rv = cronsh_pipe(config.pipe, report);
+			}
+
+			if(rv == 0) {
+				// if the fallback option was set, don't send it any further
+				if(CRONSH_OPTION(command->options, SENDTO_FALLBACK)) {
+					command->options &= ~CRONSH_OPTION_SENDTO_ALL;
+				}
+			}
+			else {
+				cronsh_log(CRONSH_LOGLEVEL_CRITICAL, "failed sending to pipe (%d)", rv);
+			}
+		}
+
+		// write to file
+		if(CRONSH_OPTION(command->options, SENDTO_FILE)) {
+			cronsh_log(CRONSH_LOGLEVEL_DEBUG, "sending to file");
+
+			if(cronsh_file(config.file, report) == 0) {
+				// if the fallback option was set, don't send it any further
+				if(CRONSH_OPTION(command->options, SENDTO_FALLBACK)) {
+					command->options &= ~CRONSH_OPTION_SENDTO_ALL;
+				}
+			}
+			else {
+				cronsh_log(CRONSH_LOGLEVEL_CRITICAL, "failed sending to file (%s)", strerror(errno));
+			}
+		}
+
+		// write to stdout
+		if(CRONSH_OPTION(command->options, SENDTO_STDOUT)) {
+			cronsh_log(CRONSH_LOGLEVEL_DEBUG, "sending to stdout");
+
+			sink_t sink;
+
+			sinkInitFile(&sink, stdout);
+			cronsh_send(&sink, report);
+		}
+	}
+
+	return;
+}
+
+int cronsh_pipe(const char *rawpipecommand, report_t *report) {
+	int rv;
+	command_t *command;
+	event_t event;
+	sink_t sink;
+	
+	if(rawpipecommand == NULL) {
+		return -1;
+	}
+
+	cronsh_log(CRONSH_LOGLEVEL_DEBUG, "sending to: %s", rawpipecommand);
+
+	// the daemon keeps this consumer running
+	if(consumer.fd != -1 && !strcmp(consumer.rawcommand, rawpipecommand)) {
+		if(cronsh_consumer_send(report) == 0) {
+			return 0;
+		}
+
+		cronsh_log(CRONSH_LOGLEVEL_NOTICE, "the running consumer didn't accept the document (%s), starting a new one", strerror(errno));
+	}
+
+	command = cronsh_command_init(rawpipecommand, NULL);
+	if(command == NULL) {
+		return -1;
+	}
+
+	if(eventInit(&event) != 0) {
+		cronsh_log(CRONSH_LOGLEVEL_CRITICAL, "failed creating event loop: %s", strerror(errno));
+
+		cronsh_command_free(command);
+
+		return -1;
+	}
+
+	// the document is written to stdin of the command while it is generated
+	command->stdinstream = 1;
+
+	if(cronsh_command_start(command, &event) != 0) {
+		eventFree(&event);
+		cronsh_command_free(command);
+
+		return -1;
+	}
+
+	sinkInitCommand(&sink, command, &event);
+
+	rv = cronsh_send(&sink, report);
+
+	cronsh_command_closestdin(command, &event);
+	cronsh_command_run(command, &event);
+	cronsh_command_wait(command);
+
+	eventFree(&event);
+
+	if(rv != 0) {
+		cronsh_log(CRONSH_LOGLEVEL_NOTICE, "the pipe didn't accept the whole document");
+
+		rv = -1;
+	}
+	else {
+		rv = command->status;
+	}
+
+	cronsh_log(CRONSH_LOGLEVEL_DEBUG, "status: %d", command->status);
+	cronsh_log(CRONSH_LOGLEVEL_DEBUG, "signal: %d", command->signal);
+	cronsh_log(CRONSH_LOGLEVEL_DEBUG, "stdout: (%d) %s", command->stdoutbuffer.used, command->stdoutbuffer.data);
+	cronsh_log(CRONSH_LOGLEVEL_DEBUG, "stderr: (%d) %s", command->stderrbuffer.used, command->stderrbuffer.data);
+
+	cronsh_command_free(command);
+
+	return rv;
+}
+
+static int cronsh_file_open(const char *path) {
+	if(reportfile.fd != -1 && !strcmp(reportfile.path, path)) {
+		return 0;
+	}
+
+	cronsh_file_close();
+
+	// the path is compared for the rotation, it has to be complete
+	if(snprintf(reportfile.path, sizeof(reportfile.path), "%s", path) >= (int)sizeof(reportfile.path)) {
+		reportfile.path[0] = '\0';
+
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+
+	reportfile.fd = open(path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0666);
+	if(reportfile.fd == -1) {
+		return -1;
+	}
+
+	return 0;
+}
+
+void cronsh_file_close(void) {
+	if(reportfile.fd == -1) {
+		return;
+	}
+
+	if(reportfile.unsynced != 0) {
+		fdatasync(reportfile.fd);
+		reportfile.unsynced = 0;
+	}
+
+	close(reportfile.fd);
+	reportfile.fd = -1;
+
+	return;
+}
+
+// Move the file away if the next document would make it too big
+static int cronsh_file_rotate(size_t nbytes) {
+	int i;
+	char from[PATH_MAX + 16], to[PATH_MAX + 16];
+	struct stat st, pathst;
+
+	if(config.filemaxsize == 0 || fstat(reportfile.fd, &st) != 0 || st.st_size == 0 || (size_t)st.st_size + nbytes <= config.filemaxsize) {
+		return 0;
+	}
+
+	// nobody else is writing while we rotate
+	while(flock(reportfile.fd, LOCK_EX) == -1) {
+		if(errno != EINTR) {
+			return -1;
+		}
+	}
+
+	// somebody else might have been faster
+	if(stat(reportfile.path, &pathst) == 0 && pathst.st_ino == st.st_ino && pathst.st_dev == st.st_dev) {
+		cronsh_log(CRONSH_LOGLEVEL_DEBUG, "rotating %s", reportfile.path);
+
+		for(i = CRONSH_FILE_KEEP - 1; i > 0; i--) {
+			snprintf(from, sizeof(from), "%s.%d", reportfile.path, i);
+			snprintf(to, sizeof(to), "%s.%d", reportfile.path, i + 1);
+			rename(from, to);
+		}
+
+		snprintf(to, sizeof(to), "%s.1", reportfile.path);
+		rename(reportfile.path, to);
+	}
+
+	flock(reportfile.fd, LOCK_UN);
+
+	strcpy(from, reportfile.path);
+
+	// closing releases the lock, the next one gets a fresh file
+	cronsh_file_close();
+
+	return cronsh_file_open(from);
+}
+
+// Open the file for a document of about nbytes that belongs to a command started at starttime
+static int cronsh_file_prepare(const char *file, time_t starttime, size_t nbytes) {
+	char path[PATH_MAX];
+	struct tm tm;
+
+	if(file == NULL) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	// a new file for every period, e.g. /var/log/cronsh-%Y%m%d.yaml
+	if(strchr(file, '%') != NULL) {
+		localtime_r(&starttime, &tm);
+
+		if(strftime(path, sizeof(path), file, &tm) == 0) {
+			errno = ENAMETOOLONG;
+			return -1;
+		}
+	}
+	else if(snprintf(path, sizeof(path), "%s", file) >= (int)sizeof(path)) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+
+	cronsh_log(CRONSH_LOGLEVEL_DEBUG, "sending to: %s", path);
+
+	if(cronsh_file_open(path) != 0) {
+		return -1;
+	}
+
+	return cronsh_file_rotate(nbytes);
+}
+
+static void cronsh_file_written(void) {
+	if(config.filesync != 0 && ++reportfile.unsynced >= config.filesync) {
+		fdatasync(reportfile.fd);
+		reportfile.unsynced = 0;
+	}
+
+	return;
+}
+
+// Append a complete document with a single write
+static int cronsh_file_append(const char *bytes, size_t nbytes) {
+	int rv, err;
+	sink_t sink;
+
+	while(flock(reportfile.fd, LOCK_SH) == -1) {
+		if(errno != EINTR) {
+			return -1;
+		}
+	}
+
+	sinkInitFD(&sink, reportfile.fd);
+
+	rv = sinkWrite(&sink, bytes, nbytes);
+
+	err = errno;
+
+	flock(reportfile.fd, LOCK_UN);
+
+	if(rv != 0) {
+		errno = err;
+		return -1;
+	}
+
+	cronsh_file_written();
+
+	return 0;
+}
+
+int cronsh_file(const char *file, report_t *report) {
+	int rv, err;
+	size_t nbytes;
+	buffer_t buffer;
+	sink_t sink;
+
+	// a rough guess of the size of the document
+	nbytes = report->command->stdoutbuffer.used + report->command->stderrbuffer.used + 4096;
+
+	if(cronsh_file_prepare(file, report->starttime, nbytes) != 0) {
+		return -1;
+	}
+
+	/*
+		Small documents are written with one write() with O_APPEND and can't interleave with
+		each other. They share the lock. Bigger documents are written in chunks and need the
+		file for themselves.
+	*/
+	if(nbytes <= CRONSH_FILE_ATOMIC) {
+		bufferInit(&buffer, nbytes);
+
+		rv = cronsh_report(&buffer, report);
+		if(rv == 0) {
+			rv = cronsh_file_append(buffer.data, buffer.used);
+		}
+
+		bufferFree(&buffer);
+
+		return (rv == 0) ? 0 : -1;
+	}
+
+	while(flock(reportfile.fd, LOCK_EX) == -1) {
+		if(errno != EINTR) {
+			return -1;
+		}
+	}
+
+	sinkInitFD(&sink, reportfile.fd);
+
+	rv = cronsh_send(&sink, report);
+
+	err = errno;
+
+	flock(reportfile.fd, LOCK_UN);
+
+	if(rv != 0) {
+		errno = err;
+		return -1;
+	}
+
+	cronsh_file_written();
+
+	return 0;
+}
+
+// dir/cronsh_tag.suffix, or dir/cronsh.suffix without a tag
+static void cronsh_tag_path(char *path, size_t size, const char *dir, const char *tag, const char *suffix) {
+	size_t n, i;
+
+	if(tag == NULL) {
+		tag = "";
+	}
+
+	n = snprintf(path, size, "%s/cronsh%s", dir, (tag[0] != '\0') ? "_" : "");
+
+	// anything that could leave the directory or confuse a shell becomes _
+	for(i = 0; tag[i] != '\0' && n + strlen(suffix) + 1 < size; i++) {
+		path[n++] = (isalnum((unsigned char)tag[i]) || tag[i] == '-' || tag[i] == '_') ? tag[i] : '_';
+	}
+
+	snprintf(&path[n], size - n, "%s", suffix);
+
+	return;
+}
+
+/*
+	The metrics of a tag in the format of the node_exporter textfile collector. A family
+	starts with its HELP and TYPE, the lines without a family belong to the one before.
+*/
+static const struct {
+	const char *family;
+	const char *type;
+	const char *help;
+	const char *name;
+	const char *labels;
+} cronshMetrics[] = {
+	{"cronsh_job_runs_total", "counter", "Finished runs.", "cronsh_job_runs_total", NULL},
+	{"cronsh_job_failures_total", "counter", "Runs with a status or a signal other than 0.", "cronsh_job_failures_total", NULL},
+	{"cronsh_job_cpu_seconds_total", "counter", "CPU time of the command and its waited-for descendants.", "cronsh_job_cpu_seconds_total", "mode=\"user\""},
+	{NULL, NULL, NULL, "cronsh_job_cpu_seconds_total", "mode=\"system\""},
+	{"cronsh_job_output_bytes_total", "counter", "Bytes captured from stdout and stderr, before compression.", "cronsh_job_output_bytes_total", "stream=\"stdout\""},
+	{NULL, NULL, NULL, "cronsh_job_output_bytes_total", "stream=\"stderr\""},
+	{"cronsh_job_last_run_timestamp_seconds", "gauge", "Start of the last run.", "cronsh_job_last_run_timestamp_seconds", NULL},
+	{"cronsh_job_last_success_timestamp_seconds", "gauge", "Start of the last run with status and signal 0.", "cronsh_job_last_success_timestamp_seconds", NULL},
+	{"cronsh_job_last_status", "gauge", "Exit status of the last run.", "cronsh_job_last_status", NULL},
+	{"cronsh_job_last_signal", "gauge", "Signal that ended the last run.", "cronsh_job_last_signal", NULL},
+	{"cronsh_job_last_runtime_seconds", "gauge", "Runtime of the last run.", "cronsh_job_last_runtime_seconds", NULL},
+	{"cronsh_job_last_maxrss_bytes", "gauge", "Maximum resident set size of the last run.", "cronsh_job_last_maxrss_bytes", NULL},
+	{"cronsh_job_runtime_seconds", "histogram", "Runtime of the runs.", "cronsh_job_runtime_seconds_bucket", "le=\"0.1\""},
+	{NULL, NULL, NULL, "cronsh_job_runtime_seconds_bucket", "le=\"0.5\""},
+	{NULL, NULL, NULL, "cronsh_job_runtime_seconds_bucket", "le=\"1\""},
+	{NULL, NULL, NULL, "cronsh_job_runtime_seconds_bucket", "le=\"5\""},
+	{NULL, NULL, NULL, "cronsh_job_runtime_seconds_bucket", "le=\"10\""},
+	{NULL, NULL, NULL, "cronsh_job_runtime_seconds_bucket", "le=\"30\""},
+	{NULL, NULL, NULL, "cronsh_job_runtime_seconds_bucket", "le=\"60\""},
+	{NULL, NULL, NULL, "cronsh_job_runtime_seconds_bucket", "le=\"300\""},
+	{NULL, NULL, NULL, "cronsh_job_runtime_seconds_bucket", "le=\"600\""},
+	{NULL, NULL, NULL, "cronsh_job_runtime_seconds_bucket", "le=\"1800\""},
+	{NULL, NULL, NULL, "cronsh_job_runtime_seconds_bucket", "le=\"3600\""},
+	{NULL, NULL, NULL, "cronsh_job_runtime_seconds_bucket", "le=\"+Inf\""},
+	{NULL, NULL, NULL, "cronsh_job_runtime_seconds_sum", NULL},
+	{NULL, NULL, NULL, "cronsh_job_runtime_seconds_count", NULL},
+	{"cronsh_job_skipped_total", "counter", "Runs that were skipped because the previous run still held the lock of the tag.", "cronsh_job_skipped_total", NULL},
+};
+
+#define CRONSH_METRICS_COUNT		(sizeof(cronshMetrics) / sizeof(cronshMetrics[0]))
+#define CRONSH_METRICS_BUCKETS		12	// the runtime buckets, starting at CRONSH_METRICS_BUCKET
+#define CRONSH_METRICS_BUCKET		12
+#define CRONSH_METRICS_SKIPPED		(CRONSH_METRICS_BUCKET + CRONSH_METRICS_BUCKETS + 2)
+
+static const double cronshMetricsBuckets[CRONSH_METRICS_BUCKETS - 1] = {0.1, 0.5, 1, 5, 10, 30, 60, 300, 600, 1800, 3600};
+
+// name{tag="...",labels}
+static void cronsh_metrics_key(char *key, size_t size, size_t metric, const char *tag) {
+	size_t n;
+
+	n = snprintf(key, size, "%s{tag=\"", cronshMetrics[metric].name);
+
+	for(; *tag != '\0' && n + 3 < size; tag++) {
+		if(*tag == '"' || *tag == '\\') {
+			key[n++] = '\\';
+		}
+
+		key[n++] = *tag;
+	}
+
+	key[n] = '\0';
+
+	if(cronshMetrics[metric].labels != NULL) {
+		snprintf(&key[n], size - n, "\",%s}", cronshMetrics[metric].labels);
+	}
+	else {
+		snprintf(&key[n], size - n, "\"}");
+	}
+
+	return;
+}
+
+/*
+	Update the textfile of the tag of the command. The file is read, updated, and replaced with
+	rename(), so the collector never sees half of it. Concurrent cronsh processes take turns
+	with a lock on a separate file, as the textfile itself is replaced.
+*/
+int cronsh_metrics(const char *dir, report_t *report) {
+	command_t *command = report->command;
+	const char *tag = (command->tag != NULL) ? command->tag : "";
+	char path[PATH_MAX], lockpath[PATH_MAX + 8], tmppath[PATH_MAX + 32], key[512], *line = NULL, *value;
+	size_t linesize = 0, i;
+	double values[CRONSH_METRICS_COUNT], runtime;
+	int lockfd, fd, rv, failed;
+	FILE *fp;
+	buffer_t buffer;
+	sink_t sink;
+
+	cronsh_tag_path(path, sizeof(path), dir, command->tag, ".prom");
+
+	snprintf(lockpath, sizeof(lockpath), "%s.lock", path);
+	snprintf(tmppath, sizeof(tmppath), "%s.%d.tmp", path, getpid());
+
+	lockfd = open(lockpath, O_RDWR | O_CREAT | O_CLOEXEC, 0666);
+	if(lockfd == -1) {
+		return -1;
+	}
+
+	while(flock(lockfd, LOCK_EX) == -1) {
+		if(errno != EINTR) {
+			close(lockfd);
+			return -1;
+		}
+	}
+
+	memset(values, 0, sizeof(values));
+
+	// pick up the values of the previous runs
+	fp = fopen(path, "re");
+	if(fp != NULL) {
+		while(getline(&line, &linesize, fp) != -1) {
+			if(line[0] == '#') {
+				continue;
+			}
+
+			value = strrchr(line, ' ');
+			if(value == NULL) {
+				continue;
+			}
+
+			*value++ = '\0';
+
+			for(i = 0; i < CRONSH_METRICS_COUNT; i++) {
+				cronsh_metrics_key(key, sizeof(key), i, tag);
+
+				if(!strcmp(key, line)) {
+					values[i] = strtod(value, NULL);
+					break;
+				}
+			}
+		}
+
+		free(line);
+		fclose(fp);
+	}
+
+	// a skipped run didn't run, it doesn't change anything else
+	if(command->overlap != NULL && command->overlap->result == CRONSH_OVERLAP_SKIPPED) {
+		values[CRONSH_METRICS_SKIPPED] += 1;
+	}
+	else {
+		failed = (command->status != 0 || command->signal != 0);
+		runtime = report->runtime / 1000.0;
+
+		values[0] += 1;
+		values[1] += failed;
+		values[2] += command->rusage.ru_utime.tv_sec + command->rusage.ru_utime.tv_usec / 1000000.0;
+		values[3] += command->rusage.ru_stime.tv_sec + command->rusage.ru_stime.tv_usec / 1000000.0;
+		values[4] += ((command->stdoutbuffer.codec != NULL) ? command->stdoutbuffer.codec->bytes : command->stdoutbuffer.total) + ((command->stream != NULL) ? command->stream->bytes[0] : 0);
+		values[5] += ((command->stderrbuffer.codec != NULL) ? command->stderrbuffer.codec->bytes : command->stderrbuffer.total) + ((command->stream != NULL) ? command->stream->bytes[1] : 0);
+		values[6] = report->starttime;
+		if(failed == 0) {
+			values[7] = report->starttime;
+		}
+		values[8] = command->status;
+		values[9] = command->signal;
+		values[10] = runtime;
+		values[11] = command->rusage.ru_maxrss * 1024.0;
+
+		// the buckets are cumulative
+		for(i = 0; i < CRONSH_METRICS_BUCKETS; i++) {
+			if(i == CRONSH_METRICS_BUCKETS - 1 || runtime <= cronshMetricsBuckets[i]) {
+				values[CRONSH_METRICS_BUCKET + i] += 1;
+			}
+		}
+
+		values[CRONSH_METRICS_BUCKET + CRONSH_METRICS_BUCKETS] += runtime;
+		values[CRONSH_METRICS_BUCKET + CRONSH_METRICS_BUCKETS + 1] += 1;
+	}
+
+	bufferInit(&buffer, 8192);
+
+	for(i = 0; i < CRONSH_METRICS_COUNT; i++) {
+		if(cronshMetrics[i].family != NULL) {
+			bufferAppendString(&buffer, "# HELP %s %s\n# TYPE %s %s\n", cronshMetrics[i].family, cronshMetrics[i].help, cronshMetrics[i].family, cronshMetrics[i].type);
+		}
+
+		cronsh_metrics_key(key, sizeof(key), i, tag);
+		bufferAppendString(&buffer, "%s %.15g\n", key, values[i]);
+	}
+
+	rv = -1;
+
+	fd = open(tmppath, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if(fd != -1) {
+		sinkInitFD(&sink, fd);
+
+		rv = sinkWrite(&sink, buffer.data, buffer.used);
+
+		if(close(fd) != 0) {
+			rv = -1;
+		}
+
+		if(rv == 0) {
+			rv = rename(tmppath, path);
+		}
+
+		if(rv != 0) {
+			unlink(tmppath);
+		}
+	}
+
+	bufferFree(&buffer);
+
+	flock(lockfd, LOCK_UN);
+	close(lockfd);
+
+	return rv;
+}
+
+static int cronsh_history_compare(const void *a, const void *b) {
+	uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+// The 95th percentile of n values, n is at most CRONSH_HISTORY_SIZE
+static uint32_t cronsh_history_p95(uint32_t *values, size_t n) {
+	if(n == 0) {
+		return 0;
+	}
+
+	qsort(values, n, sizeof(uint32_t), cronsh_history_compare);
+
+	return values[(n * 95 + 99) / 100 - 1];
+}
+
+/*
+	Compare the run with the previous runs of the same tag and add it to the ring in
+	cronsh_<tag>.hist. The file has a fixed size and is mapped, only the last
+	CRONSH_HISTORY_SIZE runs are looked at, however long the tag has been running.
+*/
+int cronsh_history(const char *dir, report_t *report) {
+	command_t *command = report->command;
+	history_t *history = command->history;
+	historyfile_t *file;
+	historyrecord_t *record;
+	char path[PATH_MAX];
+	uint32_t runtimes[CRONSH_HISTORY_SIZE], maxrss[CRONSH_HISTORY_SIZE];
+	size_t i, n;
+	double factor;
+	int fd;
+	struct stat st;
+
+	// a skipped run has nothing to compare
+	if(history == NULL || (command->overlap != NULL && command->overlap->result == CRONSH_OVERLAP_SKIPPED)) {
+		return 0;
+	}
+
+	cronsh_tag_path(path, sizeof(path), dir, command->tag, ".hist");
+
+	fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0666);
+	if(fd == -1) {
+		return -1;
+	}
+
+	while(flock(fd, LOCK_EX) == -1) {
+		if(errno != EINTR) {
+			close(fd);
+			return -1;
+		}
+	}
+
+	if(fstat(fd, &st) != 0 || ((size_t)st.st_size < sizeof(historyfile_t) && ftruncate(fd, sizeof(historyfile_t)) != 0)) {
+		close(fd);
+		return -1;
+	}
+
+	file = (historyfile_t *)mmap(NULL, sizeof(historyfile_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if(file == MAP_FAILED) {
+		close(fd);
+		return -1;
+	}
+
+	// a new file or one from a different version starts empty
+	if(memcmp(file->magic, CRONSH_HISTORY_MAGIC, sizeof(file->magic)) != 0 || file->size != CRONSH_HISTORY_SIZE) {
+		memset(file, 0, sizeof(historyfile_t));
+		memcpy(file->magic, CRONSH_HISTORY_MAGIC, sizeof(file->magic));
+		file->size = CRONSH_HISTORY_SIZE;
+	}
+
+	n = (file->count < CRONSH_HISTORY_SIZE) ? file->count : CRONSH_HISTORY_SIZE;
+
+	for(i = 0; i < n; i++) {
+		runtimes[i] = file->records[i].runtime;
+		maxrss[i] = file->records[i].maxrss;
+	}
+
+	history->runs = n;
+	history->runtime = cronsh_history_p95(runtimes, n);
+	history->maxrss = cronsh_history_p95(maxrss, n);
+
+	factor = (command->settings.slowfactor != 0) ? command->settings.slowfactor : CRONSH_HISTORY_FACTOR;
+
+	if(n >= CRONSH_HISTORY_MINRUNS) {
+		history->slow = (report->runtime > history->runtime * factor);
+		history->rssregression = (command->rusage.ru_maxrss > history->maxrss * factor);
+	}
+
+	record = &file->records[file->count % CRONSH_HISTORY_SIZE];
+	record->starttime = report->starttime;
+	record->runtime = report->runtime;
+	record->maxrss = command->rusage.ru_maxrss;
+	record->cpu = command->rusage.ru_utime.tv_sec * 1000 + command->rusage.ru_utime.tv_usec / 1000 + command->rusage.ru_stime.tv_sec * 1000 + command->rusage.ru_stime.tv_usec / 1000;
+	record->status = command->status;
+	record->signal = command->signal;
+
+	file->count++;
+
+	munmap(file, sizeof(historyfile_t));
+
+	flock(fd, LOCK_UN);
+	close(fd);
+
+	return 0;
+}
+
+// the cronsh and the command (negative for a process group) of the run that holds the lock
+static pid_t cronsh_overlap_holder(int fd, pid_t *target) {
+	char line[64];
+	ssize_t n;
+	int holder, t;
+
+	n = pread(fd, line, sizeof(line) - 1, 0);
+	if(n <= 0) {
+		return 0;
+	}
+
+	line[n] = '\0';
+
+	if(sscanf(line, "%d %d", &holder, &t) != 2) {
+		return 0;
+	}
+
+	*target = t;
+
+	return holder;
+}
+
+static int cronsh_overlap_skip(command_t *command, const char *reason) {
+	cronsh_log(CRONSH_LOGLEVEL_NOTICE, "skipping %s, %s", command->tag, reason);
+
+	command->overlap->result = CRONSH_OVERLAP_SKIPPED;
+	command->status = -1;
+
+	cronsh_overlap_unlock(command);
+
+	return -1;
+}
+
+// Whether target (negative for its process group) is still the command that holder started, pids might have been reused
+static int cronsh_overlap_child(pid_t holder, pid_t target) {
+	char path[64], data[1024], *p;
+	pid_t pid = (target < 0) ? -target : target;
+
+	if(holder <= 0 || pid <= 0) {
+		return 0;
+	}
+
+	if(kill(holder, 0) != 0 && errno != EPERM) {
+		return 0;
+	}
+
+	snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+	if(cronsh_profile_read(path, data, sizeof(data)) <= 0) {
+		return 0;
+	}
+
+	// pid (comm) state ppid ...
+	p = strrchr(data, ')');
+	if(p == NULL || strlen(p) < 4) {
+		return 0;
+	}
+
+	return (strtol(&p[4], NULL, 10) == holder);
+}
+
+/*
+	One step of kill-previous: SIGTERM to the command of the run that holds the lock and
+	SIGKILL after kill-after. Nothing is signalled unless the holder is alive and the target
+	is its child. Returns -1 if the lock is still held after kill-after and CRONSH_OVERLAP_GRACE.
+*/
+static int cronsh_overlap_kill(command_t *command, pid_t holder, pid_t target) {
+	overlap_t *overlap = command->overlap;
+	unsigned long killafter;
+	uint64_t now, since;
+
+	killafter = (command->settings.killafter != 0) ? command->settings.killafter : CRONSH_KILL_AFTER;
+
+	now = cronsh_now();
+	since = (overlap->signalled != 0) ? overlap->signalled : overlap->start;
+
+	if(now - since >= (uint64_t)(killafter + CRONSH_OVERLAP_GRACE) * 1000000) {
+		return -1;
+	}
+
+	// the holder writes its command into the lock once it has started it
+	if(target == 0 || !cronsh_overlap_child(holder, target)) {
+		return 0;
+	}
+
+	if(overlap->signalled == 0 || target != overlap->target) {
+		cronsh_log(CRONSH_LOGLEVEL_NOTICE, "killing the previous run of %s (%d)", command->tag, target);
+
+		kill(target, SIGTERM);
+
+		overlap->target = target;
+		overlap->previous = (target < 0) ? -target : target;
+		overlap->signalled = now;
+		overlap->killed = 0;
+	}
+	else if(overlap->killed == 0 && now - overlap->signalled >= (uint64_t)killafter * 1000000) {
+		kill(target, SIGKILL);
+
+		overlap->killed = 1;
+	}
+
+	return 0;
+}
+
+/*
+	Take the lock of the tag before the command is started. The lock is an flock on
+	cronsh_<tag>.lock in CRONSH_LOCKDIR that is held until the command has exited, so it
+	goes away with cronsh, however it ends. With wait, a run first has to get one of the
+	overlap-queue locks cronsh_<tag>.lock.<n>, otherwise it is skipped. Returns -1 if the
+	run is skipped. If the lock can't be taken at all, the command runs anyway.
+
+	With wait = 0, nothing blocks: it returns 1 while the previous run holds the lock
+	and is called again later, the queue lock and the state of kill-previous are kept
+	in between.
+*/
+static int cronsh_overlap_lock(command_t *command, int wait) {
+	overlap_t *overlap = command->overlap;
+	char path[PATH_MAX], suffix[32];
+	unsigned int i, queue;
+	int rv;
+	pid_t holder, target = 0;
+
+	if(overlap == NULL || overlap->locked != 0) {
+		return 0;
+	}
+
+	cronsh_tag_path(path, sizeof(path), config.lockdir, command->tag, ".lock");
+
+	if(overlap->fd == -1) {
+		overlap->fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0666);
+		if(overlap->fd == -1) {
+			cronsh_log(CRONSH_LOGLEVEL_CRITICAL, "failed opening the lock %s (%s), runs may overlap", path, strerror(errno));
+
+			free(overlap);
+			command->overlap = NULL;
+
+			return 0;
+		}
+
+		overlap->start = cronsh_now();
+	}
+
+	while((rv = flock(overlap->fd, LOCK_EX | LOCK_NB)) != 0) {
+		if(errno == EINTR) {
+			continue;
+		}
+
+		if(errno != EWOULDBLOCK) {
+			cronsh_log(CRONSH_LOGLEVEL_CRITICAL, "failed locking %s (%s), runs may overlap", path, strerror(errno));
+
+			cronsh_overlap_unlock(command);
+			free(overlap);
+			command->overlap = NULL;
+
+			return 0;
+		}
+
+		holder = cronsh_overlap_holder(overlap->fd, &target);
+
+		cronsh_log(CRONSH_LOGLEVEL_DEBUG, "%s is locked by %d (command %d)", path, holder, target);
+
+		// another command in the same manifest isn't killed, and only waited for without blocking
+		if(holder == config.pid && (command->settings.overlap == CRONSH_OVERLAP_KILL || (command->settings.overlap == CRONSH_OVERLAP_WAIT && wait != 0))) {
+			return cronsh_overlap_skip(command, "the previous run is in the same cronsh");
+		}
+
+		if(command->settings.overlap == CRONSH_OVERLAP_SKIP) {
+			return cronsh_overlap_skip(command, "the previous run is still going");
+		}
+
+		if(command->settings.overlap == CRONSH_OVERLAP_WAIT) {
+			overlap->result = CRONSH_OVERLAP_WAITED;
+
+			if(overlap->slot == -1) {
+				queue = (command->settings.overlapqueue != 0) ? command->settings.overlapqueue : CRONSH_OVERLAP_QUEUE;
+
+				for(i = 0; i < queue; i++) {
+					snprintf(suffix, sizeof(suffix), ".lock.%u", i);
+					cronsh_tag_path(path, sizeof(path), config.lockdir, command->tag, suffix);
+
+					overlap->slot = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0666);
+					if(overlap->slot == -1) {
+						continue;
+					}
+
+					if(flock(overlap->slot, LOCK_EX | LOCK_NB) == 0) {
+						break;
+					}
+
+					close(overlap->slot);
+					overlap->slot = -1;
+				}
+
+				if(overlap->slot == -1) {
+					return cronsh_overlap_skip(command, "the queue is full");
+				}
+
+				cronsh_log(CRONSH_LOGLEVEL_DEBUG, "waiting in %s", path);
+			}
+
+			if(wait == 0) {
+				return 1;
+			}
+
+			while((rv = flock(overlap->fd, LOCK_EX)) == -1 && errno == EINTR);
+
+			if(rv != 0) {
+				cronsh_log(CRONSH_LOGLEVEL_CRITICAL, "failed locking %s (%s), runs may overlap", command->tag, strerror(errno));
+			}
+
+			break;
+		}
+
+		overlap->result = CRONSH_OVERLAP_KILLED;
+
+		if(cronsh_overlap_kill(command, holder, target) != 0) {
+			return cronsh_overlap_skip(command, "the previous run didn't go away");
+		}
+
+		if(wait == 0) {
+			return 1;
+		}
+
+		usleep(CRONSH_OVERLAP_POLL * 1000);
+	}
+
+	if(overlap->slot != -1) {
+		close(overlap->slot);
+		overlap->slot = -1;
+	}
+
+	overlap->locked = 1;
+
+	if(overlap->result != CRONSH_OVERLAP_ACQUIRED) {
+		overlap->waited = (cronsh_now() - overlap->start) / 1000000;
+	}
+
+	// the previous run is gone, its pids are written again once the command runs
+	if(ftruncate(overlap->fd, 0) != 0) {
+		cronsh_log(CRONSH_LOGLEVEL_DEBUG, "failed truncating the lock of %s", command->tag);
+	}
+
+	return 0;
+}
+
+static void cronsh_overlap_owner(command_t *command) {
+	char line[64];
+	int n;
+
+	if(command->overlap == NULL || command->overlap->fd == -1) {
+		return;
+	}
+
+	n = snprintf(line, sizeof(line), "%d %d\n", config.pid, CRONSH_OPTION(command->options, KILL_GROUP) ? -command->pid : command->pid);
+
+	if(pwrite(command->overlap->fd, line, n, 0) != n) {
+		cronsh_log(CRONSH_LOGLEVEL_DEBUG, "failed writing the lock of %s", command->tag);
+	}
+
+	return;
+}
+
+static void cronsh_overlap_unlock(command_t *command) {
+	if(command->overlap == NULL) {
+		return;
+	}
+
+	if(command->overlap->slot != -1) {
+		close(command->overlap->slot);
+		command->overlap->slot = -1;
+	}
+
+	if(command->overlap->fd != -1) {
+		close(command->overlap->fd);
+		command->overlap->fd = -1;
+	}
+
+	command->overlap->locked = 0;
+
+	return;
+}
+
+/*
+	Delay the start by up to splay. The delay is derived from the hostname and the tag, so
+	a tag starts at the same offset on a host every time, but at different ones across a
+	fleet, and the tags of a host don't start together either.
+*/
+static void cronsh_admission_splay(command_t *command) {
+	char key[512];
+	struct timespec delay;
+
+	if(command->admission == NULL || command->settings.splay == 0) {
+		return;
+	}
+
+	snprintf(key, sizeof(key), "%s#%s", config.thishostname, (command->tag != NULL) ? command->tag : "");
+
+	command->admission->splay = cronsh_hash(key) % command->settings.splay;
+
+	cronsh_log(CRONSH_LOGLEVEL_DEBUG, "splay: %lums", command->admission->splay);
+
+	delay.tv_sec = command->admission->splay / 1000;
+	delay.tv_nsec = (command->admission->splay % 1000) * 1000000;
+
+	while(nanosleep(&delay, &delay) == -1 && errno == EINTR);
+
+	return;
+}
+
+/*
+	Take one of the CRONSH_MAXJOBS slots of the host, cronsh.slot.<n> in CRONSH_LOCKDIR.
+	Like the locks of overlap, a slot is an flock and goes away with cronsh. If all of them
+	are taken, it blocks on the flock of one slot, chosen by the pid so the waiting cronsh
+	spread over the slots. With wait = 0, it returns 1 instead and is called again later.
+	If the slots can't be used at all, the command starts anyway.
+*/
+static int cronsh_admission_acquire(admission_t *admission, int wait) {
+	char path[PATH_MAX], suffix[32];
+	long i, n;
+	int fd, rv;
+
+	if(config.maxjobs <= 0 || admission->fd != -1) {
+		return 0;
+	}
+
+	if(admission->start == 0) {
+		admission->start = cronsh_now();
+	}
+
+	for(i = 0, n = 0; i < config.maxjobs; i++) {
+		snprintf(suffix, sizeof(suffix), ".slot.%ld", i);
+		cronsh_tag_path(path, sizeof(path), config.lockdir, NULL, suffix);
+
+		fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0666);
+		if(fd == -1) {
+			continue;
+		}
+
+		n++;
+
+		if(flock(fd, LOCK_EX | LOCK_NB) == 0) {
+			break;
+		}
+
+		close(fd);
+		fd = -1;
+	}
+
+	if(n == 0) {
+		cronsh_log(CRONSH_LOGLEVEL_CRITICAL, "failed opening the slots in %s (%s), the jobs aren't limited", config.lockdir, strerror(errno));
+
+		return -1;
+	}
+
+	if(fd == -1) {
+		if(wait == 0) {
+			return 1;
+		}
+
+		i = config.pid % config.maxjobs;
+
+		cronsh_log(CRONSH_LOGLEVEL_DEBUG, "all %ld slots are taken, waiting for slot %ld", config.maxjobs, i);
+
+		snprintf(suffix, sizeof(suffix), ".slot.%ld", i);
+		cronsh_tag_path(path, sizeof(path), config.lockdir, NULL, suffix);
+
+		fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0666);
+		if(fd == -1) {
+			cronsh_log(CRONSH_LOGLEVEL_CRITICAL, "failed opening %s (%s), the job isn't limited", path, strerror(errno));
+
+			return -1;
+		}
+
+		while((rv = flock(fd, LOCK_EX)) == -1 && errno == EINTR);
+
+		if(rv != 0) {
+			cronsh_log(CRONSH_LOGLEVEL_CRITICAL, "failed locking %s (%s), the job isn't limited", path, strerror(errno));
+
+			close(fd);
+
+			return -1;
+		}
+	}
+
+	admission->fd = fd;
+	admission->slot = i;
+	admission->waited = (cronsh_now() - admission->start) / 1000000;
+
+	cronsh_log(CRONSH_LOGLEVEL_DEBUG, "got slot %ld of %ld after %lums", i, config.maxjobs, admission->waited);
+
+	return 0;
+}
+
+static void cronsh_admission_release(admission_t *admission) {
+	if(admission->fd == -1) {
+		return;
+	}
+
+	close(admission->fd);
+	admission->fd = -1;
+
+	return;
+}
+
+// A record with a chunk of the output of a command that is still running
+static int cronsh_stream_record(buffer_t *dst, command_t *command, const char *name, buffer_t *data, size_t offset) {
+	int rv = 0;
+	struct timespec now;
+	emitter_t emitter;
+
+	clock_gettime(CLOCK_REALTIME, &now);
+
+	emitterInit(&emitter, dst, command->settings.format);
+
+	rv += emitterStart(&emitter, 8);
+	rv += emitterString(&emitter, 0, "record", "chunk", 5);
+	rv += emitterString(&emitter, 0, "hostname", config.thishostname, strlen(config.thishostname));
+	rv += emitterString(&emitter, 0, "tag", command->tag, (command->tag != NULL) ? strlen(command->tag) : 0);
+	rv += emitterNumber(&emitter, 0, "pid", command->pid);
+	rv += emitterString(&emitter, 0, "stream", name, strlen(name));
+	rv += emitterNumber(&emitter, 0, "time", (long)now.tv_sec * 1000 + now.tv_nsec / 1000000);	// milliseconds
+	rv += emitterNumber(&emitter, 0, "offset", offset);
+	rv += emitterBytes(&emitter, 0, "data", data->data, data->used);
+	rv += emitterEnd(&emitter);
+
+	return rv;
+}
+
+static int cronsh_stream_pipe(command_t *command, const char *bytes, size_t nbytes) {
+	stream_t *stream = command->stream;
+
+	if(stream->failed != 0) {
+		return -1;
+	}
+
+	// the daemon keeps a consumer running already
+	if(consumer.fd != -1 && !strcmp(consumer.rawcommand, config.pipe)) {
+		return cronsh_consumer_write(bytes, nbytes);
+	}
+
+	if(stream->pipe == NULL) {
+		stream->pipe = cronsh_command_init(config.pipe, NULL);
+		if(stream->pipe == NULL) {
+			stream->failed = 1;
+			return -1;
+		}
+
+		if(eventInit(&stream->event) != 0) {
+			cronsh_command_free(stream->pipe);
+			stream->pipe = NULL;
+			stream->failed = 1;
+
+			return -1;
+		}
+
+		stream->pipe->stdinstream = 1;
+
+		if(cronsh_command_start(stream->pipe, &stream->event) != 0) {
+			eventFree(&stream->event);
+			cronsh_command_free(stream->pipe);
+			stream->pipe = NULL;
+			stream->failed = 1;
+
+			return -1;
+		}
+
+		sinkInitCommand(&stream->sink, stream->pipe, &stream->event);
+	}
+
+	if(cronsh_frame_write(&stream->sink, command->settings.pipeframe, bytes, nbytes) != 0) {
+		cronsh_log(CRONSH_LOGLEVEL_NOTICE, "the pipe didn't accept the record, not streaming to it anymore");
+
+		stream->failed = 1;
+
+		return -1;
+	}
+
+	return 0;
+}
+
+// Send what has been read since the last time to the file and the pipe, and forget about it
+static int cronsh_stream_forward(command_t *command) {
+	int i, rv = 0;
+	unsigned int capture;
+	stream_t *stream = command->stream;
+	buffer_t record, *data;
+	const char *name;
+
+	if(stream == NULL) {
+		return 0;
+	}
+
+	for(i = 0; i < 2; i++) {
+		data = (i == 0) ? &command->stdoutbuffer : &command->stderrbuffer;
+		name = (i == 0) ? "stdout" : "stderr";
+		capture = (i == 0) ? CRONSH_OPTION_CAPTURE_STDOUT : CRONSH_OPTION_CAPTURE_STDERR;
+
+		if(data->used == 0 || (command->options & capture) != capture) {
+			bufferReset(data);
+			continue;
+		}
+
+		if(bufferInit(&record, data->used + 1024) != 0) {
+			return -1;
+		}
+
+		if(cronsh_stream_record(&record, command, name, data, stream->bytes[i]) == 0) {
+			if(CRONSH_OPTION(command->options, SENDTO_PIPE) && config.pipe != NULL && cronsh_stream_pipe(command, record.data, record.used) != 0) {
+				rv = -1;
+			}
+
+			if(CRONSH_OPTION(command->options, SENDTO_FILE) && config.file != NULL) {
+				if(cronsh_file_prepare(config.file, stream->starttime, record.used) != 0 || cronsh_file_append(record.data, record.used) != 0) {
+					cronsh_log(CRONSH_LOGLEVEL_NOTICE, "failed streaming to file: %s", strerror(errno));
+
+					rv = -1;
+				}
+			}
+
+			stream->records++;
+		}
+
+		bufferFree(&record);
+
+		stream->bytes[i] += data->used;
+
+		bufferReset(data);
+	}
+
+	return rv;
+}
+
+// Send the summary to the pipe that got the records
+static int cronsh_stream_send(command_t *command, report_t *report) {
+	stream_t *stream = command->stream;
+
+	if(cronsh_frame_send(&stream->sink, command->settings.pipeframe, report) != 0) {
+		cronsh_log(CRONSH_LOGLEVEL_NOTICE, "the pipe didn't accept the whole document");
+
+		cronsh_stream_close(command);
+
+		return -1;
+	}
+
+	return cronsh_stream_close(command);
+}
+
+// Let the pipe finish, returns its exit status
+static int cronsh_stream_close(command_t *command) {
+	int rv;
+	stream_t *stream = command->stream;
+
+	if(stream == NULL || stream->pipe == NULL) {
+		return 0;
+	}
+
+	cronsh_command_closestdin(stream->pipe, &stream->event);
+	cronsh_command_run(stream->pipe, &stream->event);
+	cronsh_command_wait(stream->pipe);
+
+	rv = stream->pipe->status;
+
+	cronsh_log(CRONSH_LOGLEVEL_DEBUG, "streaming pipe status: %d", rv);
+
+	eventFree(&stream->event);
+	cronsh_command_free(stream->pipe);
+	stream->pipe = NULL;
+
+	return rv;
+}
+
+// Put the document into the spool of the consumer and leave the delivery to a flusher
+int cronsh_spool(const char *spool, const char *rawpipecommand, report_t *report) {
+	int fd, rv;
+	char *dir = NULL, *tmp = NULL, *new = NULL;
+	static unsigned int counter = 0;
+	sink_t sink;
+
+	if(spool == NULL || rawpipecommand == NULL) {
+		return -1;
+	}
+
+	// every consumer has its own spool: <spool>/<hash>/{tmp,new}
+	if(asprintf(&dir, "%s/%016llx", spool, (unsigned long long)cronsh_hash(rawpipecommand)) == -1) {
+		return -1;
+	}
+
+	rv = -1;
+
+	if(cronsh_spool_init(dir, rawpipecommand) != 0) {
+		cronsh_log(CRONSH_LOGLEVEL_CRITICAL, "failed creating spool %s: %s", dir, strerror(errno));
+
+		goto done;
+	}
+
+	// the names sort by the time of the report
+	if(asprintf(&tmp, "%s/tmp/%010ld.%d.%u", dir, (long)time(NULL), (int)getpid(), counter) == -1 || asprintf(&new, "%s/new/%010ld.%d.%u", dir, (long)time(NULL), (int)getpid(), counter) == -1) {
+		goto done;
+	}
+
+	counter++;
+
+	cronsh_log(CRONSH_LOGLEVEL_DEBUG, "spooling to: %s", new);
+
+	fd = open(tmp, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+	if(fd == -1) {
+		cronsh_log(CRONSH_LOGLEVEL_CRITICAL, "failed creating %s: %s", tmp, strerror(errno));
+
+		goto done;
+	}
+
+	sinkInitFD(&sink, fd);
+
+	if(cronsh_send(&sink, report) != 0 || fdatasync(fd) != 0) {
+		cronsh_log(CRONSH_LOGLEVEL_CRITICAL, "failed writing %s: %s", tmp, strerror(errno));
+
+		close(fd);
+		unlink(tmp);
+
+		goto done;
+	}
+
+	close(fd);
+
+	// the flusher only sees complete documents
+	if(rename(tmp, new) != 0) {
+		cronsh_log(CRONSH_LOGLEVEL_CRITICAL, "failed renaming %s: %s", tmp, strerror(errno));
+
+		unlink(tmp);
+
+		goto done;
+	}
+
+	cronsh_spool_flusher(dir, rawpipecommand);
+
+	rv = 0;
+
+done:
+	free(dir);
+	free(tmp);
+	free(new);
+
+	return rv;
+}
+
+static int cronsh_spool_init(const char *dir, const char *rawpipecommand) {
+	int fd, rv = 0;
+	char path[PATH_MAX], tmp[PATH_MAX];
+
+	if(mkdir(dir, 0700) != 0 && errno != EEXIST) {
+		return -1;
+	}
+
+	snprintf(path, sizeof(path), "%s/tmp", dir);
+	if(mkdir(path, 0700) != 0 && errno != EEXIST) {
+		return -1;
+	}
+
+	snprintf(path, sizeof(path), "%s/new", dir);
+	if(mkdir(path, 0700) != 0 && errno != EEXIST) {
+		return -1;
+	}
+
+	// leave a note which consumer this spool belongs to
+	snprintf(path, sizeof(path), "%s/command", dir);
+	if(access(path, F_OK) == 0) {
+		return 0;
+	}
+
+	snprintf(tmp, sizeof(tmp), "%s/tmp/command.%d", dir, (int)getpid());
+
+	fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+	if(fd == -1) {
+		return -1;
+	}
+
+	if(write(fd, rawpipecommand, strlen(rawpipecommand)) != (ssize_t)strlen(rawpipecommand) || rename(tmp, path) != 0) {
+		unlink(tmp);
+		rv = -1;
+	}
+
+	close(fd);
+
+	return rv;
+}
+
+// Start a flusher that is detached from us and from cron
+static void cronsh_spool_flusher(const char *dir, const char *rawpipecommand) {
+	int fd;
+	pid_t pid;
+
+	pid = fork();
+	if(pid < 0) {
+		cronsh_log(CRONSH_LOGLEVEL_CRITICAL, "failed starting the flusher: %s", strerror(errno));
+
+		return;
+	}
+
+	if(pid > 0) {
+		while(waitpid(pid, NULL, 0) == -1 && errno == EINTR);
+
+		return;
+	}
+
+	setsid();
+
+	if(fork() != 0) {
+		_exit(0);
+	}
+
+	config.pid = getpid();
+
+	// don't keep cron waiting for our output
+	fd = open("/dev/null", O_RDWR);
+	if(fd != -1) {
+		dup2(fd, 0);
+		dup2(fd, 1);
+		dup2(fd, 2);
+
+		if(fd > 2) {
+			close(fd);
+		}
+	}
+
+	// don't keep what we inherited open for as long as the consumer is failing, e.g. the lock of the
+	// tag, the slot of CRONSH_MAXJOBS, or a pipe of another job of the batch
+	if(config.logfp != NULL && config.logfp != stderr) {
+		fclose(config.logfp);
+	}
+
+	cronsh_spool_closefrom(3);
+
+	config.logfp = NULL;
+	if(config.log != NULL) {
+		config.logfp = fopen(config.log, "a");
+	}
+
+	_exit(cronsh_spool_flush(dir, rawpipecommand));
+}
+
+static void cronsh_spool_closefrom(int fd) {
+	long max;
+
+#if defined(__linux__) && defined(SYS_close_range)
+	if(syscall(SYS_close_range, fd, ~0U, 0) == 0) {
+		return;
+	}
+#endif
+
+	max = sysconf(_SC_OPEN_MAX);
+	if(max == -1) {
+		max = 1024;
+	}
+
+	for(; fd < max; fd++) {
+		close(fd);
+	}
+
+	return;
+}
+
+static int cronsh_spool_filter(const struct dirent *entry) {
+	return (entry->d_name[0] != '.');
+}
+
+static int cronsh_spool_flush(const char *dir, const char *rawpipecommand) {
+	int lockfd, n, attempts;
+	unsigned int backoff;
+	char path[PATH_MAX];
+	struct dirent **names;
+
+	snprintf(path, sizeof(path), "%s/lock", dir);
+
+	lockfd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+	if(lockfd == -1) {
+		return 1;
+	}
+
+	for(;;) {
+		// only one flusher per spool
+		if(flock(lockfd, LOCK_EX | LOCK_NB) != 0) {
+			break;
+		}
+
+		cronsh_log(CRONSH_LOGLEVEL_DEBUG, "flushing %s", dir);
+
+		attempts = 0;
+		backoff = 1;
+
+		while((n = cronsh_spool_batch(dir, rawpipecommand)) != 0) {
+			if(n > 0) {
+				attempts = 0;
+				backoff = 1;
+
+				continue;
+			}
+
+			if(++attempts == CRONSH_SPOOL_RETRIES) {
+				cronsh_log(CRONSH_LOGLEVEL_CRITICAL, "giving up on %s for now, the reports stay in the spool", dir);
+
+				break;
+			}
+
+			cronsh_log(CRONSH_LOGLEVEL_NOTICE, "delivery failed, retrying in %us", backoff);
+
+			sleep(backoff);
+
+			backoff *= 2;
+			if(backoff > CRONSH_SPOOL_MAXBACKOFF) {
+				backoff = CRONSH_SPOOL_MAXBACKOFF;
+			}
+		}
+
+		flock(lockfd, LOCK_UN);
+
+		if(n != 0) {
+			break;
+		}
+
+		// a report might have come in after the last look while its flusher found us holding the lock
+		snprintf(path, sizeof(path), "%s/new", dir);
+
+		n = scandir(path, &names, cronsh_spool_filter, NULL);
+		if(n <= 0) {
+			break;
+		}
+
+		while(n--) {
+			free(names[n]);
+		}
+
+		free(names);
+	}
+
+	close(lockfd);
+
+	return 0;
+}
+
+// Send the oldest documents to one consumer. Returns the number of delivered documents, 0 if there were none, or -1.
+static int cronsh_spool_batch(const char *dir, const char *rawpipecommand) {
+	int i, n, fd, rv = 0, delivered = 0;
+	char path[PATH_MAX], header[32];
+	char *data;
+	struct stat st;
+	struct dirent **names;
+	command_t *command;
+	event_t event;
+	sink_t sink;
+
+	snprintf(path, sizeof(path), "%s/new", dir);
+
+	n = scandir(path, &names, cronsh_spool_filter, alphasort);
+	if(n <= 0) {
+		return (n == 0) ? 0 : -1;
+	}
+
+	command = cronsh_command_init(rawpipecommand, NULL);
+	if(command == NULL || eventInit(&event) != 0) {
+		cronsh_command_free(command);
+
+		rv = 1;
+		goto done;
+	}
+
+	command->stdinstream = 1;
+
+	if(cronsh_command_start(command, &event) != 0) {
+		eventFree(&event);
+		cronsh_command_free(command);
+
+		rv = 1;
+		goto done;
+	}
+
+	sinkInitCommand(&sink, command, &event);
+
+	for(i = 0; i < n && i < CRONSH_SPOOL_BATCH && rv == 0; i++) {
+		snprintf(path, sizeof(path), "%s/new/%s", dir, names[i]->d_name);
+
+		fd = open(path, O_RDONLY | O_CLOEXEC);
+		if(fd == -1 || fstat(fd, &st) != 0) {
+			if(fd != -1) {
+				close(fd);
+			}
+
+			// keep it for later
+			names[i]->d_name[0] = '\0';
+
+			continue;
+		}
+
+		data = NULL;
+		if(st.st_size != 0) {
+			data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+			if(data == MAP_FAILED) {
+				close(fd);
+				rv = 1;
+
+				break;
+			}
+		}
+
+		if(config.settings.pipeframe == CRONSH_FRAME_LENGTH) {
+			snprintf(header, sizeof(header), "%lu\n", (unsigned long)st.st_size);
+			rv += sinkWrite(&sink, header, strlen(header));
+		}
+
+		rv += sinkWrite(&sink, data, st.st_size);
+
+		if(config.settings.pipeframe == CRONSH_FRAME_NUL) {
+			rv += sinkWrite(&sink, "", 1);
+		}
+
+		if(data != NULL) {
+			munmap(data, st.st_size);
+		}
+
+		close(fd);
+
+		delivered++;
+	}
+
+	cronsh_command_closestdin(command, &event);
+	cronsh_command_run(command, &event);
+	cronsh_command_wait(command);
+
+	eventFree(&event);
+
+	cronsh_log(CRONSH_LOGLEVEL_DEBUG, "status: %d", command->status);
+	cronsh_log(CRONSH_LOGLEVEL_DEBUG, "stdout: (%d) %s", command->stdoutbuffer.used, command->stdoutbuffer.data);
+	cronsh_log(CRONSH_LOGLEVEL_DEBUG, "stderr: (%d) %s", command->stderrbuffer.used, command->stderrbuffer.data);
+
+	if(rv == 0 && command->status == 0) {
+		// the consumer has them now
+		for(i = 0; i < n && i < CRONSH_SPOOL_BATCH; i++) {
+			if(names[i]->d_name[0] != '\0') {
+				snprintf(path, sizeof(path), "%s/new/%s", dir, names[i]->d_name);
+				unlink(path);
+			}
+		}
+
+		cronsh_log(CRONSH_LOGLEVEL_DEBUG, "delivered %d reports", delivered);
+	}
+	else {
+		rv = 1;
+	}
+
+	cronsh_command_free(command);
+
+done:
+	for(i = 0; i < n; i++) {
+		free(names[i]);
+	}
+
+	free(names);
+
+	return (rv == 0 && delivered != 0) ? delivered : -1;
+}
+
+int cronsh_send(sink_t *sink, report_t *report) {
+	int rv = 0;
+	buffer_t buffer;
+
+	// the document goes out in chunks, it is never kept in memory as a whole
+	if(bufferInitSink(&buffer, CRONSH_BUFFER_STEPSIZE, sink) != 0) {
+		return 1;
+	}
+
+	rv += cronsh_report(&buffer, report);
+	rv += bufferFlush(&buffer);
+
+	bufferFree(&buffer);
+
+	return rv;
+}
+
+void cronsh_command_spawn(command_t *command) {
+/*
+	- register the pipes and the child with an event loop
+	- write to stdin of child, read from stdout, stderr of child, non-blocking
+	- wait until the child exited or both stdout and stderr are closed
+	- wait4 for child
+	- capture the exit code
+*/
+	event_t event;
+
+	if(eventInit(&event) != 0) {
+		cronsh_log(CRONSH_LOGLEVEL_CRITICAL, "failed creating event loop: %s", strerror(errno));
+
+		command->status = -1;
+
+		return;
+	}
+
+	if(cronsh_command_start(command, &event) != 0) {
+		eventFree(&event);
+
+		return;
+	}
+
+	cronsh_command_run(command, &event);
+	cronsh_command_wait(command);
+
+	eventFree(&event);
+
+	return;
+}
+
+void cronsh_command_run(command_t *command, event_t *event) {
+	int i, n;
+	eventitem_t items[CRONSH_EVENT_MAXITEMS];
+
+	while(cronsh_command_running(command)) {
+		n = eventWait(event, items, CRONSH_EVENT_MAXITEMS, cronsh_command_timeout(command));
+		if(n == -1) {
+			if(errno == EINTR) {
+				continue;
+			}
+
+			cronsh_log(CRONSH_LOGLEVEL_CRITICAL, "waiting for events failed: %s", strerror(errno));
+
+			break;
+		}
+
+		for(i = 0; i < n; i++) {
+			cronsh_command_handle(command, event, items[i].fd, items[i].events);
+		}
+
+		cronsh_command_tick(command, event);
+	}
+
+	return;
+}
+
+int cronsh_command_start(command_t *command, event_t *event) {
+/*
+	- pipes for stdin, stdout, stderr
+	- posix_spawn with dup2 for descriptors
+	- register the parent's ends of the pipes and a pidfd for the child
+*/
+	pid_t pid;
+	int i;
+	int childstdinfd[2], childstdoutfd[2], childstderrfd[2];
+
+	// the command would run with the limits of an earlier one
+	if(cronsh_cgroup_left() != 0) {
+		cronsh_log(CRONSH_LOGLEVEL_CRITICAL, "cronsh is still in the cgroup of an earlier command, not starting '%s'", command->argv[0]);
+
+		command->status = -1;
+
+		return -1;
+	}
+
+	if(cronsh_fd_pipe(childstdinfd) != 0) {
+		cronsh_log(CRONSH_LOGLEVEL_CRITICAL, "failed creating pipes: %s", strerror(errno));
+
+		command->status = -1;
+
+		return -1;
+	}
+
+	if(cronsh_fd_pipe(childstdoutfd) != 0) {
+		cronsh_log(CRONSH_LOGLEVEL_CRITICAL, "failed creating pipes: %s", strerror(errno));
+
+		close(childstdinfd[0]);
+		close(childstdinfd[1]);
+
+		command->status = -1;
+
+		return -1;
+	}
+
+	if(cronsh_fd_pipe(childstderrfd) != 0) {
+		cronsh_log(CRONSH_LOGLEVEL_CRITICAL, "failed creating pipes: %s", strerror(errno));
+
+		close(childstdinfd[0]);
+		close(childstdinfd[1]);
+		close(childstdoutfd[0]);
+		close(childstdoutfd[1]);
+
+		command->status = -1;
+
+		return -1;
+	}
+
+	// posix_spawn gets away without copying our page tables
+	int childfds[3] = {childstdinfd[0], childstdoutfd[1], childstderrfd[1]};
+	posix_spawn_file_actions_t actions;
+	posix_spawnattr_t attr;
+	sigset_t sigs;
+	short flags = POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETSIGMASK;
+
+	posix_spawn_file_actions_init(&actions);
+	posix_spawnattr_init(&attr);
+
+	// redirect stdin, stdout, stderr. All other descriptors are closed on exec.
+	for(i = 0; i < 3; i++) {
+		posix_spawn_file_actions_adddup2(&actions, childfds[i], i);
+	}
+
+	sigemptyset(&sigs);
+	posix_spawnattr_setsigmask(&attr, &sigs);
+
+	sigaddset(&sigs, SIGPIPE);
+	posix_spawnattr_setsigdefault(&attr, &sigs);
+
+	// a group of its own, so descendants get the signals of the timeouts as well
+	if(CRONSH_OPTION(command->options, KILL_GROUP)) {
+		posix_spawnattr_setpgroup(&attr, 0);
+		flags |= POSIX_SPAWN_SETPGROUP;
+	}
+
+	posix_spawnattr_setflags(&attr, flags);
+
+	cronsh_cgroup_init(command);
+
+	i = cronsh_cgroup_spawn(command, &pid, &actions, &attr, childfds);
+
+	posix_spawn_file_actions_destroy(&actions);
+	posix_spawnattr_destroy(&attr);
+
+	if(i != 0) {
+		cronsh_log(CRONSH_LOGLEVEL_CRITICAL, "failed to execute '%s': %s (%d)", command->argv[0], strerror(i), i);
+
+		close(childstdinfd[0]);
+		close(childstdinfd[1]);
+		close(childstdoutfd[0]);
+		close(childstdoutfd[1]);
+		close(childstderrfd[0]);
+		close(childstderrfd[1]);
+
+		command->status = -1;
+
+		return -1;
+	}
+
+	command->pid = pid;
+
+	if(command->timeline != NULL) {
+		clock_gettime(CLOCK_MONOTONIC, &command->timeline->start);
+	}
+
+	cronsh_profile_start(command);
+
+	if(command->settings.timeout != 0 || command->settings.idletimeout != 0) {
+		command->deadline.start = cronsh_now();
+		command->deadline.output = command->deadline.start;
+	}
+
+	cronsh_log(CRONSH_LOGLEVEL_DEBUG, "spawned child (%d)", pid);
+
+	close(childstdinfd[0]);
+	close(childstdoutfd[1]);
+	close(childstderrfd[1]);
+
+	command->stdinfd = childstdinfd[1];
+	command->stdoutfd = childstdoutfd[0];
+	command->stderrfd = childstderrfd[0];
+
+	cronsh_fd_nonblock(command->stdinfd);
+	cronsh_fd_nonblock(command->stdoutfd);
+	cronsh_fd_nonblock(command->stderrfd);
+
+	command->stdinbytes = 0;
+	if(command->stdinbuffer != NULL) {
+		command->stdinbytes = command->stdinbuffer->used;
+	}
+
+	if(command->stdinstream != 0) {
+		// the sink registers stdin whenever it has to wait for the child
+	}
+	else if(command->stdinbytes == 0) {
+		close(command->stdinfd);
+		command->stdinfd = -1;
+	}
+	else {
+		eventAdd(event, command->stdinfd, CRONSH_EVENT_WRITE, command);
+	}
+
+	eventAdd(event, command->stdoutfd, CRONSH_EVENT_READ, command);
+	eventAdd(event, command->stderrfd, CRONSH_EVENT_READ, command);
+
+	// get notified as soon as the child exits
+#if defined(__linux__) && defined(SYS_pidfd_open)
+	command->pidfd = syscall(SYS_pidfd_open, pid, 0);
+	if(command->pidfd != -1) {
+		eventAdd(event, command->pidfd, CRONSH_EVENT_READ, command);
+	}
+	else {
+		cronsh_log(CRONSH_LOGLEVEL_DEBUG, "no pidfd for child (%s)", strerror(errno));
+	}
+#endif
+
+	return 0;
+}
+
+static void cronsh_command_close(event_t *event, int *fd) {
+	if(*fd == -1) {
+		return;
+	}
+
+	if(event != NULL) {
+		eventDelete(event, *fd);
+	}
+
+	close(*fd);
+	*fd = -1;
+
+	return;
+}
+
+// Remember when how many bytes were read from which stream
+static void cronsh_command_timeline(timeline_t *timeline, uint32_t stream, size_t nbytes) {
+	size_t size;
+	struct timespec now;
+	timelineentry_t *entries, *entry;
+
+	if(timeline->used == CRONSH_TIMELINE_MAXENTRIES) {
+		timeline->dropped++;
+		return;
+	}
+
+	if(timeline->used == timeline->size) {
+		size = (timeline->size == 0) ? 256 : timeline->size * 2;
+
+		entries = (timelineentry_t *)realloc(timeline->entries, size * sizeof(timelineentry_t));
+		if(entries == NULL) {
+			timeline->dropped++;
+			return;
+		}
+
+		timeline->entries = entries;
+		timeline->size = size;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	entry = &timeline->entries[timeline->used++];
+	entry->time = (uint64_t)(now.tv_sec - timeline->start.tv_sec) * 1000000000ULL + now.tv_nsec - timeline->start.tv_nsec;
+	entry->length = nbytes;
+	entry->stream = stream;
+
+	return;
+}
+
+static void cronsh_command_read(command_t *command, event_t *event, int *fd, buffer_t *buffer, int drain) {
+	ssize_t bytes;
+
+	while(*fd != -1) {
+		bytes = bufferRead(buffer, *fd, CRONSH_BUFFER_STEPSIZE);
+		if(bytes > 0) {
+			if(command->timeline != NULL) {
+				cronsh_command_timeline(command->timeline, (fd == &command->stdoutfd) ? 1 : 2, bytes);
+			}
+
+			if(command->settings.idletimeout != 0) {
+				command->deadline.output = cronsh_now();
+			}
+
+			if(drain == 0) {
+				break;
+			}
+
+			continue;
+		}
+
+		if(bytes == -1) {
+			if(errno == EINTR) {
+				continue;
+			}
+
+			if(errno == EAGAIN || errno == EWOULDBLOCK) {
+				// nothing left for now. When draining, the writers are gone for good.
+				if(drain != 0) {
+					cronsh_command_close(event, fd);
+				}
+
+				break;
+			}
+		}
+
+		// EOF or error
+		cronsh_command_close(event, fd);
+	}
+
+	return;
+}
+
+static void cronsh_command_exited(command_t *command, event_t *event) {
+	// the zombie still has its counters
+	cronsh_profile_sample(command, 1);
+
+	cronsh_command_close(event, &command->pidfd);
+
+	// collect what the child left in the pipes. Don't wait for descendants that inherited them.
+	cronsh_command_read(command, event, &command->stdoutfd, &command->stdoutbuffer, 1);
+	cronsh_command_read(command, event, &command->stderrfd, &command->stderrbuffer, 1);
+	cronsh_stream_forward(command);
+
+	cronsh_command_close(event, &command->stdinfd);
+
+	return;
+}
+
+void cronsh_command_handle(command_t *command, event_t *event, int fd, unsigned int events) {
+	ssize_t bytes;
+
+	// every descriptor is read or written until it would block, whatever woke it up
+	(void)events;
+
+	if(fd == -1) {
+		return;
+	}
+
+	if(fd == command->stdinfd) {
+		if(command->stdinstream != 0) {
+			return;
+		}
+
+		bytes = write(command->stdinfd, &command->stdinbuffer->data[command->stdinbuffer->used - command->stdinbytes], command->stdinbytes);
+		if(bytes > 0) {
+			command->stdinbytes -= bytes;
+		}
+		else if(bytes == -1 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+			return;
+		}
+		else {
+			// the child doesn't want any more input
+			command->stdinbytes = 0;
+		}
+
+		if(command->stdinbytes == 0) {
+			cronsh_command_close(event, &command->stdinfd);
+		}
+	}
+	else if(fd == command->stdoutfd) {
+		cronsh_command_read(command, event, &command->stdoutfd, &command->stdoutbuffer, 0);
+		cronsh_stream_forward(command);
+	}
+	else if(fd == command->stderrfd) {
+		cronsh_command_read(command, event, &command->stderrfd, &command->stderrbuffer, 0);
+		cronsh_stream_forward(command);
+	}
+	else if(fd == command->pidfd) {
+		cronsh_log(CRONSH_LOGLEVEL_DEBUG, "child (%d) exited", command->pid);
+
+		cronsh_command_exited(command, event);
+	}
+
+	return;
+}
+
+void cronsh_command_closestdin(command_t *command, event_t *event) {
+	cronsh_command_close(event, &command->stdinfd);
+
+	return;
+}
+
+int cronsh_command_running(command_t *command) {
+	if(command->stdoutfd != -1 || command->stderrfd != -1 || command->pidfd != -1) {
+		return 1;
+	}
+
+	return 0;
+}
+
+void cronsh_command_wait(command_t *command) {
+	int status = 0;
+
+	cronsh_command_close(NULL, &command->stdinfd);
+	cronsh_command_close(NULL, &command->stdoutfd);
+	cronsh_command_close(NULL, &command->stderrfd);
+	cronsh_command_close(NULL, &command->pidfd);
+
+	// make spooled output accessible like any other buffer
+	if(bufferMap(&command->stdoutbuffer) != 0) {
+		cronsh_log(CRONSH_LOGLEVEL_CRITICAL, "failed reading the spooled stdout, dropping %lu bytes (%s)", (unsigned long)command->stdoutbuffer.used, strerror(errno));
+		bufferFree(&command->stdoutbuffer);
+		bufferInit(&command->stdoutbuffer, CRONSH_BUFFER_STEPSIZE);
+	}
+
+	if(bufferMap(&command->stderrbuffer) != 0) {
+		cronsh_log(CRONSH_LOGLEVEL_CRITICAL, "failed reading the spooled stderr, dropping %lu bytes (%s)", (unsigned long)command->stderrbuffer.used, strerror(errno));
+		bufferFree(&command->stderrbuffer);
+		bufferInit(&command->stderrbuffer, CRONSH_BUFFER_STEPSIZE);
+	}
+
+	// put the kept tail of limited output behind the head
+	bufferCompact(&command->stdoutbuffer);
+	bufferCompact(&command->stderrbuffer);
+
+	// complete the compressed streams
+	if(bufferCompressEnd(&command->stdoutbuffer) != 0 || bufferCompressEnd(&command->stderrbuffer) != 0) {
+		cronsh_log(CRONSH_LOGLEVEL_CRITICAL, "failed compressing the output");
+	}
+
+	if(command->pid <= 0) {
+		return;
+	}
+
+	cronsh_log(CRONSH_LOGLEVEL_DEBUG, "waitpid(%d)", command->pid);
+
+	while(wait4(command->pid, &status, 0, &command->rusage) == -1) {
+		if(errno != EINTR) {
+			cronsh_log(CRONSH_LOGLEVEL_CRITICAL, "waitpid(%d) failed: %s", command->pid, strerror(errno));
+
+			command->status = -1;
+
+			return;
+		}
+	}
+
+	if(WIFEXITED(status)) {
+		command->status = WEXITSTATUS(status);
+	}
+	else {
+		command->status = -1;
+	}
+
+	if(WIFSIGNALED(status)) {
+		command->signal = WTERMSIG(status);
+	}
+
+	cronsh_cgroup_collect(command);
+
+	return;
+}
+
+// CLOCK_MONOTONIC in nanoseconds
+static uint64_t cronsh_now(void) {
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+static ssize_t cronsh_profile_read(const char *path, char *data, size_t size) {
+	int fd;
+	ssize_t bytes;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if(fd == -1) {
+		return -1;
+	}
+
+	bytes = read(fd, data, size - 1);
+
+	close(fd);
+
+	if(bytes < 0) {
+		return -1;
+	}
+
+	data[bytes] = '\0';
+
+	return bytes;
+}
+
+// Read the counters of one process, returns 0 if it is gone
+static int cronsh_profile_process(pid_t pid, profileproc_t *proc, uint64_t *rss) {
+	int i;
+	char path[64], data[1024], *p, *line;
+	unsigned long long utime = 0, stime = 0, pages = 0, value;
+
+	snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+	if(cronsh_profile_read(path, data, sizeof(data)) <= 0) {
+		return 0;
+	}
+
+	// the command name may contain anything, the fields start after the last )
+	p = strrchr(data, ')');
+	if(p == NULL) {
+		return 0;
+	}
+
+	// field 3 (state) is the first one, utime is 14, stime is 15, rss is 24
+	for(i = 3, p++; i <= 24; i++) {
+		p = strchr(p, ' ');
+		if(p == NULL) {
+			break;
+		}
+		p++;
+
+		if(i == 14) { utime = strtoull(p, NULL, 10); }
+		else if(i == 15) { stime = strtoull(p, NULL, 10); }
+		else if(i == 24) { pages = strtoull(p, NULL, 10); }
+	}
+
+	proc->pid = pid;
+	proc->cpu = utime + stime;
+	*rss = pages * (uint64_t)sysconf(_SC_PAGESIZE);
+
+	// only readable for our own processes
+	proc->read = 0;
+	proc->write = 0;
+
+	snprintf(path, sizeof(path), "/proc/%d/io", pid);
+	if(cronsh_profile_read(path, data, sizeof(data)) > 0) {
+		for(line = data; line != NULL; line = strchr(line, '\n')) {
+			if(*line == '\n') {
+				line++;
+			}
+
+			if(sscanf(line, "read_bytes: %llu", &value) == 1) { proc->read = value; }
+			else if(sscanf(line, "write_bytes: %llu", &value) == 1) { proc->write = value; }
+		}
+	}
+
+	// time spent on the CPU and waiting for it, in nanoseconds
+	proc->wait = 0;
+
+	snprintf(path, sizeof(path), "/proc/%d/schedstat", pid);
+	if(cronsh_profile_read(path, data, sizeof(data)) > 0) {
+		if(sscanf(data, "%*u %llu", &value) == 1) {
+			proc->wait = value;
+		}
+	}
+
+	return 1;
+}
+
+// All processes below and including pid, as far as the kernel tells about children
+static size_t cronsh_profile_tree(pid_t pid, pid_t **pids, size_t *size) {
+	size_t n = 0, i;
+	char path[320], data[4096], *p, *end;
+	DIR *dir;
+	struct dirent *entry;
+	pid_t *tpids, child;
+
+	if(*size == 0) {
+		*pids = (pid_t *)malloc(16 * sizeof(pid_t));
+		if(*pids == NULL) {
+			return 0;
+		}
+		*size = 16;
+	}
+
+	(*pids)[n++] = pid;
+
+	for(i = 0; i < n; i++) {
+		snprintf(path, sizeof(path), "/proc/%d/task", (*pids)[i]);
+
+		dir = opendir(path);
+		if(dir == NULL) {
+			continue;
+		}
+
+		while((entry = readdir(dir)) != NULL) {
+			if(entry->d_name[0] == '.') {
+				continue;
+			}
+
+			snprintf(path, sizeof(path), "/proc/%d/task/%s/children", (*pids)[i], entry->d_name);
+			if(cronsh_profile_read(path, data, sizeof(data)) <= 0) {
+				continue;
+			}
+
+			for(p = data; ; p = end) {
+				child = (pid_t)strtol(p, &end, 10);
+				if(end == p) {
+					break;
+				}
+
+				if(n == *size) {
+					tpids = (pid_t *)realloc(*pids, *size * 2 * sizeof(pid_t));
+					if(tpids == NULL) {
+						break;
+					}
+
+					*pids = tpids;
+					*size *= 2;
+				}
+
+				(*pids)[n++] = child;
+			}
+		}
+
+		closedir(dir);
+	}
+
+	return n;
+}
+
+static void cronsh_profile_start(command_t *command) {
+	profile_t *profile = command->profile;
+
+	if(profile == NULL) {
+		return;
+	}
+
+	if(command->settings.profileinterval == 0) {
+		command->settings.profileinterval = CRONSH_PROFILE_INTERVAL;
+	}
+
+	profile->start = cronsh_now();
+	profile->last = profile->start;
+	profile->next = profile->start + (uint64_t)command->settings.profileinterval * 1000000;
+
+	return;
+}
+
+// Take a sample of the process tree of the command and account what happened since the previous one
+static void cronsh_profile_sample(command_t *command, int last) {
+	profile_t *profile = command->profile;
+	profileproc_t *procs, *prev;
+	profilesample_t *samples, *sample;
+	size_t n, i, j, nprocs = 0;
+	uint64_t now, rss, totalrss = 0, cpu = 0, elapsed;
+
+	if(profile == NULL || profile->next == 0 || command->pid <= 0) {
+		return;
+	}
+
+	now = cronsh_now();
+	elapsed = now - profile->last;
+
+	n = cronsh_profile_tree(command->pid, &profile->pids, &profile->pidssize);
+
+	procs = (profileproc_t *)malloc((n + 1) * sizeof(profileproc_t));
+	if(procs == NULL) {
+		return;
+	}
+
+	for(i = 0; i < n; i++) {
+		if(cronsh_profile_process(profile->pids[i], &procs[nprocs], &rss) == 0) {
+			continue;
+		}
+
+		totalrss += rss;
+
+		// what the process did since the last sample, or since it was started
+		for(j = 0, prev = NULL; j < profile->nprocs; j++) {
+			if(profile->procs[j].pid == procs[nprocs].pid) {
+				prev = &profile->procs[j];
+				break;
+			}
+		}
+
+		if(prev != NULL && prev->cpu <= procs[nprocs].cpu) {
+			cpu += procs[nprocs].cpu - prev->cpu;
+			profile->read += procs[nprocs].read - prev->read;
+			profile->write += procs[nprocs].write - prev->write;
+			profile->wait += procs[nprocs].wait - prev->wait;
+		}
+		else {
+			cpu += procs[nprocs].cpu;
+			profile->read += procs[nprocs].read;
+			profile->write += procs[nprocs].write;
+			profile->wait += procs[nprocs].wait;
+		}
+
+		nprocs++;
+	}
+
+	free(profile->procs);
+	profile->procs = procs;
+	profile->nprocs = nprocs;
+
+	profile->last = now;
+	profile->cpu += cpu;
+
+	// the child has exited and its children can't be found anymore, only count what it did last
+	if(last == 1 || nprocs == 0) {
+		profile->next = 0;
+		return;
+	}
+
+	profile->next += (uint64_t)command->settings.profileinterval * 1000000;
+	if(profile->next <= now) {
+		profile->next = now + (uint64_t)command->settings.profileinterval * 1000000;
+	}
+
+	if(elapsed == 0) {
+		return;
+	}
+
+	if(profile->used == profile->size) {
+		n = (profile->size == 0) ? 64 : profile->size * 2;
+
+		samples = (profilesample_t *)realloc(profile->samples, n * sizeof(profilesample_t));
+		if(samples == NULL) {
+			return;
+		}
+
+		profile->samples = samples;
+		profile->size = n;
+	}
+
+	sample = &profile->samples[profile->used++];
+	sample->time = (now - profile->start) / 1000000;
+	sample->cpu = (cpu * 1000000000ULL * 100) / ((uint64_t)sysconf(_SC_CLK_TCK) * elapsed);
+	sample->rss = totalrss / 1024;
+	sample->processes = nprocs;
+
+	if(sample->cpu > profile->peakcpu) { profile->peakcpu = sample->cpu; }
+	if(sample->rss > profile->peakrss) { profile->peakrss = sample->rss; }
+	if(sample->processes > profile->peakprocesses) { profile->peakprocesses = sample->processes; }
+
+	profile->sumrss += sample->rss;
+
+	return;
+}
+
+static int cronsh_cgroup_write(const char *dir, const char *file, const char *value) {
+	int fd;
+	char path[PATH_MAX];
+	ssize_t bytes;
+
+	snprintf(path, sizeof(path), "%s/%s", dir, file);
+
+	fd = open(path, O_WRONLY | O_CLOEXEC);
+	if(fd == -1) {
+		return -1;
+	}
+
+	bytes = write(fd, value, strlen(value));
+
+	close(fd);
+
+	if(bytes != (ssize_t)strlen(value)) {
+		return -1;
+	}
+
+	return 0;
+}
+
+static ssize_t cronsh_cgroup_read(const char *dir, const char *file, char *data, size_t size) {
+	char path[PATH_MAX];
+
+	snprintf(path, sizeof(path), "%s/%s", dir, file);
+
+	return cronsh_profile_read(path, data, size);
+}
+
+// The cgroup cronsh is in, from the cgroup v2 mount and the 0:: line of /proc/self/cgroup
+static char *cronsh_cgroup_self(void) {
+	FILE *fp;
+	char *line = NULL, *mount = NULL, *self = NULL, *path;
+	size_t linesize = 0;
+
+	fp = fopen("/proc/self/mountinfo", "re");
+	if(fp == NULL) {
+		return NULL;
+	}
+
+	while(mount == NULL && getline(&line, &linesize, fp) != -1) {
+		if(strstr(line, " - cgroup2 ") == NULL) {
+			continue;
+		}
+
+		// the mount point is the fifth field
+		if(sscanf(line, "%*s %*s %*s %*s %ms", &mount) != 1) {
+			mount = NULL;
+		}
+	}
+
+	fclose(fp);
+
+	if(mount == NULL) {
+		free(line);
+		return NULL;
+	}
+
+	fp = fopen("/proc/self/cgroup", "re");
+	if(fp != NULL) {
+		while(getline(&line, &linesize, fp) != -1) {
+			if(strncmp(line, "0::", 3) != 0) {
+				continue;
+			}
+
+			path = &line[3];
+			path[strcspn(path, "\n")] = '\0';
+
+			if(asprintf(&self, "%s%s", mount, (strcmp(path, "/") == 0) ? "" : path) == -1) {
+				self = NULL;
+			}
+
+			break;
+		}
+
+		fclose(fp);
+	}
+
+	free(line);
+	free(mount);
+
+	return self;
+}
+
+// Create a cgroup for the command below CRONSH_CGROUP or the own cgroup and set its limits
+static int cronsh_cgroup_init(command_t *command) {
+	static unsigned long n = 0;
+	cgroup_t *cgroup = command->cgroup;
+	const char *parent;
+	char value[128], *device, *key, *string, *ref;
+	int rv = 0;
+
+	if(cgroup == NULL) {
+		return 0;
+	}
+
+	cgroup->self = cronsh_cgroup_self();
+
+	parent = (config.cgroup != NULL) ? config.cgroup : cgroup->self;
+	if(parent == NULL) {
+		cronsh_log(CRONSH_LOGLEVEL_NOTICE, "no cgroup v2 hierarchy found, running without cgroup");
+
+		return -1;
+	}
+
+	if(asprintf(&cgroup->path, "%s/cronsh-%d-%lu", parent, config.pid, n++) == -1) {
+		cgroup->path = NULL;
+
+		return -1;
+	}
+
+	if(mkdir(cgroup->path, 0755) == -1) {
+		cronsh_log(CRONSH_LOGLEVEL_NOTICE, "failed creating cgroup %s, running without cgroup: %s", cgroup->path, strerror(errno));
+
+		free(cgroup->path);
+		cgroup->path = NULL;
+
+		return -1;
+	}
+
+	cronsh_log(CRONSH_LOGLEVEL_DEBUG, "cgroup: %s", cgroup->path);
+
+	if(command->settings.cpuquota == 0 && command->settings.memorymax == 0 && command->settings.iomax[0] == '\0') {
+		return 0;
+	}
+
+	// a cgroup with processes can't enable controllers for its children (no internal processes), so not the one of cronsh
+	if(config.cgroup == NULL || (cgroup->self != NULL && !strcmp(config.cgroup, cgroup->self))) {
+		cronsh_log(CRONSH_LOGLEVEL_NOTICE, "the limits need CRONSH_CGROUP outside of the cgroup of cronsh, running %s without limits", cgroup->path);
+
+		return 0;
+	}
+
+	// each one on its own, the parent may not have all of them
+	cronsh_cgroup_write(parent, "cgroup.subtree_control", "+cpu");
+	cronsh_cgroup_write(parent, "cgroup.subtree_control", "+memory");
+	cronsh_cgroup_write(parent, "cgroup.subtree_control", "+io");
+
+	if(command->settings.cpuquota != 0) {
+		snprintf(value, sizeof(value), "%u 100000", command->settings.cpuquota * 1000);
+		if(cronsh_cgroup_write(cgroup->path, "cpu.max", value) != 0) {
+			cronsh_log(CRONSH_LOGLEVEL_NOTICE, "failed setting cpu-quota (cpu controller not available?): %s", strerror(errno));
+			rv = -1;
+		}
+	}
+
+	if(command->settings.memorymax != 0) {
+		snprintf(value, sizeof(value), "%zu", command->settings.memorymax);
+		if(cronsh_cgroup_write(cgroup->path, "memory.max", value) != 0) {
+			cronsh_log(CRONSH_LOGLEVEL_NOTICE, "failed setting memory-max (memory controller not available?): %s", strerror(errno));
+			rv = -1;
+		}
+	}
+
+	if(command->settings.iomax[0] != '\0') {
+		// major:minor,key=value,... to "major:minor key=value ..." with sizes like 10M
+		ref = string = strdup(command->settings.iomax);
+		if(ref != NULL) {
+			device = strsep(&string, ",");
+			snprintf(value, sizeof(value), "%s", device);
+
+			while((key = strsep(&string, ",")) != NULL) {
+				device = strchr(key, '=');
+				if(device == NULL) {
+					continue;
+				}
+
+				*device++ = '\0';
+
+				if(!strcmp(device, "max")) {
+					snprintf(&value[strlen(value)], sizeof(value) - strlen(value), " %s=max", key);
+				}
+				else if(cronsh_parse_size(device) != 0) {
+					snprintf(&value[strlen(value)], sizeof(value) - strlen(value), " %s=%zu", key, cronsh_parse_size(device));
+				}
+			}
+
+			free(ref);
+
+			if(cronsh_cgroup_write(cgroup->path, "io.max", value) != 0) {
+				cronsh_log(CRONSH_LOGLEVEL_NOTICE, "failed setting io-max (io controller not available?): %s", strerror(errno));
+				rv = -1;
+			}
+		}
+	}
+
+	if(rv != 0) {
+		cronsh_log(CRONSH_LOGLEVEL_NOTICE, "the limits for %s are not fully enforced", cgroup->path);
+	}
+
+	return 0;
+}
+
+#if defined(__linux__) && defined(SYS_clone3) && defined(CLONE_INTO_CGROUP) && !defined(POSIX_SPAWN_SETCGROUP)
+/*
+	Start the command in the cgroup behind fd like posix_spawn with the attributes of
+	cronsh_command_start. The child copies our page tables, it's only used for commands with a
+	cgroup. A failed exec is reported back through a pipe that is closed on exec. Returns 0 or an
+	error number.
+*/
+static int cronsh_cgroup_clone(command_t *command, int fd, pid_t *pid, int childfds[3]) {
+	struct clone_args args;
+	int i, err, fds[2];
+	ssize_t bytes;
+	sigset_t sigs;
+
+	if(cronsh_fd_pipe(fds) != 0) {
+		return errno;
+	}
+
+	memset(&args, 0, sizeof(args));
+	args.flags = CLONE_INTO_CGROUP;
+	args.exit_signal = SIGCHLD;
+	args.cgroup = fd;
+
+	*pid = syscall(SYS_clone3, &args, sizeof(args));
+	if(*pid == -1) {
+		err = errno;
+
+		close(fds[0]);
+		close(fds[1]);
+
+		return err;
+	}
+
+	if(*pid == 0) {
+		close(fds[0]);
+
+		for(i = 0; i < 3; i++) {
+			if(childfds[i] == i) {
+				fcntl(i, F_SETFD, 0);
+			}
+			else {
+				dup2(childfds[i], i);
+			}
+		}
+
+		sigemptyset(&sigs);
+		sigprocmask(SIG_SETMASK, &sigs, NULL);
+		signal(SIGPIPE, SIG_DFL);
+
+		if(CRONSH_OPTION(command->options, KILL_GROUP)) {
+			setpgid(0, 0);
+		}
+
+		if(command->path != NULL) {
+			execve(command->path, command->argv, environ);
+		}
+		else {
+			execvp(command->argv[0], command->argv);
+		}
+
+		err = errno;
+		while(write(fds[1], &err, sizeof(err)) == -1 && errno == EINTR);
+
+		_exit(127);
+	}
+
+	close(fds[1]);
+
+	while((bytes = read(fds[0], &err, sizeof(err))) == -1 && errno == EINTR);
+
+	close(fds[0]);
+
+	if(bytes == sizeof(err)) {
+		while(waitpid(*pid, NULL, 0) == -1 && errno == EINTR);
+
+		return err;
+	}
+
+	return 0;
+}
+#endif
+
+/*
+	Spawn the command, straight into its cgroup if it has one: with posix_spawn where glibc
+	can do it, otherwise with clone3(). Only if the kernel can't, cronsh joins the cgroup for
+	the spawn and leaves it again. Returns 0 or an error number like posix_spawn.
+*/
+static int cronsh_cgroup_spawn(command_t *command, pid_t *pid, posix_spawn_file_actions_t *actions, posix_spawnattr_t *attr, int childfds[3]) {
+	cgroup_t *cgroup = command->cgroup;
+	int rv = ENOSYS, fd;
+
+	// only clone3() needs them, posix_spawn has them in actions
+	(void)childfds;
+
+	if(cgroup != NULL && cgroup->path != NULL) {
+		fd = open(cgroup->path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+		if(fd != -1) {
+#if defined(POSIX_SPAWN_SETCGROUP)
+			short flags;
+
+			posix_spawnattr_getflags(attr, &flags);
+			posix_spawnattr_setcgroup_np(attr, fd);
+			posix_spawnattr_setflags(attr, flags | POSIX_SPAWN_SETCGROUP);
+
+			if(command->path != NULL) {
+				rv = posix_spawn(pid, command->path, actions, attr, command->argv, environ);
+			}
+			else {
+				rv = posix_spawnp(pid, command->argv[0], actions, attr, command->argv, environ);
+			}
+
+			posix_spawnattr_setflags(attr, flags);
+#elif defined(__linux__) && defined(SYS_clone3) && defined(CLONE_INTO_CGROUP)
+			rv = cronsh_cgroup_clone(command, fd, pid, childfds);
+#endif
+
+			close(fd);
+		}
+
+		// ENOSYS without clone3(), EINVAL without CLONE_INTO_CGROUP (before Linux 5.7)
+		if(rv != ENOSYS && rv != EINVAL) {
+			if(rv != 0) {
+				cronsh_cgroup_leave(command, 0);
+			}
+
+			return rv;
+		}
+
+		cronsh_log(CRONSH_LOGLEVEL_DEBUG, "can't spawn into cgroup %s, joining it for the spawn", cgroup->path);
+
+		cronsh_cgroup_enter(command);
+	}
+
+	if(command->path != NULL) {
+		rv = posix_spawn(pid, command->path, actions, attr, command->argv, environ);
+	}
+	else {
+		rv = posix_spawnp(pid, command->argv[0], actions, attr, command->argv, environ);
+	}
+
+	cronsh_cgroup_leave(command, (rv == 0) ? *pid : 0);
+
+	return rv;
+}
+
+// Try again to leave the cgroup of a command, returns -1 if cronsh is still in it
+static int cronsh_cgroup_left(void) {
+	if(config.cgroupleave == NULL) {
+		return 0;
+	}
+
+	if(cronsh_cgroup_write(config.cgroupleave, "cgroup.procs", "0") != 0) {
+		return -1;
+	}
+
+	cronsh_log(CRONSH_LOGLEVEL_NOTICE, "left the cgroup of an earlier command");
+
+	free(config.cgroupleave);
+	config.cgroupleave = NULL;
+
+	return 0;
+}
+
+// Join the cgroup of the command for the spawn, so the child starts in it before it can fork
+static void cronsh_cgroup_enter(command_t *command) {
+	cgroup_t *cgroup = command->cgroup;
+
+	if(cgroup == NULL || cgroup->path == NULL || cgroup->self == NULL) {
+		return;
+	}
+
+	if(cronsh_cgroup_write(cgroup->path, "cgroup.procs", "0") == 0) {
+		cgroup->entered = 1;
+	}
+
+	return;
+}
+
+static void cronsh_cgroup_leave(command_t *command, pid_t pid) {
+	cgroup_t *cgroup = command->cgroup;
+	char value[32];
+
+	if(cgroup == NULL || cgroup->path == NULL) {
+		return;
+	}
+
+	if(cgroup->entered == 1) {
+		if(cronsh_cgroup_write(cgroup->self, "cgroup.procs", "0") != 0) {
+			cronsh_log(CRONSH_LOGLEVEL_CRITICAL, "failed leaving cgroup %s, no further commands are started: %s", cgroup->path, strerror(errno));
+
+			config.cgroupleave = strdup(cgroup->self);
+		}
+
+		cgroup->entered = 0;
+	}
+	else if(pid > 0) {
+		// too late for anything the child forked already
+		snprintf(value, sizeof(value), "%d", pid);
+		if(cronsh_cgroup_write(cgroup->path, "cgroup.procs", value) != 0) {
+			cronsh_log(CRONSH_LOGLEVEL_NOTICE, "failed moving child (%d) into cgroup %s: %s", pid, cgroup->path, strerror(errno));
+		}
+	}
+
+	// nothing was spawned into it
+	if(pid <= 0) {
+		rmdir(cgroup->path);
+		free(cgroup->path);
+		cgroup->path = NULL;
+	}
+
+	return;
+}
+
+static uint64_t cronsh_cgroup_value(const char *data, const char *key) {
+	const char *p;
+	size_t len = strlen(key);
+
+	for(p = data; p != NULL; p = strchr(p, '\n')) {
+		if(*p == '\n') {
+			p++;
+		}
+
+		if(strncmp(p, key, len) == 0 && p[len] == ' ') {
+			return strtoull(&p[len + 1], NULL, 10);
+		}
+	}
+
+	return 0;
+}
+
+// Read the counters after the child exited and remove the cgroup
+static void cronsh_cgroup_collect(command_t *command) {
+	cgroup_t *cgroup = command->cgroup;
+	char data[4096], *p, *end;
+	const char *pressure[3] = {"cpu.pressure", "memory.pressure", "io.pressure"};
+	int i;
+
+	if(cgroup == NULL || cgroup->path == NULL) {
+		return;
+	}
+
+	if(cronsh_cgroup_read(cgroup->path, "memory.peak", data, sizeof(data)) > 0) {
+		cgroup->memorypeak = strtoull(data, NULL, 10);
+	}
+
+	if(cronsh_cgroup_read(cgroup->path, "cpu.stat", data, sizeof(data)) > 0) {
+		cgroup->cpuusage = cronsh_cgroup_value(data, "usage_usec");
+		cgroup->cpuuser = cronsh_cgroup_value(data, "user_usec");
+		cgroup->cpusystem = cronsh_cgroup_value(data, "system_usec");
+		cgroup->throttled = cronsh_cgroup_value(data, "nr_throttled");
+		cgroup->throttledtime = cronsh_cgroup_value(data, "throttled_usec");
+	}
+
+	// one line per device: major:minor rbytes=... wbytes=... rios=... wios=... dbytes=... dios=...
+	if(cronsh_cgroup_read(cgroup->path, "io.stat", data, sizeof(data)) > 0) {
+		for(p = data; (p = strchr(p, '=')) != NULL; p = end) {
+			if(p - data < 6) { end = p + 1; }
+			else if(!strncmp(p - 6, "rbytes", 6)) { cgroup->ioread += strtoull(p + 1, &end, 10); }
+			else if(!strncmp(p - 6, "wbytes", 6)) { cgroup->iowrite += strtoull(p + 1, &end, 10); }
+			else if(!strncmp(p - 4, "rios", 4)) { cgroup->ioreads += strtoull(p + 1, &end, 10); }
+			else if(!strncmp(p - 4, "wios", 4)) { cgroup->iowrites += strtoull(p + 1, &end, 10); }
+			else { end = p + 1; }
+		}
+	}
+
+	// some avg10=0.00 avg60=0.00 avg300=0.00 total=1234
+	for(i = 0; i < 3; i++) {
+		if(cronsh_cgroup_read(cgroup->path, pressure[i], data, sizeof(data)) <= 0) {
+			continue;
+		}
+
+		p = strstr(data, "total=");
+		if(p != NULL) {
+			cgroup->pressure[i] = strtoull(p + 6, NULL, 10);
+		}
+	}
+
+	// only possible if no descendant is left behind
+	if(rmdir(cgroup->path) == -1) {
+		cronsh_log(CRONSH_LOGLEVEL_NOTICE, "failed removing cgroup %s: %s", cgroup->path, strerror(errno));
+	}
+
+	return;
+}
+
+// When the next signal is due, 0 = never
+static uint64_t cronsh_command_deadline(command_t *command) {
+	deadline_t *deadline = &command->deadline;
+	uint64_t next = 0, idle;
+
+	if(deadline->start == 0 || deadline->killed != 0) {
+		return 0;
+	}
+
+	if(deadline->kill != 0) {
+		return deadline->kill;
+	}
+
+	if(command->settings.timeout != 0) {
+		next = deadline->start + (uint64_t)command->settings.timeout * 1000000;
+	}
+
+	if(command->settings.idletimeout != 0) {
+		idle = deadline->output + (uint64_t)command->settings.idletimeout * 1000000;
+		if(next == 0 || idle < next) {
+			next = idle;
+		}
+	}
+
+	return next;
+}
+
+// SIGTERM when a timeout expired, SIGKILL if that didn't help
+static void cronsh_command_expire(command_t *command, uint64_t now) {
+	deadline_t *deadline = &command->deadline;
+	pid_t target = CRONSH_OPTION(command->options, KILL_GROUP) ? -command->pid : command->pid;
+	unsigned long killafter = (command->settings.killafter != 0) ? command->settings.killafter : CRONSH_KILL_AFTER;
+
+	if(command->pid <= 0) {
+		return;
+	}
+
+	if(deadline->kill == 0) {
+		if(command->settings.timeout != 0 && now >= deadline->start + (uint64_t)command->settings.timeout * 1000000) {
+			deadline->expired = CRONSH_TIMEOUT_RUNTIME;
+			cronsh_log(CRONSH_LOGLEVEL_NOTICE, "child (%d) is running for more than %lums, terminating", command->pid, command->settings.timeout);
+		}
+		else {
+			deadline->expired = CRONSH_TIMEOUT_IDLE;
+			cronsh_log(CRONSH_LOGLEVEL_NOTICE, "child (%d) had no output for %lums, terminating", command->pid, command->settings.idletimeout);
+		}
+
+		kill(target, SIGTERM);
+
+		deadline->kill = now + (uint64_t)killafter * 1000000;
+	}
+	else {
+		cronsh_log(CRONSH_LOGLEVEL_NOTICE, "child (%d) is still running %lums after SIGTERM, killing", command->pid, killafter);
+
+		kill(target, SIGKILL);
+
+		deadline->killed = 1;
+	}
+
+	return;
+}
+
+// Milliseconds until the command needs attention without an event, -1 = never
+int cronsh_command_timeout(command_t *command) {
+	uint64_t now, next = 0, deadline;
+
+	if(command->profile != NULL) {
+		next = command->profile->next;
+	}
+
+	deadline = cronsh_command_deadline(command);
+	if(deadline != 0 && (next == 0 || deadline < next)) {
+		next = deadline;
+	}
+
+	now = cronsh_now();
+
+	// without a pidfd, only the end of the pipes tells that the command exited, which its descendants might keep open
+	if(command->pidfd == -1 && command->deadline.expired != 0 && command->pid > 0) {
+		deadline = now + (uint64_t)CRONSH_REAP_POLL * 1000000;
+		if(next == 0 || deadline < next) {
+			next = deadline;
+		}
+	}
+
+	if(next == 0) {
+		return -1;
+	}
+
+	if(next <= now) {
+		return 0;
+	}
+
+	return (int)((next - now + 999999) / 1000000);
+}
+
+// Do what's due without an event
+void cronsh_command_tick(command_t *command, event_t *event) {
+	uint64_t now, deadline;
+	siginfo_t info;
+
+	if(command->profile == NULL && command->deadline.start == 0) {
+		return;
+	}
+
+	now = cronsh_now();
+
+	if(command->profile != NULL && command->profile->next != 0 && command->profile->next <= now) {
+		cronsh_profile_sample(command, 0);
+	}
+
+	deadline = cronsh_command_deadline(command);
+	if(deadline != 0 && deadline <= now) {
+		cronsh_command_expire(command, now);
+	}
+
+	// the timeout is kept even if the pipes outlive the command, the zombie is left for cronsh_command_wait
+	if(command->pidfd == -1 && command->deadline.expired != 0 && command->pid > 0) {
+		info.si_pid = 0;
+
+		if(waitid(P_PID, command->pid, &info, WEXITED | WNOHANG | WNOWAIT) == 0 && info.si_pid == command->pid) {
+			cronsh_log(CRONSH_LOGLEVEL_DEBUG, "child (%d) exited", command->pid);
+
+			cronsh_command_exited(command, event);
+		}
+	}
+
+	return;
+}
+
+int cronsh_fd_pipe(int fds[2]) {
+#ifdef __linux__
+	return pipe2(fds, O_CLOEXEC);
+#else
+	if(pipe(fds) != 0) {
+		return -1;
+	}
+
+	fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+	fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+
+	return 0;
+#endif
+}
+
+int cronsh_fd_nonblock(int fd) {
+	int flags;
+
+	if(fd == -1) {
+		return -1;
+	}
+
+	flags = fcntl(fd, F_GETFL);
+	if(flags == -1) {
+		return -1;
+	}
+
+	return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+void cronsh_init(void) {
+	char *env;
+
+	memset(&config, 0, sizeof(config_t));
+	
+	config.pid = getpid();
+
+	// a child that went away must not take us down while we write to it
+	signal(SIGPIPE, SIG_IGN);
+
+
+	/* DEBUG */
+
+	env = getenv("CRONSH_LOGLEVEL");
+	if(env != NULL) {
+		if(!strcmp("debug", env)) {
+			config.loglevel = CRONSH_LOGLEVEL_DEBUG;
+		}
+		else if(!strcmp("notice", env)) {
+			config.loglevel = CRONSH_LOGLEVEL_NOTICE;
+		}
+		else if(!strcmp("critical", env)) {
+			config.loglevel = CRONSH_LOGLEVEL_CRITICAL;
+		}
+		else {
+			config.loglevel = CRONSH_LOGLEVEL_DEFAULT;
+		}
+	}
+	else {
+		config.loglevel = CRONSH_LOGLEVEL_DEFAULT;
+	}
+
+	env = getenv("CRONSH_LOG");
+	if(env != NULL) {
+		config.log = strdup(env);
+		config.logfp = fopen(config.log, "a");
+	}
+
+	cronsh_log(CRONSH_LOGLEVEL_DEBUG, "init start");
+
+
+	/* SHELL */
+
+	env = getenv("CRONSH_SHELL");
+	if(env != NULL) {
+		config.shell = strdup(env);
+	}
+	else {
+		config.shell = CRONSH_SHELL_DEFAULT;
+	}
+
+	cronsh_log(CRONSH_LOGLEVEL_DEBUG, "SHELL: %s", config.shell);
+
+
+	/* FILE */
+
+	env = getenv("CRONSH_FILE");
+	if(env != NULL) {
+		config.file = strdup(env);
+		cronsh_log(CRONSH_LOGLEVEL_DEBUG, "FILE: %s", config.file);
+	}
+
+	env = getenv("CRONSH_FILE_MAXSIZE");
+	if(env != NULL) {
+		config.filemaxsize = cronsh_parse_size(env);
+		cronsh_log(CRONSH_LOGLEVEL_DEBUG, "FILE_MAXSIZE: %lu", (unsigned long)config.filemaxsize);
+	}
+
+	env = getenv("CRONSH_FILE_SYNC");
+	if(env != NULL) {
+		config.filesync = strtoul(env, NULL, 10);
+		cronsh_log(CRONSH_LOGLEVEL_DEBUG, "FILE_SYNC: %u", config.filesync);
+	}
+
+
+	/* PIPE */
+
+	env = getenv("CRONSH_PIPE");
+	if(env != NULL) {
+		config.pipe = strdup(env);
+		cronsh_log(CRONSH_LOGLEVEL_DEBUG, "PIPE: %s", config.pipe);
+	}
+	
+	
+	/* OPTIONS */
+	
+	env = getenv("CRONSH_OPTIONS");
+	if(env != NULL) {
+		config.options = cronsh_options(CRONSH_OPTION_NONE, &config.settings, env);
+	}
+	else {
+		config.options = CRONSH_OPTION_NONE;
+	}
+	
+	cronsh_log(CRONSH_LOGLEVEL_DEBUG, "OPTIONS: %d", config.options);
+
+
+	/* SPOOL */
+
+	env = getenv("CRONSH_SPOOL");
+	if(env != NULL) {
+		config.spool = strdup(env);
+		cronsh_log(CRONSH_LOGLEVEL_DEBUG, "SPOOL: %s", config.spool);
+	}
+
+
+	/* CGROUP */
+
+	env = getenv("CRONSH_CGROUP");
+	if(env != NULL) {
+		config.cgroup = strdup(env);
+		cronsh_log(CRONSH_LOGLEVEL_DEBUG, "CGROUP: %s", config.cgroup);
+	}
+
+
+	/* METRICS */
+
+	env = getenv("CRONSH_METRICS");
+	if(env != NULL) {
+		config.metrics = strdup(env);
+		cronsh_log(CRONSH_LOGLEVEL_DEBUG, "METRICS: %s", config.metrics);
+	}
+
+
+	/* HISTORY */
+
+	env = getenv("CRONSH_HISTORY");
+	if(env != NULL) {
+		config.history = strdup(env);
+		cronsh_log(CRONSH_LOGLEVEL_DEBUG, "HISTORY: %s", config.history);
+	}
+
+
+	/* LOCKDIR */
+
+	env = getenv("CRONSH_LOCKDIR");
+	if(env != NULL) {
+		config.lockdir = strdup(env);
+		cronsh_log(CRONSH_LOGLEVEL_DEBUG, "LOCKDIR: %s", config.lockdir);
+	}
+
+
+	/* MAXJOBS */
+
+	env = getenv("CRONSH_MAXJOBS");
+	if(env != NULL) {
+		config.maxjobs = strtol(env, NULL, 10);
+
+		if(config.maxjobs > 0 && config.lockdir == NULL) {
+			cronsh_log(CRONSH_LOGLEVEL_NOTICE, "CRONSH_MAXJOBS needs CRONSH_LOCKDIR, the jobs aren't limited");
+			config.maxjobs = 0;
+		}
+
+		cronsh_log(CRONSH_LOGLEVEL_DEBUG, "MAXJOBS: %ld", config.maxjobs);
+	}
+
+
+	/* DAEMON */
+
+	env = getenv("CRONSH_DAEMON");
+	if(env != NULL) {
+		config.daemon = strdup(env);
+		cronsh_log(CRONSH_LOGLEVEL_DEBUG, "DAEMON: %s", config.daemon);
+	}
+
+
+	/* CONCURRENCY */
+
+	env = getenv("CRONSH_CONCURRENCY");
+	if(env != NULL) {
+		config.concurrency = strtol(env, NULL, 10);
+	}
+	else {
+		config.concurrency = sysconf(_SC_NPROCESSORS_ONLN);
+	}
+
+	if(config.concurrency < 1) {
+		config.concurrency = 1;
+	}
+
+	cronsh_log(CRONSH_LOGLEVEL_DEBUG, "CONCURRENCY: %ld", config.concurrency);
+
+
+	/* BUFFER */
+
+	env = getenv("CRONSH_BUFFER_HINT");
+	if(env != NULL) {
+		config.bufferhint = cronsh_parse_size(env);
+		cronsh_log(CRONSH_LOGLEVEL_DEBUG, "BUFFER_HINT: %lu", (unsigned long)config.bufferhint);
+	}
+
+	env = getenv("CRONSH_BUFFER_MAXGROWTH");
+	if(env != NULL && cronsh_parse_size(env) != 0) {
+		bufferSetMaxGrowth(cronsh_parse_size(env));
+		cronsh_log(CRONSH_LOGLEVEL_DEBUG, "BUFFER_MAXGROWTH: %s", env);
+	}
+
+
+	/* HOSTNAME */
+
+	env = getenv("CRONSH_HOSTNAME");
+	if(env != NULL) {
+		strncpy(config.thishostname, env, sizeof(config.thishostname));
+	}
+	else if(gethostname(config.thishostname, sizeof(config.thishostname)) != 0) {
+		strncpy(config.thishostname, "unknown", sizeof(config.thishostname));
+	}
+
+	config.thishostname[sizeof(config.thishostname) - 1] = '\0';
+
+	cronsh_log(CRONSH_LOGLEVEL_DEBUG, "HOSTNAME: %s", config.thishostname);
+	
+
+	/* USER */
+	
+	env = getenv("USER");
+	if(env != NULL) {
+		strncpy(config.thisuser, env, sizeof(config.thisuser));
+	}
+	else {
+		env = getenv("LOGNAME");
+		if(env != NULL) {
+			strncpy(config.thisuser, env, sizeof(config.thisuser));
+		}
+		else {
+			strncpy(config.thisuser, "unknown", sizeof(config.thisuser));
+		}
+	}
+
+	config.thisuser[sizeof(config.thisuser) - 1] = '\0';
+	
+	cronsh_log(CRONSH_LOGLEVEL_DEBUG, "USER: %s", config.thisuser);
+
+
+	cronsh_log(CRONSH_LOGLEVEL_DEBUG, "init done");
+
+	return;
+}
+
+command_t *cronsh_command_init(const char *rawcommand, buffer_t *stdinbuffer) {
+	if(rawcommand == NULL) {
+		cronsh_log(CRONSH_LOGLEVEL_CRITICAL, "No command given.");
+
+		return NULL;
+	}
+	
+	command_t *command = (command_t *)calloc(1, sizeof(command_t));
+	if(command == NULL) {
+		cronsh_log(CRONSH_LOGLEVEL_CRITICAL, "Not enough memory for command structure!");
+
+		return NULL;
+	}
+	
+	command->ppid = config.pid;
+	command->settings = config.settings;
+
+	command->stdinfd = -1;
+	command->stdoutfd = -1;
+	command->stderrfd = -1;
+	command->pidfd = -1;
+
+	// the buffers are set up later, but the command can be freed before
+	command->stdoutbuffer.fd = -1;
+	command->stderrbuffer.fd = -1;
+
+	/*
+		behavior
+
+		look for '#' and split the command there.
+		if '#' is escaped with '\', don't split there.
+		unescape escaped '#'.
+
+		-> command, hash-options
+
+		strip trailing spaces from the command.
+		execute command with /bin/sh -c 'command'.
+		parse hash-options.
+	*/
+
+	int len = strlen(rawcommand);
+
+	char *tcommand = (char *)calloc(len + 1, sizeof(char));
+	if(tcommand == NULL) {
+		cronsh_log(CRONSH_LOGLEVEL_CRITICAL, "Not enough memory for temporary command string!");
+
+		return NULL;
+	}
+
+	char *hashoptions = NULL;
+
+	int i = 0, j = 0;
+	for(i = 0; i < len; i++) {
+		if(rawcommand[i] == '\\' && rawcommand[i + 1] == '#') {
+			i++;
+
+			tcommand[j++] = '#';
+
+			continue;
+		}
+		else if(rawcommand[i] == '#') {
+			if(hashoptions == NULL) {
+				hashoptions = &tcommand[j];
+			}
+		}
+
+		tcommand[j++] = rawcommand[i];
+	}
+
+	if(hashoptions != NULL) {
+		char *options = NULL;
+
+		if(hashoptions[0] == '#') {
+			char *tag = &hashoptions[1];
+
+			len = strlen(hashoptions);
+			for(i = 0; i < len; i++) {
+				if(isspace(hashoptions[i])) {
+					hashoptions[i] = '\0';
+					options = &hashoptions[i + 1];
+					break;
+				}
+			}
+
+			if(strlen(tag) != 0) {
+				command->tag = strdup(tag);
+			}
+		}
+		else {
+			options = hashoptions;
+		}
+
+		cronsh_log(CRONSH_LOGLEVEL_DEBUG, "options: %s", (options != NULL) ? options : "");
+	
+		// set the individual options
+		command->options = cronsh_options(config.options, &command->settings, options);
+
+		hashoptions[0] = '\0';
+	}
+	else {
+		command->options = config.options;
+	}
+
+	len = strlen(tcommand);
+	for(i = (len - 1); i > 0; i--) {
+		if(!isspace(tcommand[i])) {
+			break;
+		}
+
+		tcommand[i] = '\0';
+	}
+
+	if(CRONSH_OPTION(command->options, DIRECT_EXEC)) {
+		command->argv = cronsh_command_split(tcommand, &command->path);
+		if(command->argv == NULL) {
+			cronsh_log(CRONSH_LOGLEVEL_DEBUG, "command needs the shell");
+		}
+	}
+
+	if(command->argv == NULL) {
+		command->argv = (char **)calloc(4, sizeof(char *));
+		if(command->argv == NULL || (command->argv[0] = strdup(config.shell)) == NULL || (command->argv[1] = strdup("-c")) == NULL || (command->argv[2] = strdup(tcommand)) == NULL) {
+			cronsh_log(CRONSH_LOGLEVEL_CRITICAL, "Not enough memory for command arguments!");
+
+			free(tcommand);
+			cronsh_command_free(command);
+
+			return NULL;
+		}
+	}
+
+	free(tcommand);
+
+	for(i = 0; command->argv[i] != NULL; i++) {
+		cronsh_log(CRONSH_LOGLEVEL_DEBUG, "argv[%d]: %s", i, command->argv[i]);
+	}
+
+	command->stdinbuffer = stdinbuffer;
+
+	// streamed output is forwarded and dropped chunk by chunk
+	if(CRONSH_OPTION(command->options, STREAM)) {
+		command->options &= ~CRONSH_OPTION_CAPTURE_SPOOL;
+		command->settings.capturelimit = 0;
+		command->settings.capturehead = 0;
+		command->settings.capturetail = 0;
+		command->settings.compress = CRONSH_CODEC_NONE;
+	}
+
+	// the spool can't be bounded
+	if(CRONSH_OPTION(command->options, CAPTURE_SPOOL) && command->settings.capturelimit != 0) {
+		cronsh_log(CRONSH_LOGLEVEL_DEBUG, "capture limit is set, not spooling");
+
+		command->options &= ~CRONSH_OPTION_CAPTURE_SPOOL;
+	}
+
+	if(CRONSH_OPTION(command->options, CAPTURE_SPOOL)) {
+		if(bufferInitSpool(&command->stdoutbuffer) != 0 || bufferInitSpool(&command->stderrbuffer) != 0) {
+			cronsh_log(CRONSH_LOGLEVEL_NOTICE, "failed creating spool, capturing to memory (%s)", strerror(errno));
+
+			bufferFree(&command->stdoutbuffer);
+			bufferFree(&command->stderrbuffer);
+
+			command->options &= ~CRONSH_OPTION_CAPTURE_SPOOL;
+		}
+	}
+
+	if(!CRONSH_OPTION(command->options, CAPTURE_SPOOL)) {
+		bufferInit(&command->stdoutbuffer, CRONSH_BUFFER_STEPSIZE);
+		bufferInit(&command->stderrbuffer, CRONSH_BUFFER_STEPSIZE);
+
+		if(command->settings.capturelimit != 0) {
+			bufferSetLimit(&command->stdoutbuffer, command->settings.capturehead, command->settings.capturetail);
+			bufferSetLimit(&command->stderrbuffer, command->settings.capturehead, command->settings.capturetail);
+		}
+
+		if(config.bufferhint != 0) {
+			bufferReserve(&command->stdoutbuffer, config.bufferhint);
+			bufferReserve(&command->stderrbuffer, config.bufferhint);
+		}
+
+		// the kept tail of a compressed stream couldn't be decompressed
+		if(command->settings.compress != CRONSH_CODEC_NONE && command->settings.capturelimit != 0) {
+			cronsh_log(CRONSH_LOGLEVEL_DEBUG, "capture limit is set, not compressing");
+		}
+		else if(command->settings.compress != CRONSH_CODEC_NONE) {
+			if(bufferSetCodec(&command->stdoutbuffer, command->settings.compress) != 0 || bufferSetCodec(&command->stderrbuffer, command->settings.compress) != 0) {
+				cronsh_log(CRONSH_LOGLEVEL_NOTICE, "compression with %s is not available, capturing uncompressed", bufferCodecName(command->settings.compress));
+
+				bufferFreeCodec(&command->stdoutbuffer);
+				bufferFreeCodec(&command->stderrbuffer);
+			}
+		}
+	}
+
+	return command;
+}
+
+// Split a command without any shell syntax into its arguments. Returns NULL if the shell is needed.
+static char **cronsh_command_split(const char *string, char **path) {
+	int i, n = 0;
+	size_t len;
+	const char *p;
+	char **argv;
+
+	if(string[strcspn(string, CRONSH_SHELL_SPECIAL)] != '\0') {
+		return NULL;
+	}
+
+	for(p = string; *p != '\0'; ) {
+		while(isspace(*p)) {
+			p++;
+		}
+
+		if(*p == '\0') {
+			break;
+		}
+
+		n++;
+
+		while(*p != '\0' && !isspace(*p)) {
+			p++;
+		}
+	}
+
+	if(n == 0) {
+		return NULL;
+	}
+
+	argv = (char **)calloc(n + 1, sizeof(char *));
+	if(argv == NULL) {
+		return NULL;
+	}
+
+	for(i = 0, p = string; i < n; i++) {
+		while(isspace(*p)) {
+			p++;
+		}
+
+		for(len = 0; p[len] != '\0' && !isspace(p[len]); len++);
+
+		argv[i] = strndup(p, len);
+		if(argv[i] == NULL) {
+			break;
+		}
+
+		p += len;
+	}
+
+	// variable assignments and builtins are left to the shell
+	if(i != n || strchr(argv[0], '=') != NULL || (*path = cronsh_command_which(argv[0])) == NULL) {
+		for(i = 0; argv[i] != NULL; i++) {
+			free(argv[i]);
+		}
+
+		free(argv);
+
+		return NULL;
+	}
+
+	return argv;
+}
+
+// Look up an executable the same way execvp() does
+static char *cronsh_command_which(const char *name) {
+	const char *paths, *end;
+	char *path;
+	size_t len, namelen = strlen(name);
+	struct stat st;
+
+	if(strchr(name, '/') != NULL) {
+		if(stat(name, &st) == 0 && S_ISREG(st.st_mode) && access(name, X_OK) == 0) {
+			return strdup(name);
+		}
+
+		return NULL;
+	}
+
+	paths = getenv("PATH");
+	if(paths == NULL) {
+		paths = "/bin:/usr/bin";
+	}
+
+	for(;;) {
+		end = strchrnul(paths, ':');
+		len = end - paths;
+
+		path = (char *)malloc(len + namelen + 3);
+		if(path == NULL) {
+			return NULL;
+		}
+
+		if(len == 0) {
+			sprintf(path, "./%s", name);
+		}
+		else {
+			sprintf(path, "%.*s/%s", (int)len, paths, name);
+		}
+
+		if(stat(path, &st) == 0 && S_ISREG(st.st_mode) && access(path, X_OK) == 0) {
+			return path;
+		}
+
+		free(path);
+
+		if(*end == '\0') {
+			break;
+		}
+
+		paths = end + 1;
+	}
+
+	return NULL;
+}
+
+void cronsh_command_free(command_t *command) {
+	int i;
+
+	if(command == NULL) {
+		return;
+	}
+	
+	bufferFree(&command->stdoutbuffer);
+	bufferFree(&command->stderrbuffer);
+
+	if(command->stream != NULL) {
+		cronsh_stream_close(command);
+		free(command->stream);
+	}
+
+	if(command->timeline != NULL) {
+		free(command->timeline->entries);
+		free(command->timeline);
+	}
+
+	if(command->history != NULL) {
+		free(command->history);
+	}
+
+	if(command->overlap != NULL) {
+		cronsh_overlap_unlock(command);
+		free(command->overlap);
+	}
+
+	if(command->admission != NULL) {
+		cronsh_admission_release(command->admission);
+		free(command->admission);
+	}
+
+	if(command->cgroup != NULL) {
+		free(command->cgroup->path);
+		free(command->cgroup->self);
+		free(command->cgroup);
+	}
+
+	if(command->profile != NULL) {
+		free(command->profile->procs);
+		free(command->profile->pids);
+		free(command->profile->samples);
+		free(command->profile);
+	}
+
+	if(command->argv != NULL) {
+		for(i = 0; command->argv[i] != NULL; i++) {
+			free(command->argv[i]);
+		}
+
+		free(command->argv);
+	}
+
+	if(command->path != NULL) {
+		free(command->path);
+	}
+
+	free(command);
+	
+	return;
+}
+
+static int cronsh_options_value(settings_t *settings, const char *key, const char *value, int negate) {
+	char *tail;
+
+	if(!strcmp(key, "capture-limit")) {
+		if(negate == 1) {
+			settings->capturelimit = 0;
+			settings->capturehead = 0;
+			settings->capturetail = 0;
+		}
+		else {
+			char head[32];
+			size_t size;
+
+			// either head:tail or the total amount, half of it from the start and half from the end
+			tail = (value != NULL) ? strchr(value, ':') : NULL;
+			if(tail != NULL && (size_t)(tail - value) < sizeof(head)) {
+				snprintf(head, sizeof(head), "%.*s", (int)(tail - value), value);
+
+				// 0 keeps nothing of the start or the end, but one of them has to be kept
+				if((cronsh_parse_size(head) == 0 && strcmp(head, "0") != 0) || (cronsh_parse_size(tail + 1) == 0 && strcmp(tail + 1, "0") != 0) || cronsh_parse_size(head) + cronsh_parse_size(tail + 1) == 0) {
+					cronsh_log(CRONSH_LOGLEVEL_NOTICE, "invalid value for option: %s", key);
+				}
+				else {
+					settings->capturelimit = 1;
+					settings->capturehead = cronsh_parse_size(head);
+					settings->capturetail = cronsh_parse_size(tail + 1);
+				}
+			}
+			else if(tail != NULL || (size = cronsh_parse_size(value)) == 0) {
+				cronsh_log(CRONSH_LOGLEVEL_NOTICE, "invalid value for option: %s", key);
+			}
+			else {
+				settings->capturelimit = 1;
+				settings->capturehead = (size + 1) / 2;
+				settings->capturetail = size / 2;
+			}
+		}
+	}
+	else if(!strcmp(key, "pipe-frame")) {
+		if(negate == 1 || (value != NULL && !strcmp(value, "none"))) {
+			settings->pipeframe = CRONSH_FRAME_NONE;
+		}
+		else if(value != NULL && !strcmp(value, "nul")) {
+			settings->pipeframe = CRONSH_FRAME_NUL;
+		}
+		else if(value != NULL && !strcmp(value, "length")) {
+			settings->pipeframe = CRONSH_FRAME_LENGTH;
+		}
+		else {
+			cronsh_log(CRONSH_LOGLEVEL_NOTICE, "invalid value for option: %s", key);
+		}
+	}
+	else if(!strcmp(key, "compress")) {
+		if(negate == 1 || (value != NULL && !strcmp(value, "none"))) {
+			settings->compress = CRONSH_CODEC_NONE;
+		}
+		else if(value != NULL && !strcmp(value, "gzip")) {
+			settings->compress = CRONSH_CODEC_GZIP;
+		}
+		else if(value != NULL && !strcmp(value, "zstd")) {
+			settings->compress = CRONSH_CODEC_ZSTD;
+		}
+		else if(value != NULL && !strcmp(value, "lz4")) {
+			settings->compress = CRONSH_CODEC_LZ4;
+		}
+		else {
+			cronsh_log(CRONSH_LOGLEVEL_NOTICE, "invalid value for option: %s", key);
+		}
+	}
+	else if(!strcmp(key, "profile-interval")) {
+		if(negate == 1) {
+			settings->profileinterval = 0;
+		}
+		else if(value == NULL || strtoul(value, &tail, 10) < CRONSH_PROFILE_MININTERVAL || *tail != '\0') {
+			cronsh_log(CRONSH_LOGLEVEL_NOTICE, "invalid value for option: %s", key);
+		}
+		else {
+			settings->profileinterval = strtoul(value, NULL, 10);
+		}
+	}
+	else if(!strcmp(key, "slow-factor")) {
+		if(negate == 1) {
+			settings->slowfactor = 0;
+		}
+		else if(value == NULL || strtod(value, &tail) <= 0 || *tail != '\0') {
+			cronsh_log(CRONSH_LOGLEVEL_NOTICE, "invalid value for option: %s", key);
+		}
+		else {
+			settings->slowfactor = strtod(value, NULL);
+		}
+	}
+	else if(!strcmp(key, "timeout") || !strcmp(key, "idle-timeout") || !strcmp(key, "kill-after") || !strcmp(key, "splay")) {
+		unsigned long *duration = !strcmp(key, "timeout") ? &settings->timeout : !strcmp(key, "idle-timeout") ? &settings->idletimeout : !strcmp(key, "kill-after") ? &settings->killafter : &settings->splay;
+
+		if(negate == 1) {
+			*duration = 0;
+		}
+		else if(value == NULL || cronsh_parse_duration(value) == 0) {
+			cronsh_log(CRONSH_LOGLEVEL_NOTICE, "invalid value for option: %s", key);
+		}
+		else {
+			*duration = cronsh_parse_duration(value);
+		}
+	}
+	else if(!strcmp(key, "cpu-quota")) {
+		if(negate == 1 || (value != NULL && !strcmp(value, "max"))) {
+			settings->cpuquota = 0;
+		}
+		else if(value == NULL || strtoul(value, &tail, 10) == 0 || (*tail != '\0' && strcmp(tail, "%") != 0)) {
+			cronsh_log(CRONSH_LOGLEVEL_NOTICE, "invalid value for option: %s", key);
+		}
+		else {
+			settings->cpuquota = strtoul(value, NULL, 10);
+		}
+	}
+	else if(!strcmp(key, "memory-max")) {
+		if(negate == 1 || (value != NULL && !strcmp(value, "max"))) {
+			settings->memorymax = 0;
+		}
+		else if(value == NULL || cronsh_parse_size(value) == 0) {
+			cronsh_log(CRONSH_LOGLEVEL_NOTICE, "invalid value for option: %s", key);
+		}
+		else {
+			settings->memorymax = cronsh_parse_size(value);
+		}
+	}
+	else if(!strcmp(key, "io-max")) {
+		if(negate == 1) {
+			settings->iomax[0] = '\0';
+		}
+		else if(value == NULL || strchr(value, ':') == NULL || strchr(value, ',') == NULL || strlen(value) >= sizeof(settings->iomax)) {
+			cronsh_log(CRONSH_LOGLEVEL_NOTICE, "invalid value for option: %s", key);
+		}
+		else {
+			strcpy(settings->iomax, value);
+		}
+	}
+	else if(!strcmp(key, "overlap")) {
+		if(negate == 1 || (value != NULL && !strcmp(value, "run"))) {
+			settings->overlap = CRONSH_OVERLAP_RUN;
+		}
+		else if(value != NULL && !strcmp(value, "skip")) {
+			settings->overlap = CRONSH_OVERLAP_SKIP;
+		}
+		else if(value != NULL && !strcmp(value, "wait")) {
+			settings->overlap = CRONSH_OVERLAP_WAIT;
+		}
+		else if(value != NULL && !strcmp(value, "kill-previous")) {
+			settings->overlap = CRONSH_OVERLAP_KILL;
+		}
+		else {
+			cronsh_log(CRONSH_LOGLEVEL_NOTICE, "invalid value for option: %s", key);
+		}
+	}
+	else if(!strcmp(key, "overlap-queue")) {
+		if(negate == 1) {
+			settings->overlapqueue = 0;
+		}
+		else if(value == NULL || strtoul(value, &tail, 10) == 0 || strtoul(value, NULL, 10) > CRONSH_OVERLAP_MAXQUEUE || *tail != '\0') {
+			cronsh_log(CRONSH_LOGLEVEL_NOTICE, "invalid value for option: %s", key);
+		}
+		else {
+			settings->overlapqueue = strtoul(value, NULL, 10);
+		}
+	}
+	else if(!strcmp(key, "format")) {
+		if(negate == 1 || (value != NULL && !strcmp(value, "yaml"))) {
+			settings->format = CRONSH_FORMAT_YAML;
+		}
+		else if(value != NULL && !strcmp(value, "cbor")) {
+			settings->format = CRONSH_FORMAT_CBOR;
+		}
+		else if(value != NULL && !strcmp(value, "msgpack")) {
+			settings->format = CRONSH_FORMAT_MSGPACK;
+		}
+		else if(value != NULL && !strcmp(value, "ndjson")) {
+			settings->format = CRONSH_FORMAT_NDJSON;
+		}
+		else {
+			cronsh_log(CRONSH_LOGLEVEL_NOTICE, "invalid value for option: %s", key);
+		}
+	}
+	else {
+		return 0;
+	}
+
+	return 1;
+}
+
+unsigned int cronsh_options(unsigned int inoptions, settings_t *settings, const char *options) {
+	int negate, exclusive;
+	unsigned int outoptions = inoptions, toption;
+	char *ref, *string, *token, *value;
+
+	if(options == NULL) {
+		return outoptions;
+	}
+	
+	ref = string = strdup(options);
+	if(ref == NULL) {
+		return outoptions;
+	}
+	
+	/*
+		silent, !silent
+		// default cron behaviour. silent if no stdout and stderr
+		crondefault, !crondefault
+		// what to capture
+		capture-stdout, !capture-stdout
+		capture-stderr, !capture-stderr
+		capture-all, !capture-all
+		capture-spool, !capture-spool
+		capture-timeline, !capture-timeline
+		profile, !profile
+		cgroup, !cgroup
+		kill-group, !kill-group
+		// where to send to
+		sendto-stdout, !sendto-stdout
+		sendto-file, !sendto-file
+		sendto-pipe, !sendto-pipe
+		sendto-all, !sendto-all
+		sendto-fallback, !sendto-fallback
+		spool, !spool
+		stream, !stream
+		// when to send
+		sendif-status, !sendif-status
+		sendif-status-ok, !sendif-status-ok
+		sendif-status-any, !sendif-status-any
+		sendif-signal, !sendif-signal
+		sendif-signal-ok, !sendif-signal-ok
+		sendif-signal-any, !sendif-signal-any
+		sendif-stdout, !sendif-stdout
+		sendif-stdout-none, !sendif-stdout-none
+		sendif-stdout-any, !sendif-stdout-any
+		sendif-stderr, !sendif-stderr
+		sendif-stderr-none, !sendif-stderr-none
+		sendif-stderr-any, !sendif-stderr-any
+		sendif-any, !sendif-any
+		sendif-slow, !sendif-slow
+		sendif-rss-regression, !sendif-rss-regression
+		sendif-overlap, !sendif-overlap
+		// options with a value
+		capture-limit=size[:size], !capture-limit
+		pipe-frame=none|nul|length, !pipe-frame
+		format=yaml|cbor|msgpack|ndjson, !format
+		compress=none|gzip|zstd|lz4, !compress
+		profile-interval=ms, !profile-interval
+		slow-factor=factor, !slow-factor
+		timeout=duration, !timeout
+		idle-timeout=duration, !idle-timeout
+		kill-after=duration, !kill-after
+		cpu-quota=percent, !cpu-quota
+		memory-max=size, !memory-max
+		io-max=major:minor,key=value,..., !io-max
+		overlap=run|skip|wait|kill-previous, !overlap
+		overlap-queue=n, !overlap-queue
+		splay=duration, !splay
+	*/
+
+	while((token = strsep(&string, " ")) != NULL) {
+		negate = 0;
+		exclusive = 0;
+
+		if(token[0] == '!' || token[0] == '*') {
+			if(token[0] == '!') {
+				negate = 1;
+			}
+			else if(token[0] == '*') {
+				exclusive = 1;
+			}
+
+			token = &token[1];
+		}
+
+		if(strlen(token) == 0) {
+			continue;
+		}
+
+		value = strchr(token, '=');
+		if(value != NULL) {
+			*value = '\0';
+			value++;
+		}
+
+		if(cronsh_options_value(settings, token, value, negate) == 1) {
+			continue;
+		}
+		
+		if(!strcmp(token, "silent")) { toption = CRONSH_OPTION_SILENT; }
+		else if(!strcmp(token, "crondefault")) { toption = CRONSH_OPTION_CRONDEFAULT; }
+
+		else if(!strcmp(token, "capture-stdout")) { toption = CRONSH_OPTION_CAPTURE_STDOUT; }
+		else if(!strcmp(token, "capture-stderr")) { toption = CRONSH_OPTION_CAPTURE_STDERR; }
+		else if(!strcmp(token, "capture-all")) { toption = CRONSH_OPTION_CAPTURE_ALL; }
+		else if(!strcmp(token, "capture-spool")) { toption = CRONSH_OPTION_CAPTURE_SPOOL; }
+		else if(!strcmp(token, "capture-timeline")) { toption = CRONSH_OPTION_CAPTURE_TIMELINE; }
+		else if(!strcmp(token, "profile")) { toption = CRONSH_OPTION_PROFILE; }
+		else if(!strcmp(token, "cgroup")) { toption = CRONSH_OPTION_CGROUP; }
+		else if(!strcmp(token, "kill-group")) { toption = CRONSH_OPTION_KILL_GROUP; }
+
+		else if(!strcmp(token, "direct-exec")) { toption = CRONSH_OPTION_DIRECT_EXEC; }
+
+		else if(!strcmp(token, "sendto-stdout")) { toption = CRONSH_OPTION_SENDTO_STDOUT; }
+		else if(!strcmp(token, "sendto-file")) { toption = CRONSH_OPTION_SENDTO_FILE; }
+		else if(!strcmp(token, "sendto-pipe")) { toption = CRONSH_OPTION_SENDTO_PIPE; }
+		else if(!strcmp(token, "sendto-all")) { toption = CRONSH_OPTION_SENDTO_ALL; }
+		else if(!strcmp(token, "sendto-fallback")) { toption = CRONSH_OPTION_SENDTO_FALLBACK; }
+
+		else if(!strcmp(token, "spool")) { toption = CRONSH_OPTION_SPOOL; }
+		else if(!strcmp(token, "stream")) { toption = CRONSH_OPTION_STREAM; }
+
+		else if(!strcmp(token, "sendif-status")) { toption = CRONSH_OPTION_SENDIF_STATUS; }
+		else if(!strcmp(token, "sendif-status-ok")) { toption = CRONSH_OPTION_SENDIF_STATUS_OK; }
+		else if(!strcmp(token, "sendif-status-any")) { toption = CRONSH_OPTION_SENDIF_STATUS_ANY; }
+
+		else if(!strcmp(token, "sendif-signal")) { toption = CRONSH_OPTION_SENDIF_SIGNAL; }
+		else if(!strcmp(token, "sendif-signal-ok")) { toption = CRONSH_OPTION_SENDIF_SIGNAL_OK; }
+		else if(!strcmp(token, "sendif-signal-any")) { toption = CRONSH_OPTION_SENDIF_SIGNAL_ANY; }
+
+		else if(!strcmp(token, "sendif-stdout")) { toption = CRONSH_OPTION_SENDIF_STDOUT; }
+		else if(!strcmp(token, "sendif-stdout-none")) { toption = CRONSH_OPTION_SENDIF_STDOUT_NONE; }
+		else if(!strcmp(token, "sendif-stdout-any")) { toption = CRONSH_OPTION_SENDIF_STDOUT_ANY; }
+
+		else if(!strcmp(token, "sendif-stderr")) { toption = CRONSH_OPTION_SENDIF_STDERR; }
+		else if(!strcmp(token, "sendif-stderr-none")) { toption = CRONSH_OPTION_SENDIF_STDERR_NONE; }
+		else if(!strcmp(token, "sendif-stderr-any")) { toption = CRONSH_OPTION_SENDIF_STDERR_ANY; }
+		
+		else if(!strcmp(token, "sendif-any")) { toption = CRONSH_OPTION_SENDIF_ANY; }
+
+		else if(!strcmp(token, "sendif-slow")) { toption = CRONSH_OPTION_SENDIF_SLOW; }
+		else if(!strcmp(token, "sendif-rss-regression")) { toption = CRONSH_OPTION_SENDIF_RSS_REGRESSION; }
+		else if(!strcmp(token, "sendif-overlap")) { toption = CRONSH_OPTION_SENDIF_OVERLAP; }
+
+		else {
+			toption = CRONSH_OPTION_NONE;
+			cronsh_log(CRONSH_LOGLEVEL_NOTICE, "unknown option: %s", token);
+		}
+		
+		if(negate == 1) {
+			outoptions &= ~toption;
+		}
+		else if(exclusive == 1) {
+			outoptions = toption;
+		}
+		else {
+			outoptions |= toption;
+		}
+	}
+	
+	free(ref);
+
+	return outoptions;
+}
+
+// FNV-1a
+uint64_t cronsh_hash(const char *string) {
+	uint64_t hash = 0xcbf29ce484222325ULL;
+
+	while(*string != '\0') {
+		hash ^= (unsigned char)*string++;
+		hash *= 0x100000001b3ULL;
+	}
+
+	return hash;
+}
+
+// Bytes of e.g. 512, 64K, 16M, or 2G, 0 for anything else
+size_t cronsh_parse_size(const char *value) {
+	char *end;
+	unsigned long long size;
+	unsigned int shift = 0;
+
+	if(value == NULL) {
+		return 0;
+	}
+
+	errno = 0;
+	size = strtoull(value, &end, 10);
+	if(end == value || !isdigit((unsigned char)value[0]) || errno == ERANGE) {
+		cronsh_log(CRONSH_LOGLEVEL_NOTICE, "invalid size: %s", value);
+		return 0;
+	}
+
+	switch(toupper((unsigned char)*end)) {
+		case 'G': shift = 30; end++; break;
+		case 'M': shift = 20; end++; break;
+		case 'K': shift = 10; end++; break;
+		default: break;
+	}
+
+	if(*end != '\0') {
+		cronsh_log(CRONSH_LOGLEVEL_NOTICE, "invalid unit in size: %s", value);
+		return 0;
+	}
+
+	if(size > (SIZE_MAX >> shift)) {
+		cronsh_log(CRONSH_LOGLEVEL_NOTICE, "size is too large: %s", value);
+		return 0;
+	}
+
+	return (size_t)(size << shift);
+}
+
+// Milliseconds of e.g. 500ms, 30s, 5m, or 2h, seconds without a unit
+unsigned long cronsh_parse_duration(const char *value) {
+	char *end;
+	unsigned long duration;
+
+	if(value == NULL) {
+		return 0;
+	}
+
+	duration = strtoul(value, &end, 10);
+	if(end == value) {
+		return 0;
+	}
+
+	if(!strcmp(end, "ms")) { return duration; }
+	else if(!strcmp(end, "") || !strcmp(end, "s")) { return duration * 1000; }
+	else if(!strcmp(end, "m")) { return duration * 60 * 1000; }
+	else if(!strcmp(end, "h")) { return duration * 60 * 60 * 1000; }
+
+	return 0;
+}
+
+void cronsh_log(int loglevel, const char *format, ...) {
+	char message[1024 + 1], *l;
+	va_list ap;
+
+	if(loglevel < config.loglevel) {
+		return;
+	}
+
+	if(config.logfp == NULL) {
+		config.logfp = stderr;
+	}
+	
+	time_t clock = time(NULL);
+	struct tm timeptr;
+	char datetime[32];
+
+	gmtime_r(&clock, &timeptr);
+	strftime(datetime, sizeof(datetime), "%F %T", &timeptr);
+
+	va_start(ap, format);
+	vsnprintf(message, sizeof(message), format, ap);
+	va_end(ap);
+
+	switch(loglevel) {
+		case CRONSH_LOGLEVEL_DEBUG: l = "DEBUG"; break;
+		case CRONSH_LOGLEVEL_NOTICE: l = "NOTICE"; break;
+		case CRONSH_LOGLEVEL_CRITICAL: l = "CRITICAL"; break;
+		default: l = "UNKNOWN"; break;
+	}
+
+	fprintf(config.logfp, "[%s] %s %u: %s\n", datetime, l, config.pid, message);
+	
+	fflush(config.logfp);
+
+	return;
+}
+
+void cronsh_help(void) {
+	fprintf(stderr, "NAME\n");
+	fprintf(stderr, "\tcronsh - a shell for executing cron jobs\n");
+	fprintf(stderr, "\n");
+
+	fprintf(stderr, "SYNOPSIS\n");
+	fprintf(stderr, "\tcronsh -c command -h\n");
+	fprintf(stderr, "\tcronsh -m manifest [-j jobs]\n");
+	fprintf(stderr, "\tcronsh -D\n");
+	fprintf(stderr, "\n");
+
+	fprintf(stderr, "DESCRIPTION\n");
+	fprintf(stderr, "\tcronsh (or cronshell) is a shell for executing cron jobs. It collects stdout, stderr, the return code, and other\n");
+	fprintf(stderr, "\tvalues from the command it runs. At the end of executing the command, all captured data is arranged in a YAML document.\n");
+	fprintf(stderr, "\tThis document will be sent to stdout, written to a file (see CRONSH_FILE), or piped to an other command (see\n");
+	fprintf(stderr, "\tCRONSH_PIPE). Set CRONSH_OPTIONS for specifying the default behaviour.\n");
+	fprintf(stderr, "\n");
+	fprintf(stderr, "\tIn the crontab, point the SHELL environment variable to cronsh. cron will then execute cronsh by calling\n");
+	fprintf(stderr, "\tit with the -c option and the command line as its value. The anatomy of the command line is:\n");
+	fprintf(stderr, "\n");
+	fprintf(stderr, "\t   [executable] [arguments]? #[tag]? [options]?\n");
+	fprintf(stderr, "\n");
+	fprintf(stderr, "\tEverything after (and including) the first # will not be part of the executed command and its arguments. Directly following\n");
+	fprintf(stderr, "\tthe # up to the first blank or the end of the line is considered as a tag for this command. Associating a tag is optional.\n");
+	fprintf(stderr, "\tThe options for the command are inherited from CRONSH_OPTIONS and can be modified by specifying addional options. This is\n");
+	fprintf(stderr, "\toptional.\n");
+	fprintf(stderr, "\n");
+	fprintf(stderr, "\tThe anatomy of the YAML is:\n");
+
+	fprintf(stderr, "\n");
+	fprintf(stderr, "\t---\n");
+	fprintf(stderr, "\thostname: Ingos-MacBook-Air.local                                   - CRONSH_HOSTNAME or gethostname().\n");
+	fprintf(stderr, "\tuser: ioppermann                                                    - USER or LOGNAME.\n");
+	fprintf(stderr, "\trawcommand: /usr/bin/printf 'hello world' #tag sendto-file          - crontab command line.\n");
+	fprintf(stderr, "\tcommand:                                                            - executed command.\n");
+	fprintf(stderr, "\t  - /usr/bin/printf\n");
+	fprintf(stderr, "\t  - hello world\n");
+	fprintf(stderr, "\ttag: tag                                                            - tag as specified in rawcommand.\n");
+	fprintf(stderr, "\tstarttime: 1396712280                                               - UNIX timestamp.\n");
+	fprintf(stderr, "\truntime: 3                                                          - runtime in milliseconds.\n");
+	fprintf(stderr, "\tpid: 4471                                                           - PID of the excuted command.\n");
+	fprintf(stderr, "\tppid: 4470                                                          - PID of cronsh.\n");
+	fprintf(stderr, "\tstatus: 0                                                           - exit status of executed command.\n");
+	fprintf(stderr, "\tsignal: 0                                                           - signal that caused exiting.\n");
+	fprintf(stderr, "\ttimeout:                                                            - with timeout or idle-timeout, the limits in\n");
+	fprintf(stderr, "\t  runtime: 3600000                                                  milliseconds, which one expired (none, runtime,\n");
+	fprintf(stderr, "\t  idle: 0                                                           or idle), and whether SIGKILL was necessary.\n");
+	fprintf(stderr, "\t  expired: runtime\n");
+	fprintf(stderr, "\t  killed: 0\n");
+	fprintf(stderr, "\toverlap:                                                            - with overlap, the policy, whether the lock of\n");
+	fprintf(stderr, "\t  policy: wait                                                      the tag was free (acquired) or the run was\n");
+	fprintf(stderr, "\t  result: waited                                                    skipped, waited, or killed the previous run,\n");
+	fprintf(stderr, "\t  waited: 41200                                                     milliseconds until the command could start,\n");
+	fprintf(stderr, "\t  previous: 0                                                       and the PID of the killed command.\n");
+	fprintf(stderr, "\tadmission:                                                          - with splay or CRONSH_MAXJOBS, milliseconds the\n");
+	fprintf(stderr, "\t  splay: 1733                                                       start was delayed, the slot the command got out\n");
+	fprintf(stderr, "\t  maxjobs: 4                                                        of maxjobs (-1 without), and milliseconds it\n");
+	fprintf(stderr, "\t  slot: 2                                                           waited for it.\n");
+	fprintf(stderr, "\t  waited: 5250\n");
+	fprintf(stderr, "\tcompress:                                                           - with compress, codec and uncompressed sizes.\n");
+	fprintf(stderr, "\t  codec: gzip\n");
+	fprintf(stderr, "\t  stdout: 12\n");
+	fprintf(stderr, "\t  stderr: 0\n");
+	fprintf(stderr, "\tstdout: hello world                                                 - captured stdout.\n");
+	fprintf(stderr, "\tstderr:                                                             - captured stderr.\n");
+	fprintf(stderr, "\tcapture:                                                            - with capture-limit, bytes written and truncated.\n");
+	fprintf(stderr, "\t  stdout:\n");
+	fprintf(stderr, "\t    bytes: 5242880\n");
+	fprintf(stderr, "\t    truncated: 1048576\n");
+	fprintf(stderr, "\tstream:                                                             - with stream, records and bytes forwarded.\n");
+	fprintf(stderr, "\t  records: 12\n");
+	fprintf(stderr, "\t  stdout: 40960\n");
+	fprintf(stderr, "\t  stderr: 0\n");
+	fprintf(stderr, "\ttimeline:                                                           - with capture-timeline, every read in order as\n");
+	fprintf(stderr, "\t  - [1520, 1, 6]                                                    [microseconds since the start, 1 = stdout or\n");
+	fprintf(stderr, "\t  - [250311, 2, 31]                                                 2 = stderr, bytes], the first 16384 reads.\n");
+	fprintf(stderr, "\ttimelinedropped: 0                                                  - with capture-timeline, reads that were not recorded.\n");
+	fprintf(stderr, "\tprofile:                                                            - with profile, samples of the process tree.\n");
+	fprintf(stderr, "\t  interval: 1000                                                    milliseconds between the samples.\n");
+	fprintf(stderr, "\t  cpu:                                                              percent of one CPU, peak of the samples and\n");
+	fprintf(stderr, "\t    peak: 198                                                       average over the runtime.\n");
+	fprintf(stderr, "\t    average: 143\n");
+	fprintf(stderr, "\t  rss:                                                              KB of all processes together.\n");
+	fprintf(stderr, "\t    peak: 524288\n");
+	fprintf(stderr, "\t    average: 312740\n");
+	fprintf(stderr, "\t  io:                                                               bytes read from and written to storage.\n");
+	fprintf(stderr, "\t    read: 4096\n");
+	fprintf(stderr, "\t    write: 20971520\n");
+	fprintf(stderr, "\t  rundelay: 35                                                      milliseconds spent waiting for a CPU.\n");
+	fprintf(stderr, "\t  processes: 3                                                      most processes at once.\n");
+	fprintf(stderr, "\t  samples:                                                          [milliseconds since the start, cpu, rss,\n");
+	fprintf(stderr, "\t    - [1000, 198, 262144, 3]                                        processes].\n");
+	fprintf(stderr, "\tcgroup:                                                             - with cgroup, the accounting of the command's\n");
+	fprintf(stderr, "\t  path: /sys/fs/cgroup/cronsh-4470-0                                cgroup, including all descendants.\n");
+	fprintf(stderr, "\t  memory:                                                           bytes, 0 without the memory controller.\n");
+	fprintf(stderr, "\t    peak: 536870912\n");
+	fprintf(stderr, "\t  cpu:                                                              milliseconds, and how often the command was\n");
+	fprintf(stderr, "\t    usage: 1520                                                     throttled by cpu-quota.\n");
+	fprintf(stderr, "\t    user: 1210\n");
+	fprintf(stderr, "\t    system: 310\n");
+	fprintf(stderr, "\t    throttled: 12\n");
+	fprintf(stderr, "\t    throttledtime: 840\n");
+	fprintf(stderr, "\t  io:                                                               bytes and operations of all devices.\n");
+	fprintf(stderr, "\t    read: 4096\n");
+	fprintf(stderr, "\t    write: 20971520\n");
+	fprintf(stderr, "\t    reads: 1\n");
+	fprintf(stderr, "\t    writes: 160\n");
+	fprintf(stderr, "\t  pressure:                                                         milliseconds some process stalled (PSI).\n");
+	fprintf(stderr, "\t    cpu: 2\n");
+	fprintf(stderr, "\t    memory: 0\n");
+	fprintf(stderr, "\t    io: 15\n");
+	fprintf(stderr, "\thistory:                                                            - with CRONSH_HISTORY, the previous runs of the\n");
+	fprintf(stderr, "\t  runs: 64                                                          tag, the 95th percentile of their runtime (in\n");
+	fprintf(stderr, "\t  runtime: 1210                                                     milliseconds) and maxrss, and whether this run\n");
+	fprintf(stderr, "\t  maxrss: 5124                                                      is above them times slow-factor.\n");
+	fprintf(stderr, "\t  slow: 1\n");
+	fprintf(stderr, "\t  rssregression: 0\n");
+	fprintf(stderr, "\trusage:                                                             - the values of the rusage struct.\n");
+	fprintf(stderr, "\t...\n");
+	fprintf(stderr, "\n");
+
+	fprintf(stderr, "OPTIONS\n");
+	fprintf(stderr, "\t-c command\n");
+	fprintf(stderr, "\t    The command to execute.\n");
+	fprintf(stderr, "\n");
+	fprintf(stderr, "\t-m manifest\n");
+	fprintf(stderr, "\t    Execute every line of this file (or stdin for -) as a command. The commands run in parallel in one cronsh\n");
+	fprintf(stderr, "\t    process and every command gets its own YAML document. Empty lines and lines starting with # are ignored.\n");
+	fprintf(stderr, "\t    A document is delivered by a child process as soon as its command has finished, so a slow pipe doesn't\n");
+	fprintf(stderr, "\t    hold up the other commands. The documents are delivered in the order the commands finished.\n");
+	fprintf(stderr, "\n");
+	fprintf(stderr, "\t-j jobs\n");
+	fprintf(stderr, "\t    Sets the environment variable CRONSH_CONCURRENCY.\n");
+	fprintf(stderr, "\n");
+	fprintf(stderr, "\t-D\n");
+	fprintf(stderr, "\t    Run as a daemon that listens on the socket given in CRONSH_DAEMON and executes the commands that\n");
+	fprintf(stderr, "\t    are handed over by cronsh -c. The daemon stays in the foreground. It doesn't start if another daemon\n");
+	fprintf(stderr, "\t    answers on the socket.\n");
+	fprintf(stderr, "\n");
+	fprintf(stderr, "\t-V verbosity\n");
+	fprintf(stderr, "\t    Sets the environment variable CRONSH_LOGLEVEL.\n");
+	fprintf(stderr, "\n");
+	fprintf(stderr, "\t-s shell\n");
+	fprintf(stderr, "\t    Sets the environment variable CRONSH_SHELL.\n");
+	fprintf(stderr, "\n");
+	fprintf(stderr, "\t-l file\n");
+	fprintf(stderr, "\t    Sets the environment variable CRONSH_LOG.\n");
+	fprintf(stderr, "\n");
+	fprintf(stderr, "\t-p command\n");
+	fprintf(stderr, "\t    Sets the environment variable CRONSH_PIPE.\n");
+	fprintf(stderr, "\n");
+	fprintf(stderr, "\t-o options\n");
+	fprintf(stderr, "\t    Sets the environment variable CRONSH_OPTIONS.\n");
+	fprintf(stderr, "\n");
+	fprintf(stderr, "\t-H hostname\n");
+	fprintf(stderr, "\t    Sets the environment variable CRONSH_HOSTNAME.\n");
+	fprintf(stderr, "\n");
+	fprintf(stderr, "\t-h\n");
+	fprintf(stderr, "\t    Display the help screen.\n");
+	fprintf(stderr, "\n");
+
+	fprintf(stderr, "ENVIRONMENT\n");
+	fprintf(stderr, "\tThese environment variables are recognized by cronsh and can be set in the crontab.\n");
+	fprintf(stderr, "\n");
+	fprintf(stderr, "\tCRONSH_LOGLEVEL\n");
+	fprintf(stderr, "\t    Set the logging verbosity for messages written to CRONSH_LOG. Valid verbosity levels are:\n");
+	fprintf(stderr, "\t         debug     - very verbose logging, includes warn and critical.\n");
+	fprintf(stderr, "\t         notice    - less verbose logging, includes critical.\n");
+	fprintf(stderr, "\t         critical  - only logs events that prevent the proper execution of cronsh.\n");
+	fprintf(stderr, "\n");
+	fprintf(stderr, "\tCRONSH_SHELL\n");
+	fprintf(stderr, "\t    Path to a shell to used for executing the command. The default is " CRONSH_SHELL_DEFAULT "\n");
+	fprintf(stderr, "\n");
+	fprintf(stderr, "\tCRONSH_LOG\n");
+	fprintf(stderr, "\t    Path to the file where to write log messages to.\n");
+	fprintf(stderr, "\n");
+	fprintf(stderr, "\tCRONSH_FILE\n");
+	fprintf(stderr, "\t    Write the YAML document to this file if the option 'sendto-file' is given. strftime() conversions like %%Y%%m%%d\n");
+	fprintf(stderr, "\t    are replaced by the start time of the command. Documents up to %dMB are appended with a single write, bigger\n", CRONSH_FILE_ATOMIC / (1024 * 1024));
+	fprintf(stderr, "\t    ones lock the file (flock) while they are written.\n");
+	fprintf(stderr, "\n");
+	fprintf(stderr, "\tCRONSH_FILE_MAXSIZE\n");
+	fprintf(stderr, "\t    Rotate CRONSH_FILE before it grows beyond this size (e.g. 100M). The last %d files are kept as .1, .2, ...\n", CRONSH_FILE_KEEP);
+	fprintf(stderr, "\n");
+	fprintf(stderr, "\tCRONSH_FILE_SYNC\n");
+	fprintf(stderr, "\t    Call fdatasync() on CRONSH_FILE after this many documents and before cronsh exits. 1 syncs every document.\n");
+	fprintf(stderr, "\n");
+	fprintf(stderr, "\tCRONSH_PIPE\n");
+	fprintf(stderr, "\t    Write the YAML document to STDIN of this command if the option 'sendto-pipe' is given.\n");
+	fprintf(stderr, "\n");
+	fprintf(stderr, "\tCRONSH_SPOOL\n");
+	fprintf(stderr, "\t    Directory for the YAML documents that are delivered to CRONSH_PIPE in the background if the option 'spool'\n");
+	fprintf(stderr, "\t    is given. Every consumer gets a sub directory. A detached flusher sends up to %d documents to one invocation\n", CRONSH_SPOOL_BATCH);
+	fprintf(stderr, "\t    of the consumer. The documents are only removed if the consumer exits with 0, otherwise the flusher\n");
+	fprintf(stderr, "\t    retries with increasing delays. The documents are kept in the spool if it gives up.\n");
+	fprintf(stderr, "\n");
+	fprintf(stderr, "\tCRONSH_OPTIONS\n");
+	fprintf(stderr, "\t    Set the different options to define the default behaviour of cronsh. The order of the\n");
+	fprintf(stderr, "\t    options is crucial. Valid options are:\n");
+	fprintf(stderr, "\t         silent              - nothing will be send neither to cron, file, nor pipe.\n");
+	fprintf(stderr, "\t         crondefault         - mimic the default cron behaviour, i.e. send the YAML to cron only if there's output.\n");
+	fprintf(stderr, "\t         capture-stdout      - capture stdout.\n");
+	fprintf(stderr, "\t         capture-stderr      - capture stderr.\n");
+	fprintf(stderr, "\t         capture-all         - capture stdout and stderr.\n");
+	fprintf(stderr, "\t         capture-spool       - splice the output into a memory file instead of copying it into the heap (Linux).\n");
+	fprintf(stderr, "\t         capture-timeline    - record every read from stdout and stderr, see timeline.\n");
+	fprintf(stderr, "\t         profile             - sample CPU, memory, I/O and run queue delay of the command and all its descendants\n");
+	fprintf(stderr, "\t                               from /proc while it runs (Linux), see profile. Processes that come and go between\n");
+	fprintf(stderr, "\t                               two samples are only in rusage.\n");
+	fprintf(stderr, "\t         kill-group          - run the command in its own process group. The signals of timeout and idle-timeout\n");
+	fprintf(stderr, "\t                               go to the whole group, including descendants that run in the background.\n");
+	fprintf(stderr, "\t         cgroup              - run the command in its own cgroup v2 (see CRONSH_CGROUP) and report its accounting,\n");
+	fprintf(stderr, "\t                               see cgroup. Without a writable cgroup the command runs as usual. The command is\n");
+	fprintf(stderr, "\t                               spawned into the cgroup. Before Linux 5.7 cronsh joins it for the spawn, and if it\n");
+	fprintf(stderr, "\t                               can't leave it again, no further commands are started.\n");
+	fprintf(stderr, "\t         direct-exec         - execute commands without shell syntax directly instead of with CRONSH_SHELL.\n");
+	fprintf(stderr, "\t         sendto-stdout       - send the YAML to stdout.\n");
+	fprintf(stderr, "\t         sendto-file         - send the YAML to a file (see CRONSH_FILE).\n");
+	fprintf(stderr, "\t         sendto-pipe         - send the YAML to the pipe (see CRONSH_PIPE).\n");
+	fprintf(stderr, "\t         sendto-all          - send the YAML to cron, file, and pipe.\n");
+	fprintf(stderr, "\t         sendto-fallback     - try to send the YAML first to pipe, then to file, and then cron if the previous didn't work.\n");
+	fprintf(stderr, "\t         spool               - don't wait for the pipe, put the YAML into CRONSH_SPOOL and let a flusher deliver it.\n");
+	fprintf(stderr, "\t         stream              - send every chunk of stdout and stderr to the file and the pipe as soon as it is read,\n");
+	fprintf(stderr, "\t                               as a record with record: chunk, hostname, tag, pid, stream, time (in ms), offset, and\n");
+	fprintf(stderr, "\t                               data. The pipe is kept running for all records of a command and gets them with\n");
+	fprintf(stderr, "\t                               pipe-frame. At the end the usual document follows, with empty stdout and stderr and\n");
+	fprintf(stderr, "\t                               the number of records and forwarded bytes in stream. Only one chunk is kept in memory.\n");
+	fprintf(stderr, "\t         sendif-status       - send the YAML only if the return status is not 0.\n");
+	fprintf(stderr, "\t         sendif-status-ok    - send the YAML only if the return status is 0.\n");
+	fprintf(stderr, "\t         sendif-status-any   - send the YAML on any return status.\n");
+	fprintf(stderr, "\t         sendif-signal       - send the YAML only if the signal status is not 0.\n");
+	fprintf(stderr, "\t         sendif-signal-ok    - send the YAML only if the signal status is 0.\n");
+	fprintf(stderr, "\t         sendif-signal-any   - send the YAML on any signal status.\n");
+	fprintf(stderr, "\t         sendif-stdout       - send the YAML only if there was output to stdout.\n");
+	fprintf(stderr, "\t         sendif-stdout-none  - send the YAML only if there was no output to stdout.\n");
+	fprintf(stderr, "\t         sendif-stdout-any   - send the YAML on any stdout value.\n");
+	fprintf(stderr, "\t         sendif-stderr       - send the YAML only if there was output to stderr.\n");
+	fprintf(stderr, "\t         sendif-stderr-none  - send the YAML only if there was no output to stderr.\n");
+	fprintf(stderr, "\t         sendif-stderr-any   - send the YAML on any stderr value.\n");
+	fprintf(stderr, "\t         sendif-any          - send the YAML in any case.\n");
+	fprintf(stderr, "\t         sendif-slow         - send the YAML only if the runtime is above the 95th percentile of the previous runs\n");
+	fprintf(stderr, "\t                               of the tag times slow-factor. Needs CRONSH_HISTORY and %d previous runs.\n", CRONSH_HISTORY_MINRUNS);
+	fprintf(stderr, "\t         sendif-rss-regression - send the YAML only if maxrss is above the 95th percentile of the previous runs\n");
+	fprintf(stderr, "\t                               of the tag times slow-factor. Needs CRONSH_HISTORY and %d previous runs.\n", CRONSH_HISTORY_MINRUNS);
+	fprintf(stderr, "\t         sendif-overlap      - send the YAML only if the run was skipped, waited, or killed the previous run of\n");
+	fprintf(stderr, "\t                               the tag because of overlap.\n");
+	fprintf(stderr, "\t         capture-limit=size  - keep only the first and the last half of size bytes (e.g. 4M) of stdout and stderr each.\n");
+	fprintf(stderr, "\t                               Use head:tail (e.g. 1M:3M) to choose how much to keep from the start and from the end.\n");
+	fprintf(stderr, "\t                               Either may be 0, e.g. 0:4M keeps only the last 4M.\n");
+	fprintf(stderr, "\t         pipe-frame=frame    - let the daemon (see CRONSH_DAEMON) keep CRONSH_PIPE running and write all YAML documents to it.\n");
+	fprintf(stderr, "\t                               With nul every document is followed by a \\0, with length every document is preceded by\n");
+	fprintf(stderr, "\t                               its length in bytes and a newline. The consumer is restarted if it exits, or if a worker\n");
+	fprintf(stderr, "\t                               dies in the middle of a document.\n");
+	fprintf(stderr, "\t         format=format       - encode the report as yaml (default), cbor, msgpack, or ndjson. The binary formats carry the same\n");
+	fprintf(stderr, "\t                               fields as the YAML, with stdout and stderr as raw byte strings that are copied unescaped.\n");
+	fprintf(stderr, "\t                               Consecutive reports in a file form a CBOR sequence or a MessagePack stream. Use\n");
+	fprintf(stderr, "\t                               pipe-frame=length with the daemon, as the binary reports may contain \\0.\n");
+	fprintf(stderr, "\t                               ndjson writes every report as a JSON object on a single line, ready to be appended to\n");
+	fprintf(stderr, "\t                               the input file of a log shipper. Bytes in stdout and stderr that aren't valid UTF-8\n");
+	fprintf(stderr, "\t                               become U+FFFD.\n");
+	fprintf(stderr, "\t         compress=codec      - compress stdout and stderr with gzip, zstd, or lz4 while they are captured. YAML and\n");
+	fprintf(stderr, "\t                               JSON carry the compressed streams as base64 (tagged !!binary in YAML), CBOR and\n");
+	fprintf(stderr, "\t                               MessagePack as byte strings. The codec and the original sizes are in compress. A codec\n");
+	fprintf(stderr, "\t                               is only available if cronsh was built with it (see the top of cronsh.c), and nothing\n");
+	fprintf(stderr, "\t                               is compressed together with capture-limit or capture-spool.\n");
+	fprintf(stderr, "\t         profile-interval=ms - take a sample every ms milliseconds with profile. The default is %d, at least %d.\n", CRONSH_PROFILE_INTERVAL, CRONSH_PROFILE_MININTERVAL);
+	fprintf(stderr, "\t         timeout=duration    - send SIGTERM to the command if it runs longer than duration (e.g. 500ms, 30s, 5m, 2h,\n");
+	fprintf(stderr, "\t                               seconds without a unit), and SIGKILL if it still runs after kill-after.\n");
+	fprintf(stderr, "\t         idle-timeout=duration - the same if the command didn't write anything to stdout or stderr for duration.\n");
+	fprintf(stderr, "\t         kill-after=duration - time between SIGTERM and SIGKILL. The default is %ds.\n", CRONSH_KILL_AFTER / 1000);
+	fprintf(stderr, "\t         overlap=policy      - what to do if the previous run of the tag still holds the lock in CRONSH_LOCKDIR:\n");
+	fprintf(stderr, "\t                               run (the default, no lock), skip this run, wait for the previous run, or\n");
+	fprintf(stderr, "\t                               kill-previous (SIGTERM, SIGKILL after kill-after). A skipped run has status -1.\n");
+	fprintf(stderr, "\t                               kill-previous only signals the command of a running cronsh and skips the run if\n");
+	fprintf(stderr, "\t                               the lock is still held %ds after kill-after. Needs a tag. A run doesn't\n", CRONSH_OVERLAP_GRACE / 1000);
+	fprintf(stderr, "\t                               kill a previous run from the same manifest, it's skipped. The other commands of a\n");
+	fprintf(stderr, "\t                               manifest run while one waits.\n");
+	fprintf(stderr, "\t         overlap-queue=n     - with overlap=wait, at most n runs of the tag wait at once, the others are skipped.\n");
+	fprintf(stderr, "\t                               The default is %d, at most %d.\n", CRONSH_OVERLAP_QUEUE, CRONSH_OVERLAP_MAXQUEUE);
+	fprintf(stderr, "\t         splay=duration      - delay the start by up to duration (e.g. 5m). The delay is a hash of the hostname\n");
+	fprintf(stderr, "\t                               and the tag, the same every time on a host but different across hosts and tags.\n");
+	fprintf(stderr, "\t                               It is not applied to the commands of a manifest.\n");
+	fprintf(stderr, "\t         slow-factor=factor  - how far above the 95th percentile sendif-slow and sendif-rss-regression trigger.\n");
+	fprintf(stderr, "\t                               The default is %g.\n", CRONSH_HISTORY_FACTOR);
+	fprintf(stderr, "\t         cpu-quota=percent   - limit the command to this much of one CPU (e.g. 50%% or 200%%) with cpu.max.\n");
+	fprintf(stderr, "\t         memory-max=size     - limit the memory of the command (e.g. 512M) with memory.max.\n");
+	fprintf(stderr, "\t         io-max=limits       - limit the I/O of the command on a device with io.max, e.g. 8:0,rbps=10M,wbps=10M,wiops=100.\n");
+	fprintf(stderr, "\t                               The limits imply cgroup and need CRONSH_CGROUP. They are only enforced if the\n");
+	fprintf(stderr, "\t                               controllers can be enabled for the cgroup, otherwise a notice is logged.\n");
+	fprintf(stderr, "\n");
+	fprintf(stderr, "\tCRONSH_CGROUP\n");
+	fprintf(stderr, "\t    Directory in the cgroup v2 hierarchy where the option 'cgroup' creates a cgroup for every command. The default\n");
+	fprintf(stderr, "\t    is the cgroup of cronsh, which is enough for the accounting. The limits are only applied below CRONSH_CGROUP:\n");
+	fprintf(stderr, "\t    cgroup v2 doesn't let a cgroup that has processes, like the one of cronsh, enable controllers for its\n");
+	fprintf(stderr, "\t    children. The directory must not contain processes itself and have the cpu, memory, and io controllers\n");
+	fprintf(stderr, "\t    available, e.g. a subtree delegated by systemd.\n");
+	fprintf(stderr, "\n");
+	fprintf(stderr, "\tCRONSH_METRICS\n");
+	fprintf(stderr, "\t    Directory of the node_exporter textfile collector. After every run, cronsh updates cronsh_<tag>.prom there with\n");
+	fprintf(stderr, "\t    the number of runs and failures, CPU time, captured bytes, the status, signal, runtime, and maxrss of the last\n");
+	fprintf(stderr, "\t    run, and a histogram of the runtime. Runs skipped by overlap are only counted as skipped. The sendif options\n");
+	fprintf(stderr, "\t    don't apply. The file is replaced atomically, concurrent cronsh processes wait for each other with a lock on\n");
+	fprintf(stderr, "\t    cronsh_<tag>.prom.lock.\n");
+	fprintf(stderr, "\n");
+	fprintf(stderr, "\tCRONSH_HISTORY\n");
+	fprintf(stderr, "\t    Directory for the history of every tag. cronsh_<tag>.hist keeps the start time, runtime, maxrss, CPU time,\n");
+	fprintf(stderr, "\t    status, and signal of the last %d runs in a ring of fixed size. Every run is compared with the previous ones\n", CRONSH_HISTORY_SIZE);
+	fprintf(stderr, "\t    before it is added, see history, sendif-slow, and sendif-rss-regression.\n");
+	fprintf(stderr, "\n");
+	fprintf(stderr, "\tCRONSH_LOCKDIR\n");
+	fprintf(stderr, "\t    Directory for the locks of overlap. cronsh_<tag>.lock is locked with flock while the command runs and holds\n");
+	fprintf(stderr, "\t    the PIDs of cronsh and the command, the runs that wait take one of cronsh_<tag>.lock.<n> first. A lock is\n");
+	fprintf(stderr, "\t    released when cronsh exits, however it ends. The slots of CRONSH_MAXJOBS are cronsh.slot.<n>.\n");
+	fprintf(stderr, "\n");
+	fprintf(stderr, "\tCRONSH_MAXJOBS\n");
+	fprintf(stderr, "\t    Number of commands that run at the same time on the host. A command has to lock one of the slots in\n");
+	fprintf(stderr, "\t    CRONSH_LOCKDIR before it starts and waits until one is free, see admission. Every command of a manifest\n");
+	fprintf(stderr, "\t    takes a slot of its own, the others run while one waits, see CRONSH_CONCURRENCY. The default is no limit.\n");
+	fprintf(stderr, "\n");
+	fprintf(stderr, "\tCRONSH_DAEMON\n");
+	fprintf(stderr, "\t    Path to the socket of a cronsh daemon (see -D). cronsh -c hands the command together with its environment,\n");
+	fprintf(stderr, "\t    working directory, stdout and stderr over to the daemon and exits. If no daemon is listening on the socket,\n");
+	fprintf(stderr, "\t    cronsh executes the command itself. Only commands from the same user are accepted. The daemon rejects the\n");
+	fprintf(stderr, "\t    command if it can't change into the working directory or didn't get stdout and stderr.\n");
+	fprintf(stderr, "\n");
+	fprintf(stderr, "\tCRONSH_CONCURRENCY\n");
+	fprintf(stderr, "\t    Number of commands from a manifest that run at the same time. The default is the number of CPUs.\n");
+	fprintf(stderr, "\n");
+	fprintf(stderr, "\tCRONSH_BUFFER_HINT\n");
+	fprintf(stderr, "\t    Preallocate this many bytes (e.g. 16M) for capturing stdout and stderr each.\n");
+	fprintf(stderr, "\n");
+	fprintf(stderr, "\tCRONSH_BUFFER_MAXGROWTH\n");
+	fprintf(stderr, "\t    Buffers double in size until they grow by this many bytes at once. The default is 64M.\n");
+	fprintf(stderr, "\n");
+	fprintf(stderr, "\tCRONSH_HOSTNAME\n");
+	fprintf(stderr, "\t    Override the hostname as given by gethostname().\n");
+	fprintf(stderr, "\n");
+	fprintf(stderr, "\tUSER / LOGNAME\n");
+	fprintf(stderr, "\t    The user who owns this crontab and this command will be run as. See the man page for crontab.\n");
+	fprintf(stderr, "\n");
+
+	fprintf(stderr, "BUGS\n");
+	fprintf(stderr, "\tNo known bugs (but probably there are some).\n");
+	fprintf(stderr, "\n");
+
+	fprintf(stderr, "AUTHOR\n");
+	fprintf(stderr, "\t(c) 2014+ Ingo Oppermann\n");
+
+	return;
+}
+
+/* sink facility */
+
+int sinkInitFD(sink_t *sink, int fd) {
+	if(sink == NULL) {
+		return 1;
+	}
+
+	memset(sink, 0, sizeof(sink_t));
+
+	sink->type = CRONSH_SINK_FD;
+	sink->fd = fd;
+
+	return 0;
+}
+
+int sinkInitFile(sink_t *sink, FILE *fp) {
+	if(sink == NULL) {
+		return 1;
+	}
+
+	memset(sink, 0, sizeof(sink_t));
+
+	sink->type = CRONSH_SINK_FILE;
+	sink->fd = -1;
+	sink->fp = fp;
+
+	return 0;
+}
+
+int sinkInitCommand(sink_t *sink, command_t *command, event_t *event) {
+	if(sink == NULL) {
+		return 1;
+	}
+
+	memset(sink, 0, sizeof(sink_t));
+
+	sink->type = CRONSH_SINK_COMMAND;
+	sink->fd = -1;
+	sink->command = command;
+	sink->event = event;
+
+	return 0;
+}
+
+// Keep the command going until its stdin is writable again
+static int sinkWaitCommand(sink_t *sink) {
+	int i, n, writable = 0;
+	command_t *command = sink->command;
+	eventitem_t items[CRONSH_EVENT_MAXITEMS];
+
+	if(eventAdd(sink->event, command->stdinfd, CRONSH_EVENT_WRITE, command) != 0) {
+		return 1;
+	}
+
+	while(writable == 0 && command->stdinfd != -1) {
+		n = eventWait(sink->event, items, CRONSH_EVENT_MAXITEMS, -1);
+		if(n == -1) {
+			if(errno == EINTR) {
+				continue;
+			}
+
+			break;
+		}
+
+		for(i = 0; i < n; i++) {
+			if(items[i].fd == command->stdinfd) {
+				writable = 1;
+				continue;
+			}
+
+			cronsh_command_handle(command, sink->event, items[i].fd, items[i].events);
+		}
+	}
+
+	if(command->stdinfd == -1) {
+		errno = EPIPE;
+		return 1;
+	}
+
+	eventDelete(sink->event, command->stdinfd);
+
+	return (writable != 0) ? 0 : 1;
+}
+
+int sinkWritev(sink_t *sink, struct iovec *iov, int iovcnt) {
+	int i;
+	ssize_t bytes;
+
+	if(sink == NULL) {
+		return 1;
+	}
+
+	if(sink->type == CRONSH_SINK_FILE) {
+		for(i = 0; i < iovcnt; i++) {
+			if(fwrite(iov[i].iov_base, 1, iov[i].iov_len, sink->fp) != iov[i].iov_len) {
+				return 1;
+			}
+		}
+
+		return 0;
+	}
+
+	int fd = (sink->type == CRONSH_SINK_COMMAND) ? sink->command->stdinfd : sink->fd;
+
+	while(iovcnt != 0) {
+		if(iov[0].iov_len == 0) {
+			iov++;
+			iovcnt--;
+			continue;
+		}
+
+		if(fd == -1) {
+			errno = EPIPE;
+			return 1;
+		}
+
+		bytes = writev(fd, iov, iovcnt);
+		if(bytes == -1) {
+			if(errno == EINTR) {
+				continue;
+			}
+
+			if((errno == EAGAIN || errno == EWOULDBLOCK) && sink->type == CRONSH_SINK_COMMAND) {
+				if(sinkWaitCommand(sink) != 0) {
+					return 1;
+				}
+
+				fd = sink->command->stdinfd;
+
+				continue;
+			}
+
+			return 1;
+		}
+
+		// skip over what has been written
+		while(bytes > 0) {
+			if((size_t)bytes >= iov[0].iov_len) {
+				bytes -= iov[0].iov_len;
+				iov[0].iov_len = 0;
+				iov++;
+				iovcnt--;
+			}
+			else {
+				iov[0].iov_base = (char *)iov[0].iov_base + bytes;
+				iov[0].iov_len -= bytes;
+				bytes = 0;
+			}
+		}
+	}
+
+	return 0;
+}
+
+int sinkWrite(sink_t *sink, const char *bytes, size_t nbytes) {
+	struct iovec iov;
+
+	iov.iov_base = (void *)bytes;
+	iov.iov_len = nbytes;
+
+	return sinkWritev(sink, &iov, 1);
+}
+
+/* buffer facility */
+
+static size_t bufferMaxGrowth = CRONSH_BUFFER_MAXGROWTH;
+
+void bufferSetMaxGrowth(size_t nbytes) {
+	if(nbytes < CRONSH_BUFFER_STEPSIZE) {
+		nbytes = CRONSH_BUFFER_STEPSIZE;
+	}
+
+	bufferMaxGrowth = nbytes;
+
+	return;
+}
+
+int bufferInit(buffer_t *buffer, size_t nbytes) {
+	if(buffer == NULL) {
+		return 1;
+	}
+
+	buffer->data = NULL;
+	buffer->size = 0;
+	buffer->used = 0;
+	buffer->step = nbytes;
+	buffer->sink = NULL;
+	buffer->fd = -1;
+	buffer->mapped = 0;
+	buffer->limited = 0;
+	buffer->limit = 0;
+	buffer->total = 0;
+	buffer->dropped = 0;
+	buffer->ring = NULL;
+	buffer->ringsize = 0;
+	buffer->ringused = 0;
+	buffer->ringpos = 0;
+	buffer->codec = NULL;
+
+	buffer->data = (char *)calloc(buffer->step + 1, sizeof(char));
+	if(buffer->data == NULL) {
+		return 1;
+	}
+
+	buffer->size = buffer->step;
+
+	return 0;
+}
+
+int bufferInitSink(buffer_t *buffer, size_t nbytes, sink_t *sink) {
+	if(bufferInit(buffer, nbytes) != 0) {
+		return 1;
+	}
+
+	buffer->sink = sink;
+
+	return 0;
+}
+
+// Write the buffered data and the given bytes to the sink in one go
+static int bufferDrain(buffer_t *dst, const char *bytes, size_t nbytes) {
+	int n = 0, rv;
+	struct iovec iov[2];
+
+	if(dst->used != 0) {
+		iov[n].iov_base = dst->data;
+		iov[n].iov_len = dst->used;
+		n++;
+	}
+
+	if(nbytes != 0) {
+		iov[n].iov_base = (void *)bytes;
+		iov[n].iov_len = nbytes;
+		n++;
+	}
+
+	if(n == 0) {
+		return 0;
+	}
+
+	rv = sinkWritev(dst->sink, iov, n);
+
+	dst->used = 0;
+	dst->data[0] = '\0';
+
+	return rv;
+}
+
+int bufferFlush(buffer_t *buffer) {
+	if(buffer == NULL) {
+		return 1;
+	}
+
+	if(buffer->sink == NULL) {
+		return 0;
+	}
+
+	return bufferDrain(buffer, NULL, 0);
+}
+
+int bufferFree(buffer_t *buffer) {
+	if(buffer == NULL) {
+		return 1;
+	}
+
+	if(buffer->data != NULL) {
+		if(buffer->mapped != 0) {
+			munmap(buffer->data, buffer->size + 1);
+		}
+		else {
+			free(buffer->data);
+		}
+
+		buffer->data = NULL;
+		buffer->size = 0;
+		buffer->used = 0;
+	}
+
+	buffer->mapped = 0;
+
+	if(buffer->fd != -1) {
+		close(buffer->fd);
+		buffer->fd = -1;
+	}
+
+	if(buffer->ring != NULL) {
+		free(buffer->ring);
+		buffer->ring = NULL;
+		buffer->ringused = 0;
+		buffer->ringpos = 0;
+	}
+
+	bufferFreeCodec(buffer);
+
+	return 0;
+}
+
+static int bufferUnmap(buffer_t *buffer) {
+	if(buffer->mapped == 0 || buffer->fd == -1) {
+		return 0;
+	}
+
+	munmap(buffer->data, buffer->size + 1);
+	buffer->data = NULL;
+	buffer->size = 0;
+	buffer->mapped = 0;
+
+	// drop the terminating byte again
+	if(ftruncate(buffer->fd, buffer->used) != 0 || lseek(buffer->fd, buffer->used, SEEK_SET) == -1) {
+		return 1;
+	}
+
+	return 0;
+}
+
+int bufferReset(buffer_t *buffer) {
+	if(buffer == NULL) {
+		return 1;
+	}
+
+	if(buffer->fd != -1) {
+		int mapped = buffer->mapped;
+
+		bufferUnmap(buffer);
+
+		if(ftruncate(buffer->fd, 0) != 0 || lseek(buffer->fd, 0, SEEK_SET) != 0) {
+			return 1;
+		}
+
+		buffer->used = 0;
+
+		if(mapped != 0) {
+			return bufferMap(buffer);
+		}
+
+		return 0;
+	}
+
+	buffer->used = 0;
+	buffer->total = 0;
+	buffer->dropped = 0;
+	buffer->ringused = 0;
+	buffer->ringpos = 0;
+
+	if(buffer->data != NULL) {
+		buffer->data[0] = '\0';
+	}
+
+	return 0;
+}
+
+static int bufferWriteSpool(buffer_t *dst, const char *bytes, size_t nbytes) {
+	ssize_t n;
+
+	// appending invalidates the mapping
+	if(bufferUnmap(dst) != 0) {
+		return 1;
+	}
+
+	while(nbytes != 0) {
+		n = write(dst->fd, bytes, nbytes);
+		if(n == -1) {
+			if(errno == EINTR) {
+				continue;
+			}
+
+			return 1;
+		}
+
+		bytes += n;
+		nbytes -= n;
+		dst->used += n;
+	}
+
+	return 0;
+}
+
+static int bufferAppendRing(buffer_t *dst, const char *bytes, size_t nbytes) {
+	size_t n;
+
+	dst->total += nbytes;
+
+	if(dst->ringsize == 0) {
+		dst->dropped += nbytes;
+		return 0;
+	}
+
+	if(dst->ring == NULL) {
+		dst->ring = (char *)malloc(dst->ringsize);
+		if(dst->ring == NULL) {
+			dst->dropped += nbytes;
+			return 1;
+		}
+	}
+
+	// only the last ringsize bytes will survive anyways
+	if(nbytes > dst->ringsize) {
+		dst->dropped += nbytes - dst->ringsize;
+		bytes += nbytes - dst->ringsize;
+		nbytes = dst->ringsize;
+	}
+
+	if(dst->ringused + nbytes > dst->ringsize) {
+		dst->dropped += dst->ringused + nbytes - dst->ringsize;
+	}
+
+	while(nbytes != 0) {
+		n = dst->ringsize - dst->ringpos;
+		if(n > nbytes) {
+			n = nbytes;
+		}
+
+		memcpy(&dst->ring[dst->ringpos], bytes, n);
+
+		bytes += n;
+		nbytes -= n;
+
+		dst->ringpos = (dst->ringpos + n) % dst->ringsize;
+		dst->ringused = (dst->ringused + n > dst->ringsize) ? dst->ringsize : dst->ringused + n;
+	}
+
+	return 0;
+}
+
+static int bufferResize(buffer_t *dst, size_t size) {
+	char *data;
+
+#ifdef __linux__
+	// large buffers live in their own mapping and can be moved around by the kernel without copying
+	if(dst->mapped != 0) {
+		data = (char *)mremap(dst->data, dst->size + 1, size + 1, MREMAP_MAYMOVE);
+		if(data == MAP_FAILED) {
+			return 1;
+		}
+
+		dst->data = data;
+		dst->size = size;
+
+		return 0;
+	}
+
+	if(size >= CRONSH_BUFFER_MAPSIZE) {
+		data = (char *)mmap(NULL, size + 1, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if(data == MAP_FAILED) {
+			return 1;
+		}
+
+		if(dst->data != NULL) {
+			memcpy(data, dst->data, dst->used + 1);
+			free(dst->data);
+		}
+
+		dst->data = data;
+		dst->size = size;
+		dst->mapped = 1;
+
+		return 0;
+	}
+#endif
+
+	data = (char *)realloc(dst->data, size + 1);
+	if(data == NULL) {
+		return 1;
+	}
+
+	dst->data = data;
+	dst->size = size;
+
+	return 0;
+}
+
+int bufferReserve(buffer_t *dst, size_t nbytes) {
+	size_t size, growth;
+
+	if(dst == NULL) {
+		return 1;
+	}
+
+	if(dst->fd != -1) {
+		return 0;
+	}
+
+	// Check if we have to increase the buffer size
+	if((dst->used + nbytes) <= dst->size && dst->data != NULL) {
+		return 0;
+	}
+
+	// Double the size, but don't grow by more than the limit at once
+	growth = (dst->size > dst->step) ? dst->size : dst->step;
+	if(growth > bufferMaxGrowth) {
+		growth = bufferMaxGrowth;
+	}
+
+	size = dst->size + growth;
+
+	// Round up to the next step bound if that's not enough
+	if(size < (dst->used + nbytes)) {
+		size = ((dst->used + nbytes) / dst->step + 1) * dst->step;
+	}
+
+	return bufferResize(dst, size);
+}
+
+ssize_t bufferRead(buffer_t *dst, int fd, size_t nbytes) {
+	int pending = 0;
+	ssize_t bytes;
+
+	if(dst == NULL) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if(dst->fd != -1) {
+		return bufferSplice(dst, fd, 16 * nbytes);
+	}
+
+	if(dst->codec != NULL) {
+		char data[64 * 1024];
+
+		bytes = read(fd, data, sizeof(data));
+		if(bytes > 0 && bufferCompress(dst, data, bytes) != 0) {
+			errno = ENOMEM;
+			return -1;
+		}
+
+		return bytes;
+	}
+
+	// once the start is complete, everything goes through the ring
+	if(dst->limited != 0 && dst->used >= dst->limit) {
+		char data[64 * 1024];
+
+		bytes = read(fd, data, sizeof(data));
+		if(bytes > 0) {
+			bufferAppendRing(dst, data, bytes);
+		}
+
+		return bytes;
+	}
+
+	// make room for everything that is already waiting
+	if(ioctl(fd, FIONREAD, &pending) == 0 && (size_t)pending > nbytes) {
+		nbytes = pending;
+	}
+
+	if(bufferReserve(dst, nbytes) != 0) {
+		errno = ENOMEM;
+		return -1;
+	}
+
+	nbytes = dst->size - dst->used;
+	if(dst->limited != 0 && (dst->used + nbytes) > dst->limit) {
+		nbytes = dst->limit - dst->used;
+	}
+
+	bytes = read(fd, &dst->data[dst->used], nbytes);
+	if(bytes > 0) {
+		dst->used += bytes;
+		dst->total += bytes;
+		dst->data[dst->used] = '\0';
+	}
+
+	return bytes;
+}
+
+int bufferAppendBytes(buffer_t *dst, const char *bytes, size_t nbytes) {
+
+	if(dst == NULL) {
+		return 1;
+	}
+
+	if(bytes == NULL) {
+		return 0;
+	}
+
+	if(nbytes == 0) {
+		return 0;
+	}
+
+	if(dst->fd != -1) {
+		dst->total += nbytes;
+
+		return bufferWriteSpool(dst, bytes, nbytes);
+	}
+
+	// a buffer in front of a sink never grows
+	if(dst->sink != NULL && (dst->used + nbytes) > dst->size) {
+		if(nbytes >= dst->size) {
+			return bufferDrain(dst, bytes, nbytes);
+		}
+
+		if(bufferDrain(dst, NULL, 0) != 0) {
+			return 1;
+		}
+	}
+
+	if(dst->limited != 0 && (dst->used + nbytes) > dst->limit) {
+		size_t head = dst->limit - dst->used;
+
+		if(bufferAppendRing(dst, &bytes[head], nbytes - head) != 0) {
+			return 1;
+		}
+
+		nbytes = head;
+		if(nbytes == 0) {
+			return 0;
+		}
+	}
+
+	dst->total += nbytes;
+
+	if(bufferReserve(dst, nbytes) != 0) {
+		return 1;
+	}
+
+	// Copy the stuff into the buffer
+	memcpy(&dst->data[dst->used], bytes, nbytes);
+
+	dst->used += nbytes;
+
+	dst->data[dst->used] = '\0';
+
+	return 0;
+}
+
+static int bufferCodecRun(buffer_t *dst, const char *bytes, size_t nbytes, int finish) {
+	codec_t *codec = dst->codec;
+
+	switch(codec->type) {
+#ifdef CRONSH_WITH_ZLIB
+		case CRONSH_CODEC_GZIP: {
+			int rv;
+			char *out;
+			z_stream *z = (z_stream *)codec->stream;
+
+			if(z == NULL) {
+				z = (z_stream *)calloc(1, sizeof(z_stream));
+				if(z == NULL) {
+					return 1;
+				}
+
+				// 16 + window bits for a gzip header. The fastest level keeps up with the command's output.
+				if(deflateInit2(z, Z_BEST_SPEED, Z_DEFLATED, 16 + 15, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+					free(z);
+					return 1;
+				}
+
+				codec->stream = z;
+			}
+
+			z->next_in = (Bytef *)bytes;
+			z->avail_in = nbytes;
+
+			do {
+				out = bufferSpace(dst, CRONSH_CODEC_CHUNK);
+				if(out == NULL) {
+					return 1;
+				}
+
+				z->next_out = (Bytef *)out;
+				z->avail_out = CRONSH_CODEC_CHUNK;
+
+				rv = deflate(z, (finish != 0) ? Z_FINISH : Z_NO_FLUSH);
+				if(rv == Z_STREAM_ERROR) {
+					return 1;
+				}
+
+				bufferAdvance(dst, CRONSH_CODEC_CHUNK - z->avail_out);
+			} while(z->avail_out == 0 || (finish != 0 && rv != Z_STREAM_END));
+
+			if(finish != 0) {
+				deflateEnd(z);
+				free(z);
+				codec->stream = NULL;
+			}
+
+			return 0;
+		}
+#endif
+#ifdef CRONSH_WITH_ZSTD
+		case CRONSH_CODEC_ZSTD: {
+			size_t rv;
+			char *out;
+			ZSTD_CCtx *cctx = (ZSTD_CCtx *)codec->stream;
+			ZSTD_inBuffer in = {bytes, nbytes, 0};
+			ZSTD_outBuffer o;
+
+			if(cctx == NULL) {
+				cctx = ZSTD_createCCtx();
+				if(cctx == NULL) {
+					return 1;
+				}
+
+				codec->stream = cctx;
+			}
+
+			do {
+				out = bufferSpace(dst, CRONSH_CODEC_CHUNK);
+				if(out == NULL) {
+					return 1;
+				}
+
+				o.dst = out;
+				o.size = CRONSH_CODEC_CHUNK;
+				o.pos = 0;
+
+				rv = ZSTD_compressStream2(cctx, &o, &in, (finish != 0) ? ZSTD_e_end : ZSTD_e_continue);
+				if(ZSTD_isError(rv)) {
+					return 1;
+				}
+
+				bufferAdvance(dst, o.pos);
+			} while((finish != 0) ? (rv != 0) : (in.pos < in.size));
+
+			if(finish != 0) {
+				ZSTD_freeCCtx(cctx);
+				codec->stream = NULL;
+			}
+
+			return 0;
+		}
+#endif
+#ifdef CRONSH_WITH_LZ4
+		case CRONSH_CODEC_LZ4: {
+			size_t rv, n, bound;
+			char *out;
+			LZ4F_cctx *cctx = (LZ4F_cctx *)codec->stream;
+
+			if(cctx == NULL) {
+				if(LZ4F_isError(LZ4F_createCompressionContext(&cctx, LZ4F_VERSION))) {
+					return 1;
+				}
+
+				codec->stream = cctx;
+
+				out = bufferSpace(dst, LZ4F_HEADER_SIZE_MAX);
+				if(out == NULL) {
+					return 1;
+				}
+
+				rv = LZ4F_compressBegin(cctx, out, LZ4F_HEADER_SIZE_MAX, NULL);
+				if(LZ4F_isError(rv)) {
+					return 1;
+				}
+
+				bufferAdvance(dst, rv);
+			}
+
+			while(nbytes != 0) {
+				n = (nbytes > CRONSH_CODEC_CHUNK) ? CRONSH_CODEC_CHUNK : nbytes;
+				bound = LZ4F_compressBound(n, NULL);
+
+				out = bufferSpace(dst, bound);
+				if(out == NULL) {
+					return 1;
+				}
+
+				rv = LZ4F_compressUpdate(cctx, out, bound, bytes, n, NULL);
+				if(LZ4F_isError(rv)) {
+					return 1;
+				}
+
+				bufferAdvance(dst, rv);
+
+				bytes += n;
+				nbytes -= n;
+			}
+
+			if(finish != 0) {
+				bound = LZ4F_compressBound(0, NULL);
+
+				out = bufferSpace(dst, bound);
+				if(out == NULL) {
+					return 1;
+				}
+
+				rv = LZ4F_compressEnd(cctx, out, bound, NULL);
+				if(LZ4F_isError(rv)) {
+					return 1;
+				}
+
+				bufferAdvance(dst, rv);
+
+				LZ4F_freeCompressionContext(cctx);
+				codec->stream = NULL;
+			}
+
+			return 0;
+		}
+#endif
+		default:
+			// no codec built in
+			(void)bytes;
+			(void)nbytes;
+			(void)finish;
+			break;
+	}
+
+	return 1;
+}
+
+// Compress everything that is read into the buffer with this codec. Fails if it isn't compiled in.
+int bufferSetCodec(buffer_t *buffer, int type) {
+	if(buffer == NULL || buffer->fd != -1 || buffer->limited != 0 || buffer->used != 0) {
+		return 1;
+	}
+
+	switch(type) {
+#ifdef CRONSH_WITH_ZLIB
+		case CRONSH_CODEC_GZIP: break;
+#endif
+#ifdef CRONSH_WITH_ZSTD
+		case CRONSH_CODEC_ZSTD: break;
+#endif
+#ifdef CRONSH_WITH_LZ4
+		case CRONSH_CODEC_LZ4: break;
+#endif
+		default: return 1;
+	}
+
+	buffer->codec = (codec_t *)calloc(1, sizeof(codec_t));
+	if(buffer->codec == NULL) {
+		return 1;
+	}
+
+	buffer->codec->type = type;
+
+	return 0;
+}
+
+int bufferCompress(buffer_t *dst, const char *bytes, size_t nbytes) {
+	if(dst == NULL || dst->codec == NULL) {
+		return 1;
+	}
+
+	dst->codec->bytes += nbytes;
+
+	return bufferCodecRun(dst, bytes, nbytes, 0);
+}
+
+// Write the end of the stream. A buffer that never got any data stays empty.
+int bufferCompressEnd(buffer_t *dst) {
+	if(dst == NULL || dst->codec == NULL || dst->codec->stream == NULL) {
+		return 0;
+	}
+
+	return bufferCodecRun(dst, NULL, 0, 1);
+}
+
+const char *bufferCodecName(int type) {
+	switch(type) {
+		case CRONSH_CODEC_GZIP: return "gzip";
+		case CRONSH_CODEC_ZSTD: return "zstd";
+		case CRONSH_CODEC_LZ4: return "lz4";
+	}
+
+	return "none";
+}
+
+static void bufferFreeCodec(buffer_t *buffer) {
+	codec_t *codec = buffer->codec;
+
+	if(codec == NULL) {
+		return;
+	}
+
+	if(codec->stream != NULL) {
+		switch(codec->type) {
+#ifdef CRONSH_WITH_ZLIB
+			case CRONSH_CODEC_GZIP: deflateEnd((z_stream *)codec->stream); free(codec->stream); break;
+#endif
+#ifdef CRONSH_WITH_ZSTD
+			case CRONSH_CODEC_ZSTD: ZSTD_freeCCtx((ZSTD_CCtx *)codec->stream); break;
+#endif
+#ifdef CRONSH_WITH_LZ4
+			case CRONSH_CODEC_LZ4: LZ4F_freeCompressionContext((LZ4F_cctx *)codec->stream); break;
+#endif
+			default: break;
+		}
+	}
+
+	free(codec);
+	buffer->codec = NULL;
+
+	return;
+}
+
+static const char bufferBase64[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+// Base64 with padding. If newline is given, it is put after every 76 characters.
+int bufferAppendBase64(buffer_t *dst, const char *bytes, size_t len, const char *newline, size_t newlinelen) {
+	char *out, *o;
+	const unsigned char *in = (const unsigned char *)bytes;
+	size_t segment, i, column = 0;
+	uint32_t v;
+
+	while(len != 0) {
+		// whole lines of 57 bytes, so only the last segment has padding
+		segment = CRONSH_BUFFER_STEPSIZE;
+		if(dst->sink != NULL) {
+			segment = dst->size / (2 * (newlinelen + 2));
+		}
+		segment -= segment % 57;
+		if(segment == 0) {
+			segment = 57;
+		}
+		if(segment > len) {
+			segment = len;
+		}
+
+		out = bufferSpace(dst, (segment / 57 + 1) * (76 + newlinelen));
+		if(out == NULL) {
+			return 1;
+		}
+
+		o = out;
+		for(i = 0; i + 3 <= segment; i += 3) {
+			if(newline != NULL && column == 76) {
+				memcpy(o, newline, newlinelen);
+				o += newlinelen;
+				column = 0;
+			}
+
+			v = (in[i] << 16) | (in[i + 1] << 8) | in[i + 2];
+			*o++ = bufferBase64[(v >> 18) & 0x3f];
+			*o++ = bufferBase64[(v >> 12) & 0x3f];
+			*o++ = bufferBase64[(v >> 6) & 0x3f];
+			*o++ = bufferBase64[v & 0x3f];
+			column += 4;
+		}
+
+		if(i < segment) {
+			if(newline != NULL && column == 76) {
+				memcpy(o, newline, newlinelen);
+				o += newlinelen;
+				column = 0;
+			}
+
+			v = in[i] << 16;
+			if(i + 1 < segment) {
+				v |= in[i + 1] << 8;
+			}
+
+			*o++ = bufferBase64[(v >> 18) & 0x3f];
+			*o++ = bufferBase64[(v >> 12) & 0x3f];
+			*o++ = (i + 1 < segment) ? bufferBase64[(v >> 6) & 0x3f] : '=';
+			*o++ = '=';
+			column += 4;
+		}
+
+		bufferAdvance(dst, o - out);
+
+		in += segment;
+		len -= segment;
+	}
+
+	return 0;
+}
+
+int bufferInitSpool(buffer_t *buffer) {
+	if(buffer == NULL) {
+		return 1;
+	}
+
+	buffer->data = NULL;
+	buffer->size = 0;
+	buffer->used = 0;
+	buffer->step = CRONSH_BUFFER_STEPSIZE;
+	buffer->sink = NULL;
+	buffer->fd = -1;
+	buffer->mapped = 0;
+	buffer->limited = 0;
+	buffer->limit = 0;
+	buffer->total = 0;
+	buffer->dropped = 0;
+	buffer->ring = NULL;
+	buffer->ringsize = 0;
+	buffer->ringused = 0;
+	buffer->ringpos = 0;
+	buffer->codec = NULL;
+
+#ifdef __linux__
+	buffer->fd = memfd_create("cronsh", MFD_CLOEXEC);
+#endif
+
+	if(buffer->fd == -1) {
+		char path[1024];
+		const char *tmpdir = getenv("TMPDIR");
+
+		snprintf(path, sizeof(path), "%s/cronsh.XXXXXX", (tmpdir != NULL) ? tmpdir : "/tmp");
+
+		buffer->fd = mkstemp(path);
+		if(buffer->fd == -1) {
+			return 1;
+		}
+
+		unlink(path);
+		fcntl(buffer->fd, F_SETFD, FD_CLOEXEC);
+	}
+
+	return 0;
+}
+
+ssize_t bufferSplice(buffer_t *dst, int fd, size_t nbytes) {
+	ssize_t bytes;
+
+	if(dst == NULL || dst->fd == -1) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if(bufferUnmap(dst) != 0) {
+		return -1;
+	}
+
+#ifdef __linux__
+	// move the pages from the pipe into the spool without copying them through userspace
+	bytes = splice(fd, NULL, dst->fd, NULL, nbytes, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+	if(bytes > 0) {
+		dst->used += bytes;
+
+		return bytes;
+	}
+
+	if(bytes == 0 || (errno != EINVAL && errno != ENOSYS)) {
+		return bytes;
+	}
+#endif
+
+	char data[64 * 1024];
+
+	bytes = read(fd, data, sizeof(data));
+	if(bytes > 0) {
+		if(bufferWriteSpool(dst, data, bytes) != 0) {
+			return -1;
+		}
+	}
+
+	return bytes;
+}
+
+int bufferMap(buffer_t *buffer) {
+	char *data;
+
+	if(buffer == NULL) {
+		return 1;
+	}
+
+	if(buffer->fd == -1 || buffer->mapped != 0) {
+		return 0;
+	}
+
+	// one extra zero byte to keep the data NUL-terminated
+	if(ftruncate(buffer->fd, buffer->used + 1) != 0) {
+		return bufferUnspool(buffer);
+	}
+
+	data = (char *)mmap(NULL, buffer->used + 1, PROT_READ | PROT_WRITE, MAP_PRIVATE, buffer->fd, 0);
+	if(data == MAP_FAILED) {
+		return bufferUnspool(buffer);
+	}
+
+	buffer->data = data;
+	buffer->size = buffer->used;
+	buffer->mapped = 1;
+
+	return 0;
+}
+
+// Read the spool into the heap and continue as an ordinary buffer, if it can't be mapped
+static int bufferUnspool(buffer_t *buffer) {
+	char *data;
+	size_t n = 0;
+	ssize_t bytes;
+
+	data = (char *)malloc(buffer->used + 1);
+	if(data == NULL) {
+		return 1;
+	}
+
+	while(n < buffer->used) {
+		bytes = pread(buffer->fd, &data[n], buffer->used - n, n);
+		if(bytes == -1 && errno == EINTR) {
+			continue;
+		}
+
+		if(bytes <= 0) {
+			free(data);
+			return 1;
+		}
+
+		n += bytes;
+	}
+
+	data[n] = '\0';
+
+	close(buffer->fd);
+	buffer->fd = -1;
+
+	buffer->data = data;
+	buffer->size = buffer->used;
+	buffer->mapped = 0;
+
+	return 0;
+}
+
+int bufferSetLimit(buffer_t *buffer, size_t head, size_t tail) {
+	if(buffer == NULL || buffer->fd != -1) {
+		return 1;
+	}
+
+	if(buffer->ring != NULL) {
+		free(buffer->ring);
+		buffer->ring = NULL;
+	}
+
+	buffer->limited = 1;
+	buffer->limit = head;
+	buffer->ringsize = tail;
+	buffer->ringused = 0;
+	buffer->ringpos = 0;
+
+	return 0;
+}
+
+int bufferCompact(buffer_t *buffer) {
+	int rv = 0;
+	size_t total;
+	char marker[64];
+
+	if(buffer == NULL) {
+		return 1;
+	}
+
+	if(buffer->limited == 0) {
+		return 0;
+	}
+
+	// from here on the buffer is unlimited again
+	buffer->limited = 0;
+	buffer->limit = 0;
+
+	total = buffer->total;
+
+	if(buffer->dropped != 0) {
+		// a limit on the tail alone has no head to separate the marker from
+		snprintf(marker, sizeof(marker), "%s[... %lu bytes truncated ...]\n", (buffer->used != 0) ? "\n" : "", (unsigned long)buffer->dropped);
+		rv += bufferAppendBytes(buffer, marker, strlen(marker));
+	}
+
+	if(buffer->ringused != 0) {
+		if(buffer->ringused < buffer->ringsize) {
+			rv += bufferAppendBytes(buffer, buffer->ring, buffer->ringused);
+		}
+		else {
+			rv += bufferAppendBytes(buffer, &buffer->ring[buffer->ringpos], buffer->ringsize - buffer->ringpos);
+			rv += bufferAppendBytes(buffer, buffer->ring, buffer->ringpos);
+		}
+	}
+
+	// the marker and the tail don't count as new output
+	buffer->total = total;
+
+	if(buffer->ring != NULL) {
+		free(buffer->ring);
+		buffer->ring = NULL;
+	}
+
+	buffer->ringsize = 0;
+	buffer->ringused = 0;
+	buffer->ringpos = 0;
+
+	return rv;
+}
+
+char *bufferSpace(buffer_t *dst, size_t nbytes) {
+	if(dst == NULL || dst->fd != -1) {
+		return NULL;
+	}
+
+	if(dst->sink != NULL) {
+		if(nbytes > dst->size) {
+			return NULL;
+		}
+
+		if((dst->used + nbytes) > dst->size) {
+			if(bufferDrain(dst, NULL, 0) != 0) {
+				return NULL;
+			}
+		}
+	}
+	else if(bufferReserve(dst, nbytes) != 0) {
+		return NULL;
+	}
+
+	return &dst->data[dst->used];
+}
+
+void bufferAdvance(buffer_t *dst, size_t nbytes) {
+	dst->used += nbytes;
+	dst->total += nbytes;
+	dst->data[dst->used] = '\0';
+
+	return;
+}
+
+int bufferAppendString(buffer_t *dst, const char *format, ...) {
+	int rv;
+	char *string;
+	va_list ap;
+
+	if(format == NULL) {
+		return 0;
+	}
+
+	va_start(ap, format);
+	vasprintf(&string, format, ap);
+	va_end(ap);
+
+	if(string == NULL) {
+		return 0;
+	}
+
+	rv = bufferAppendBytes(dst, string, strlen(string));
+
+	free(string);
+
+	return rv;
+}
+
+int bufferAppendBuffer(buffer_t *dst, buffer_t *src) {
+	if(src == NULL) {
+		return 0;
+	}
+
+	return bufferAppendBytes(dst, src->data, src->used);
+}
+
+int bufferStartYAML(buffer_t *dst) {
+	return bufferAppendBytes(dst, "---\n", 4);
+}
+
+int bufferEndYAML(buffer_t *dst) {
+	return bufferAppendBytes(dst, "...\n", 4);
+}
+
+static const char bufferYAMLSpaces[] = "                                ";
+
+static int bufferAppendYAMLIndent(buffer_t *dst, unsigned int level) {
+	int rv = 0;
+	size_t n = 2 * level;
+
+	while(n > (sizeof(bufferYAMLSpaces) - 1)) {
+		rv += bufferAppendBytes(dst, bufferYAMLSpaces, sizeof(bufferYAMLSpaces) - 1);
+		n -= sizeof(bufferYAMLSpaces) - 1;
+	}
+
+	rv += bufferAppendBytes(dst, bufferYAMLSpaces, n);
+
+	return rv;
+}
+
+static int bufferAppendYAMLPrefix(buffer_t *dst, unsigned int level, const char *key) {
+	int rv = 0;
+
+	rv += bufferAppendYAMLIndent(dst, level);
+
+	if(key[0] == '-' && key[1] == '\0') {
+		rv += bufferAppendBytes(dst, "- ", 2);
+	}
+	else {
+		rv += bufferAppendBytes(dst, key, strlen(key));
+		rv += bufferAppendBytes(dst, ": ", 2);
+	}
+
+	return rv;
+}
+
+#define CRONSH_SCAN_CONTROL(c) ((unsigned char)(c) < 0x20 || (unsigned char)(c) == 0x7f)
+
+// Portable version, looks at 8 bytes at once
+static size_t bufferScanYAMLControlSWAR(const char *string, size_t len) {
+	size_t i = 0;
+	uint64_t x, lt, del;
+	const uint64_t ones = 0x0101010101010101ULL, highs = 0x8080808080808080ULL;
+
+	for(; (i + 8) <= len; i += 8) {
+		memcpy(&x, &string[i], 8);
+
+		// bytes below 0x20 and bytes equal to 0x7f
+		lt = (x - ones * 0x20) & ~x & highs;
+		del = ((x ^ (ones * 0x7f)) - ones) & ~(x ^ (ones * 0x7f)) & highs;
+
+		if((lt | del) != 0) {
+			break;
+		}
+	}
+
+	for(; i < len; i++) {
+		if(CRONSH_SCAN_CONTROL(string[i])) {
+			break;
+		}
+	}
+
+	return i;
+}
+
+#ifdef CRONSH_SCAN_X86
+__attribute__((target("sse2")))
+static size_t bufferScanYAMLControlSSE2(const char *string, size_t len) {
+	size_t i = 0;
+	int mask;
+	__m128i v;
+	const __m128i space = _mm_set1_epi8(0x1f), del = _mm_set1_epi8(0x7f);
+
+	for(; (i + 16) <= len; i += 16) {
+		v = _mm_loadu_si128((const __m128i *)&string[i]);
+
+		// v <= 0x1f as unsigned is max(v, 0x1f) == 0x1f
+		mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(_mm_max_epu8(v, space), space), _mm_cmpeq_epi8(v, del)));
+		if(mask != 0) {
+			return i + __builtin_ctz(mask);
+		}
+	}
+
+	return i + bufferScanYAMLControlSWAR(&string[i], len - i);
+}
+
+__attribute__((target("avx2")))
+static size_t bufferScanYAMLControlAVX2(const char *string, size_t len) {
+	size_t i = 0;
+	unsigned int mask;
+	__m256i v;
+	const __m256i space = _mm256_set1_epi8(0x1f), del = _mm256_set1_epi8(0x7f);
+
+	for(; (i + 32) <= len; i += 32) {
+		v = _mm256_loadu_si256((const __m256i *)&string[i]);
+
+		mask = (unsigned int)_mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(_mm256_max_epu8(v, space), space), _mm256_cmpeq_epi8(v, del)));
+		if(mask != 0) {
+			return i + __builtin_ctz(mask);
+		}
+	}
+
+	return i + bufferScanYAMLControlSSE2(&string[i], len - i);
+}
+#endif
+
+#define CRONSH_SCAN_SWAR	1
+#define CRONSH_SCAN_SSE2	2
+#define CRONSH_SCAN_AVX2	3
+
+static int bufferScanLevel = 0;
+
+static int bufferScanDetect(void) {
+	if(bufferScanLevel == 0) {
+		bufferScanLevel = CRONSH_SCAN_SWAR;
+#ifdef CRONSH_SCAN_X86
+		__builtin_cpu_init();
+		if(__builtin_cpu_supports("avx2")) {
+			bufferScanLevel = CRONSH_SCAN_AVX2;
+		}
+		else if(__builtin_cpu_supports("sse2")) {
+			bufferScanLevel = CRONSH_SCAN_SSE2;
+		}
+#endif
+	}
+
+	return bufferScanLevel;
+}
+
+// Position of the first control character, or len if there is none
+static size_t bufferScanYAMLControl(const char *string, size_t len) {
+	// short strings aren't worth it
+	if(len < 16) {
+		size_t i;
+
+		for(i = 0; i < len; i++) {
+			if(CRONSH_SCAN_CONTROL(string[i])) {
+				break;
+			}
+		}
+
+		return i;
+	}
+
+	switch(bufferScanDetect()) {
+#ifdef CRONSH_SCAN_X86
+		case CRONSH_SCAN_AVX2: return bufferScanYAMLControlAVX2(string, len);
+		case CRONSH_SCAN_SSE2: return bufferScanYAMLControlSSE2(string, len);
+#endif
+		default: break;
+	}
+
+	return bufferScanYAMLControlSWAR(string, len);
+}
+
+// Position of the first single quote, or len if there is none
+static size_t bufferScanYAMLQuote(const char *string, size_t len) {
+	const char *t = (const char *)memchr(string, '\'', len);
+
+	if(t == NULL) {
+		return len;
+	}
+
+	return t - string;
+}
+
+static int bufferAppendYAMLLiteral(buffer_t *dst, unsigned int level, const char *string, size_t len) {
+	int rv = 0;
+	char *out, *o;
+	const char *cr;
+	unsigned char c;
+	size_t i, j, segment, factor;
+	size_t indent = 2 * (level + 1);
+
+	if(indent > (sizeof(bufferYAMLSpaces) - 1)) {
+		indent = sizeof(bufferYAMLSpaces) - 1;
+	}
+
+	// as always, a \r that is the first control character is a line break, all others are escaped
+	cr = &string[bufferScanYAMLControl(string, len)];
+	if(cr == &string[len] || *cr != '\r') {
+		cr = NULL;
+	}
+
+	rv += bufferAppendBytes(dst, "|-\n", 3);
+	rv += bufferAppendBytes(dst, bufferYAMLSpaces, indent);
+
+	// a byte turns into at most a newline plus indentation or a \xNN escape
+	factor = (indent + 1 > 4) ? indent + 1 : 4;
+
+	while(len != 0) {
+		segment = CRONSH_BUFFER_STEPSIZE;
+		if(dst->sink != NULL) {
+			segment = dst->size / factor;
+		}
+		if(segment > len) {
+			segment = len;
+		}
+
+		out = bufferSpace(dst, segment * factor);
+		if(out == NULL) {
+			return rv + 1;
+		}
+
+		o = out;
+		i = 0;
+		while(i < segment) {
+			j = i + bufferScanYAMLControl(&string[i], segment - i);
+
+			memcpy(o, &string[i], j - i);
+			o += j - i;
+
+			if(j == segment) {
+				break;
+			}
+
+			c = (unsigned char)string[j];
+			if(c == '\n' || &string[j] == cr) {
+				*o++ = '\n';
+				memcpy(o, bufferYAMLSpaces, indent);
+				o += indent;
+			}
+			else {
+				*o++ = '\\';
+				*o++ = 'x';
+				if(c >= 0x10) {
+					*o++ = "0123456789abcdef"[c >> 4];
+				}
+				*o++ = "0123456789abcdef"[c & 0x0f];
+			}
+
+			i = j + 1;
+		}
+
+		bufferAdvance(dst, o - out);
+
+		string += segment;
+		len -= segment;
+	}
+
+	return rv;
+}
+
+static int bufferAppendYAMLQuoted(buffer_t *dst, const char *string, size_t len) {
+	int rv = 0;
+	char *out, *o;
+	size_t i, j, segment;
+
+	rv += bufferAppendBytes(dst, "'", 1);
+
+	while(len != 0) {
+		segment = CRONSH_BUFFER_STEPSIZE;
+		if(dst->sink != NULL) {
+			segment = dst->size / 2;
+		}
+		if(segment > len) {
+			segment = len;
+		}
+
+		// every quote is doubled
+		out = bufferSpace(dst, segment * 2);
+		if(out == NULL) {
+			return rv + 1;
+		}
+
+		o = out;
+		i = 0;
+		while(i < segment) {
+			j = i + bufferScanYAMLQuote(&string[i], segment - i);
+
+			memcpy(o, &string[i], j - i);
+			o += j - i;
+
+			if(j == segment) {
+				break;
+			}
+
+			*o++ = '\'';
+			*o++ = '\'';
+
+			i = j + 1;
+		}
+
+		bufferAdvance(dst, o - out);
+
+		string += segment;
+		len -= segment;
+	}
+
+	rv += bufferAppendBytes(dst, "'", 1);
+
+	return rv;
+}
+
+int bufferAppendYAMLKey(buffer_t *dst, unsigned int level, const char *key) {
+	int rv = 0;
+
+	if(key == NULL) {
+		return 0;
+	}
+
+	rv += bufferAppendYAMLPrefix(dst, level, key);
+	rv += bufferAppendBytes(dst, "\n", 1);
+
+	return rv;
+}
+
+int bufferAppendYAMLNumber(buffer_t *dst, unsigned int level, const char *key, long value) {
+	int rv = 0;
+	char number[32], *n = &number[sizeof(number)];
+	unsigned long u = (value < 0) ? -(unsigned long)value : (unsigned long)value;
+
+	if(key == NULL) {
+		return 0;
+	}
+
+	*--n = '\n';
+	do {
+		*--n = '0' + (u % 10);
+		u /= 10;
+	} while(u != 0);
+
+	if(value < 0) {
+		*--n = '-';
+	}
+
+	rv += bufferAppendYAMLPrefix(dst, level, key);
+	rv += bufferAppendBytes(dst, n, &number[sizeof(number)] - n);
+
+	return rv;
+}
+
+int bufferAppendYAMLString(buffer_t *dst, unsigned int level, const char *key, const char *string, size_t len) {
+	int rv = 0;
+
+	if(key == NULL) {
+		return 0;
+	}
+
+	rv += bufferAppendYAMLPrefix(dst, level, key);
+
+	if(string != NULL && len != 0) {
+		// strings with control characters become literal blocks, all others are quoted
+		if(bufferScanYAMLControl(string, len) != len) {
+			rv += bufferAppendYAMLLiteral(dst, level, string, len);
+		}
+		else {
+			rv += bufferAppendYAMLQuoted(dst, string, len);
+		}
+	}
+
+	rv += bufferAppendBytes(dst, "\n", 1);
+
+	return rv;
+}
+
+// Base64 in a literal block, tagged so that parsers hand out the original bytes
+int bufferAppendYAMLBinary(buffer_t *dst, unsigned int level, const char *key, const char *bytes, size_t len) {
+	int rv = 0;
+	char newline[1 + sizeof(bufferYAMLSpaces)];
+	size_t indent = 2 * (level + 1);
+
+	if(key == NULL) {
+		return 0;
+	}
+
+	if(indent > (sizeof(bufferYAMLSpaces) - 1)) {
+		indent = sizeof(bufferYAMLSpaces) - 1;
+	}
+
+	newline[0] = '\n';
+	memcpy(&newline[1], bufferYAMLSpaces, indent);
+
+	rv += bufferAppendYAMLPrefix(dst, level, key);
+
+	if(bytes == NULL || len == 0) {
+		rv += bufferAppendBytes(dst, "!!binary ''\n", 12);
+
+		return rv;
+	}
+
+	rv += bufferAppendBytes(dst, "!!binary |-", 11);
+	rv += bufferAppendBytes(dst, newline, 1 + indent);
+	rv += bufferAppendBase64(dst, bytes, len, newline, 1 + indent);
+	rv += bufferAppendBytes(dst, "\n", 1);
+
+	return rv;
+}
+
+int bufferAppendYAML(buffer_t *dst, unsigned int level, const char *key, const char *format, int type, ...) {
+	int rv = 0;
+	char *string;
+	va_list ap;
+
+	if(key == NULL || format == NULL) {
+		return 0;
+	}
+
+	if(type != CRONSH_YAML_NUMBER && type != CRONSH_YAML_STRING) {
+		return bufferAppendYAMLKey(dst, level, key);
+	}
+
+	va_start(ap, type);
+	vasprintf(&string, format, ap);
+	va_end(ap);
+
+	if(string == NULL) {
+		return 0;
+	}
+
+	if(type == CRONSH_YAML_NUMBER) {
+		rv += bufferAppendYAMLPrefix(dst, level, key);
+		rv += bufferAppendBytes(dst, string, strlen(string));
+		rv += bufferAppendBytes(dst, "\n", 1);
+	}
+	else {
+		rv += bufferAppendYAMLString(dst, level, key, string, strlen(string));
+	}
+
+	free(string);
+
+	return rv;
+}
+
+int bufferAppendYAMLList(buffer_t *dst, unsigned int level, const char *key, int type, char **list) {
+	int rv = 0;
+	unsigned int l;
+
+	if(key == NULL) {
+		return 0;
+	}
+
+	rv += bufferAppendYAMLIndent(dst, level);
+	rv += bufferAppendBytes(dst, key, strlen(key));
+
+	rv += bufferAppendBytes(dst, ":\n", 2);
+
+	for(l = 0; list[l] != NULL; l++) {
+		if(type == CRONSH_YAML_STRING) {
+			rv += bufferAppendYAMLString(dst, level + 1, "-", list[l], strlen(list[l]));
+		}
+		else {
+			rv += bufferAppendYAML(dst, level + 1, "-", "%s", type, list[l]);
+		}
+	}
+
+	return rv;
+}
+
+// what a byte turns into inside a JSON string: 0 = copied, u = \u00XX, 8 = start of a UTF-8 sequence
+static const char bufferJSONEscape[256] = {
+	[0x00 ... 0x07] = 'u',
+	['\b'] = 'b', ['\t'] = 't', ['\n'] = 'n', [0x0b] = 'u', ['\f'] = 'f', ['\r'] = 'r',
+	[0x0e ... 0x1f] = 'u',
+	['"'] = '"', ['\\'] = '\\',
+	[0x80 ... 0xff] = '8',
+};
+
+// Portable version, looks at 8 bytes at once
+static size_t bufferScanJSONSWAR(const char *string, size_t len) {
+	size_t i = 0;
+	uint64_t x, lt, quote, backslash;
+	const uint64_t ones = 0x0101010101010101ULL, highs = 0x8080808080808080ULL;
+
+	for(; (i + 8) <= len; i += 8) {
+		memcpy(&x, &string[i], 8);
+
+		// bytes below 0x20, quotes, backslashes, and everything with the high bit set
+		lt = (x - ones * 0x20) & ~x & highs;
+		quote = ((x ^ (ones * '"')) - ones) & ~(x ^ (ones * '"')) & highs;
+		backslash = ((x ^ (ones * '\\')) - ones) & ~(x ^ (ones * '\\')) & highs;
+
+		if((lt | quote | backslash | (x & highs)) != 0) {
+			break;
+		}
+	}
+
+	for(; i < len; i++) {
+		if(bufferJSONEscape[(unsigned char)string[i]] != 0) {
+			break;
+		}
+	}
+
+	return i;
+}
+
+#ifdef CRONSH_SCAN_X86
+__attribute__((target("sse2")))
+static size_t bufferScanJSONSSE2(const char *string, size_t len) {
+	size_t i = 0;
+	int mask;
+	__m128i v;
+	const __m128i space = _mm_set1_epi8(0x20), quote = _mm_set1_epi8('"'), backslash = _mm_set1_epi8('\\');
+
+	for(; (i + 16) <= len; i += 16) {
+		v = _mm_loadu_si128((const __m128i *)&string[i]);
+
+		// as signed bytes, everything from 0x80 on is below 0x20 as well
+		mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmplt_epi8(v, space), _mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, backslash))));
+		if(mask != 0) {
+			return i + __builtin_ctz(mask);
+		}
+	}
+
+	return i + bufferScanJSONSWAR(&string[i], len - i);
+}
+
+__attribute__((target("avx2")))
+static size_t bufferScanJSONAVX2(const char *string, size_t len) {
+	size_t i = 0;
+	unsigned int mask;
+	__m256i v;
+	const __m256i space = _mm256_set1_epi8(0x20), quote = _mm256_set1_epi8('"'), backslash = _mm256_set1_epi8('\\');
+
+	for(; (i + 32) <= len; i += 32) {
+		v = _mm256_loadu_si256((const __m256i *)&string[i]);
+
+		mask = (unsigned int)_mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpgt_epi8(space, v), _mm256_or_si256(_mm256_cmpeq_epi8(v, quote), _mm256_cmpeq_epi8(v, backslash))));
+		if(mask != 0) {
+			return i + __builtin_ctz(mask);
+		}
+	}
+
+	return i + bufferScanJSONSSE2(&string[i], len - i);
+}
+#endif
+
+// Position of the first byte that can't be copied into a JSON string as it is, or len if there is none
+static size_t bufferScanJSON(const char *string, size_t len) {
+	if(len < 16) {
+		size_t i;
+
+		for(i = 0; i < len; i++) {
+			if(bufferJSONEscape[(unsigned char)string[i]] != 0) {
+				break;
+			}
+		}
+
+		return i;
+	}
+
+	switch(bufferScanDetect()) {
+#ifdef CRONSH_SCAN_X86
+		case CRONSH_SCAN_AVX2: return bufferScanJSONAVX2(string, len);
+		case CRONSH_SCAN_SSE2: return bufferScanJSONSSE2(string, len);
+#endif
+		default: break;
+	}
+
+	return bufferScanJSONSWAR(string, len);
+}
+
+// Length of the UTF-8 sequence at the start of string. If it isn't well-formed, valid is 0 and the length
+// is that of its maximal subpart, which is replaced by a single U+FFFD (Unicode 15, 3.9)
+static size_t bufferScanUTF8(const unsigned char *string, size_t len, int *valid) {
+	unsigned char c = string[0], min = 0x80, max = 0xbf;
+	size_t n, i;
+
+	*valid = 0;
+
+	if(c >= 0xc2 && c <= 0xdf) {
+		n = 2;
+	}
+	else if(c >= 0xe0 && c <= 0xef) {
+		n = 3;
+		if(c == 0xe0) { min = 0xa0; }		// overlong
+		else if(c == 0xed) { max = 0x9f; }	// surrogates
+	}
+	else if(c >= 0xf0 && c <= 0xf4) {
+		n = 4;
+		if(c == 0xf0) { min = 0x90; }		// overlong
+		else if(c == 0xf4) { max = 0x8f; }	// above U+10FFFF
+	}
+	else {
+		return 1;
+	}
+
+	if(len < 2 || string[1] < min || string[1] > max) {
+		return 1;
+	}
+
+	for(i = 2; i < n; i++) {
+		if(i >= len || string[i] < 0x80 || string[i] > 0xbf) {
+			return i;
+		}
+	}
+
+	*valid = 1;
+
+	return n;
+}
+
+// Quoted and escaped, bytes that aren't valid UTF-8 are replaced by U+FFFD
+int bufferAppendJSONString(buffer_t *dst, const char *string, size_t len) {
+	int rv = 0;
+	char *out, *o, e;
+	unsigned char c;
+	size_t i, j, n, segment;
+	int valid;
+
+	if(string == NULL) {
+		return bufferAppendBytes(dst, "null", 4);
+	}
+
+	rv += bufferAppendBytes(dst, "\"", 1);
+
+	while(len != 0) {
+		segment = CRONSH_BUFFER_STEPSIZE;
+		if(dst->sink != NULL) {
+			segment = dst->size / 8;
+		}
+		if(segment > len) {
+			segment = len;
+		}
+
+		// a byte turns into at most 6 bytes, a sequence may reach 3 bytes beyond the segment
+		out = bufferSpace(dst, segment * 6 + 8);
+		if(out == NULL) {
+			return rv + 1;
+		}
+
+		o = out;
+		i = 0;
+		while(i < segment) {
+			j = i + bufferScanJSON(&string[i], segment - i);
+
+			memcpy(o, &string[i], j - i);
+			o += j - i;
+
+			if(j == segment) {
+				i = j;
+				break;
+			}
+
+			c = (unsigned char)string[j];
+			e = bufferJSONEscape[c];
+
+			if(e == '8') {
+				n = bufferScanUTF8((const unsigned char *)&string[j], len - j, &valid);
+				if(valid == 1) {
+					memcpy(o, &string[j], n);
+					o += n;
+				}
+				else {
+					memcpy(o, "\\ufffd", 6);
+					o += 6;
+				}
+
+				i = j + n;
+				continue;
+			}
+
+			*o++ = '\\';
+			if(e == 'u') {
+				*o++ = 'u';
+				*o++ = '0';
+				*o++ = '0';
+				*o++ = "0123456789abcdef"[c >> 4];
+				*o++ = "0123456789abcdef"[c & 0x0f];
+			}
+			else {
+				*o++ = e;
+			}
+
+			i = j + 1;
+		}
+
+		bufferAdvance(dst, o - out);
+
+		string += i;
+		len -= i;
+	}
+
+	rv += bufferAppendBytes(dst, "\"", 1);
+
+	return rv;
+}
+
+int bufferAppendJSONNumber(buffer_t *dst, long value) {
+	char number[32], *n = &number[sizeof(number)];
+	unsigned long u = (value < 0) ? -(unsigned long)value : (unsigned long)value;
+
+	do {
+		*--n = '0' + (u % 10);
+		u /= 10;
+	} while(u != 0);
+
+	if(value < 0) {
+		*--n = '-';
+	}
+
+	return bufferAppendBytes(dst, n, &number[sizeof(number)] - n);
+}
+
+static char *bufferPutBE(char *p, uint64_t value, int nbytes) {
+	int i;
+
+	for(i = nbytes - 1; i >= 0; i--) {
+		p[i] = (char)(value & 0xff);
+		value >>= 8;
+	}
+
+	return p + nbytes;
+}
+
+int bufferAppendCBORHead(buffer_t *dst, unsigned int major, uint64_t value) {
+	char *p, *o;
+
+	// 9 bytes for the longest head and 1 for the terminating \0
+	p = o = bufferSpace(dst, 10);
+	if(p == NULL) {
+		return 1;
+	}
 
-	fprintf(stderr, "SYNOPSIS\n");
-	fprintf(stderr, "\tcronsh -c command -h\n");
-	fprintf(stderr, "\n");
+	major <<= 5;
 
-	fprintf(stderr, "DESCRIPTION\n");
-	fprintf(stderr, "\tcronsh (or cronshell) is a shell for executing cron jobs. It collects stdout, stderr, the return code, and other\n");
-	fprintf(stderr, "\tvalues from the command it runs. At the end of executing the command, all captured data is arranged in a YAML document.\n");
-	fprintf(stderr, "\tThis document will be sent to stdout, written to a file (see CRONSH_FILE), or piped to an other command (see\n");
-	fprintf(stderr, "\tCRONSH_PIPE). Set CRONSH_OPTIONS for specifying the default behaviour.\n");
-	fprintf(stderr, "\n");
-	fprintf(stderr, "\tIn the crontab, point the SHELL environment variable to cronsh. cron will then execute cronsh by calling\n");
-	fprintf(stderr, "\tit with the -c option and the command line as its value. The anatomy of the command line is:\n");
-	fprintf(stderr, "\n");
-	fprintf(stderr, "\t   [executable] [arguments]? #[tag]? [options]?\n");
-	fprintf(stderr, "\n");
-	fprintf(stderr, "\tEverything after (and including) the first # will not be part of the executed command and its arguments. Directly following\n");
-	fprintf(stderr, "\tthe # up to the first blank or the end of the line is considered as a tag for this command. Associating a tag is optional.\n");
-	fprintf(stderr, "\tThe options for the command are inherited from CRONSH_OPTIONS and can be modified by specifying addional options. This is\n");
-	fprintf(stderr, "\toptional.\n");
-	fprintf(stderr, "\n");
-	fprintf(stderr, "\tThe anatomy of the YAML is:\n");
+	if(value < 24) {
+		*o++ = major | value;
+	}
+	else if(value <= 0xff) {
+		*o++ = major | 24;
+		o = bufferPutBE(o, value, 1);
+	}
+	else if(value <= 0xffff) {
+		*o++ = major | 25;
+		o = bufferPutBE(o, value, 2);
+	}
+	else if(value <= 0xffffffff) {
+		*o++ = major | 26;
+		o = bufferPutBE(o, value, 4);
+	}
+	else {
+		*o++ = major | 27;
+		o = bufferPutBE(o, value, 8);
+	}
 
-	fprintf(stderr, "\n");
-	fprintf(stderr, "\t---\n");
-	fprintf(stderr, "\thostname: Ingos-MacBook-Air.local                                   - CRONSH_HOSTNAME or gethostname().\n");
-	fprintf(stderr, "\tuser: ioppermann                                                    - USER or LOGNAME.\n");
-	fprintf(stderr, "\trawcommand: /usr/bin/printf 'hello world' #tag sendto-file          - crontab command line.\n");
-	fprintf(stderr, "\tcommand:                                                            - executed command.\n");
-	fprintf(stderr, "\t  - /usr/bin/printf\n");
-	fprintf(stderr, "\t  - hello world\n");
-	fprintf(stderr, "\ttag: tag                                                            - tag as specified in rawcommand.\n");
-	fprintf(stderr, "\tstarttime: 1396712280                                               - UNIX timestamp.\n");
-	fprintf(stderr, "\truntime: 3                                                          - runtime in milliseconds.\n");
-	fprintf(stderr, "\tpid: 4471                                                           - PID of the excuted command.\n");
-	fprintf(stderr, "\tppid: 4470                                                          - PID of cronsh.\n");
-	fprintf(stderr, "\tstatus: 0                                                           - exit status of executed command.\n");
-	fprintf(stderr, "\tsignal: 0                                                           - signal that caused exiting.\n");
-	fprintf(stderr, "\tstdout: hello world                                                 - captured stdout.\n");
-	fprintf(stderr, "\tstderr:                                                             - captured stderr.\n");
-	fprintf(stderr, "\trusage:                                                             - the values of the rusage struct.\n");
-	fprintf(stderr, "\t...\n");
-	fprintf(stderr, "\n");
+	bufferAdvance(dst, o - p);
 
-	fprintf(stderr, "OPTIONS\n");
-	fprintf(stderr, "\t-c command\n");
-	fprintf(stderr, "\t    The command to execute.\n");
-	fprintf(stderr, "\n");
-	fprintf(stderr, "\t-V verbosity\n");
-	fprintf(stderr, "\t    Sets the environment variable CRONSH_LOGLEVEL.\n");
-	fprintf(stderr, "\n");
-	fprintf(stderr, "\t-s shell\n");
-	fprintf(stderr, "\t    Sets the environment variable CRONSH_SHELL.\n");
-	fprintf(stderr, "\n");
-	fprintf(stderr, "\t-l file\n");
-	fprintf(stderr, "\t    Sets the environment variable CRONSH_LOG.\n");
-	fprintf(stderr, "\n");
-	fprintf(stderr, "\t-p command\n");
-	fprintf(stderr, "\t    Sets the environment variable CRONSH_PIPE.\n");
-	fprintf(stderr, "\n");
-	fprintf(stderr, "\t-o options\n");
-	fprintf(stderr, "\t    Sets the environment variable CRONSH_OPTIONS.\n");
-	fprintf(stderr, "\n");
-	fprintf(stderr, "\t-H hostname\n");
-	fprintf(stderr, "\t    Sets the environment variable CRONSH_HOSTNAME.\n");
-	fprintf(stderr, "\n");
-	fprintf(stderr, "\t-h\n");
-	fprintf(stderr, "\t    Display the help screen.\n");
-	fprintf(stderr, "\n");
+	return 0;
+}
 
-	fprintf(stderr, "ENVIRONMENT\n");
-	fprintf(stderr, "\tThese environment variables are recognized by cronsh and can be set in the crontab.\n");
-	fprintf(stderr, "\n");
-	fprintf(stderr, "\tCRONSH_LOGLEVEL\n");
-	fprintf(stderr, "\t    Set the logging verbosity for messages written to CRONSH_LOG. Valid verbosity levels are:\n");
-	fprintf(stderr, "\t         debug     - very verbose logging, includes warn and critical.\n");
-	fprintf(stderr, "\t         notice    - less verbose logging, includes critical.\n");
-	fprintf(stderr, "\t         critical  - only logs events that prevent the proper execution of cronsh.\n");
-	fprintf(stderr, "\n");
-	fprintf(stderr, "\tCRONSH_SHELL\n");
-	fprintf(stderr, "\t    Path to a shell to used for executing the command. The default is " CRONSH_SHELL_DEFAULT "\n");
-	fprintf(stderr, "\n");
-	fprintf(stderr, "\tCRONSH_LOG\n");
-	fprintf(stderr, "\t    Path to the file where to write log messages to.\n");
-	fprintf(stderr, "\n");
-	fprintf(stderr, "\tCRONSH_FILE\n");
-	fprintf(stderr, "\t    Write the YAML document to this file if the option 'sendto-file' is given.\n");
-	fprintf(stderr, "\n");
-	fprintf(stderr, "\tCRONSH_PIPE\n");
-	fprintf(stderr, "\t    Write the YAML document to STDIN of this command if the option 'sendto-pipe' is given.\n");
-	fprintf(stderr, "\n");
-	fprintf(stderr, "\tCRONSH_OPTIONS\n");
-	fprintf(stderr, "\t    Set the different options to define the default behaviour of cronsh. The order of the\n");
-	fprintf(stderr, "\t    options is crucial. Valid options are:\n");
-	fprintf(stderr, "\t         silent              - nothing will be send neither to cron, file, nor pipe.\n");
-	fprintf(stderr, "\t         crondefault         - mimic the default cron behaviour, i.e. send the YAML to cron only if there's output.\n");
-	fprintf(stderr, "\t         capture-stdout      - capture stdout.\n");
-	fprintf(stderr, "\t         capture-stderr      - capture stderr.\n");
-	fprintf(stderr, "\t         capture-all         - capture stdout and stderr.\n");
-	fprintf(stderr, "\t         sendto-stdout       - send the YAML to stdout.\n");
-	fprintf(stderr, "\t         sendto-file         - send the YAML to a file (see CRONSH_FILE).\n");
-	fprintf(stderr, "\t         sendto-pipe         - send the YAML to the pipe (see CRONSH_PIPE).\n");
-	fprintf(stderr, "\t         sendto-all          - send the YAML to cron, file, and pipe.\n");
-	fprintf(stderr, "\t         sendto-fallback     - try to send the YAML first to pipe, then to file, and then cron if the previous didn't work.\n");
-	fprintf(stderr, "\t         sendif-status       - send the YAML only if the return status is not 0.\n");
-	fprintf(stderr, "\t         sendif-status-ok    - send the YAML only if the return status is 0.\n");
-	fprintf(stderr, "\t         sendif-status-any   - send the YAML on any return status.\n");
-	fprintf(stderr, "\t         sendif-signal       - send the YAML only if the signal status is not 0.\n");
-	fprintf(stderr, "\t         sendif-signal-ok    - send the YAML only if the signal status is 0.\n");
-	fprintf(stderr, "\t         sendif-signal-any   - send the YAML on any signal status.\n");
-	fprintf(stderr, "\t         sendif-stdout       - send the YAML only if there was output to stdout.\n");
-	fprintf(stderr, "\t         sendif-stdout-none  - send the YAML only if there was no output to stdout.\n");
-	fprintf(stderr, "\t         sendif-stdout-any   - send the YAML on any stdout value.\n");
-	fprintf(stderr, "\t         sendif-stderr       - send the YAML only if there was output to stderr.\n");
-	fprintf(stderr, "\t         sendif-stderr-none  - send the YAML only if there was no output to stderr.\n");
-	fprintf(stderr, "\t         sendif-stderr-any   - send the YAML on any stderr value.\n");
-	fprintf(stderr, "\t         sendif-any          - send the YAML in any case.\n");
-	fprintf(stderr, "\n");
-	fprintf(stderr, "\tCRONSH_HOSTNAME\n");
-	fprintf(stderr, "\t    Override the hostname as given by gethostname().\n");
-	fprintf(stderr, "\n");
-	fprintf(stderr, "\tUSER / LOGNAME\n");
-	fprintf(stderr, "\t    The user who owns this crontab and this command will be run as. See the man page for crontab.\n");
-	fprintf(stderr, "\n");
+int bufferAppendCBORNumber(buffer_t *dst, long value) {
+	if(value < 0) {
+		return bufferAppendCBORHead(dst, 1, (uint64_t)(-(value + 1)));
+	}
+
+	return bufferAppendCBORHead(dst, CRONSH_ITEM_NUMBER, (uint64_t)value);
+}
+
+int bufferAppendCBORString(buffer_t *dst, unsigned int major, const char *string, size_t len) {
+	int rv = 0;
+
+	// a missing string is null
+	if(string == NULL) {
+		return bufferAppendBytes(dst, "\xf6", 1);
+	}
+
+	rv += bufferAppendCBORHead(dst, major, len);
+	rv += bufferAppendBytes(dst, string, len);
+
+	return rv;
+}
+
+int bufferAppendMsgpackHead(buffer_t *dst, unsigned int type, uint64_t value) {
+	char *p, *o;
+
+	p = o = bufferSpace(dst, 10);
+	if(p == NULL) {
+		return 1;
+	}
+
+	switch(type) {
+		case CRONSH_ITEM_TEXT:
+			if(value < 32) {
+				*o++ = 0xa0 | value;
+			}
+			else if(value <= 0xff) {
+				*o++ = 0xd9;
+				o = bufferPutBE(o, value, 1);
+			}
+			else if(value <= 0xffff) {
+				*o++ = 0xda;
+				o = bufferPutBE(o, value, 2);
+			}
+			else {
+				*o++ = 0xdb;
+				o = bufferPutBE(o, value, 4);
+			}
+			break;
+		case CRONSH_ITEM_BYTES:
+			if(value <= 0xff) {
+				*o++ = 0xc4;
+				o = bufferPutBE(o, value, 1);
+			}
+			else if(value <= 0xffff) {
+				*o++ = 0xc5;
+				o = bufferPutBE(o, value, 2);
+			}
+			else {
+				*o++ = 0xc6;
+				o = bufferPutBE(o, value, 4);
+			}
+			break;
+		case CRONSH_ITEM_ARRAY:
+		case CRONSH_ITEM_MAP:
+			if(value < 16) {
+				*o++ = ((type == CRONSH_ITEM_ARRAY) ? 0x90 : 0x80) | value;
+			}
+			else if(value <= 0xffff) {
+				*o++ = (type == CRONSH_ITEM_ARRAY) ? 0xdc : 0xde;
+				o = bufferPutBE(o, value, 2);
+			}
+			else {
+				*o++ = (type == CRONSH_ITEM_ARRAY) ? 0xdd : 0xdf;
+				o = bufferPutBE(o, value, 4);
+			}
+			break;
+		default:
+			// non-negative integers
+			if(value < 128) {
+				*o++ = value;
+			}
+			else if(value <= 0xff) {
+				*o++ = 0xcc;
+				o = bufferPutBE(o, value, 1);
+			}
+			else if(value <= 0xffff) {
+				*o++ = 0xcd;
+				o = bufferPutBE(o, value, 2);
+			}
+			else if(value <= 0xffffffff) {
+				*o++ = 0xce;
+				o = bufferPutBE(o, value, 4);
+			}
+			else {
+				*o++ = 0xcf;
+				o = bufferPutBE(o, value, 8);
+			}
+			break;
+	}
+
+	bufferAdvance(dst, o - p);
+
+	return 0;
+}
+
+int bufferAppendMsgpackNumber(buffer_t *dst, long value) {
+	char *p, *o;
+
+	if(value >= 0) {
+		return bufferAppendMsgpackHead(dst, CRONSH_ITEM_NUMBER, (uint64_t)value);
+	}
+
+	p = o = bufferSpace(dst, 10);
+	if(p == NULL) {
+		return 1;
+	}
+
+	if(value >= -32) {
+		*o++ = (char)value;
+	}
+	else if(value >= INT8_MIN) {
+		*o++ = 0xd0;
+		o = bufferPutBE(o, (uint64_t)value, 1);
+	}
+	else if(value >= INT16_MIN) {
+		*o++ = 0xd1;
+		o = bufferPutBE(o, (uint64_t)value, 2);
+	}
+	else if(value >= INT32_MIN) {
+		*o++ = 0xd2;
+		o = bufferPutBE(o, (uint64_t)value, 4);
+	}
+	else {
+		*o++ = 0xd3;
+		o = bufferPutBE(o, (uint64_t)value, 8);
+	}
+
+	bufferAdvance(dst, o - p);
+
+	return 0;
+}
+
+int bufferAppendMsgpackString(buffer_t *dst, unsigned int type, const char *string, size_t len) {
+	int rv = 0;
+
+	// a missing string is nil
+	if(string == NULL) {
+		return bufferAppendBytes(dst, "\xc0", 1);
+	}
+
+	rv += bufferAppendMsgpackHead(dst, type, len);
+	rv += bufferAppendBytes(dst, string, len);
+
+	return rv;
+}
+
+/* emitter facility */
+
+void emitterInit(emitter_t *emitter, buffer_t *dst, int format) {
+	emitter->dst = dst;
+	emitter->format = format;
+
+	emitter->depth = 0;
+	emitter->first = 1;
+
+	return;
+}
+
+// the binary formats need to know the number of entries of a map before its first entry
+int emitterStart(emitter_t *emitter, size_t nitems) {
+	switch(emitter->format) {
+		case CRONSH_FORMAT_CBOR: return bufferAppendCBORHead(emitter->dst, CRONSH_ITEM_MAP, nitems);
+		case CRONSH_FORMAT_MSGPACK: return bufferAppendMsgpackHead(emitter->dst, CRONSH_ITEM_MAP, nitems);
+		case CRONSH_FORMAT_NDJSON: return bufferAppendBytes(emitter->dst, "{", 1);
+	}
+
+	return bufferStartYAML(emitter->dst);
+}
+
+// close the JSON objects that are deeper than level
+static int emitterClose(emitter_t *emitter, unsigned int level) {
+	int rv = 0;
+
+	while(emitter->depth > level) {
+		emitter->depth--;
+		rv += bufferAppendBytes(emitter->dst, &emitter->closers[emitter->depth], 1);
+		emitter->first = 0;
+	}
+
+	return rv;
+}
+
+int emitterEnd(emitter_t *emitter) {
+	int rv = 0;
+
+	switch(emitter->format) {
+		case CRONSH_FORMAT_YAML: return bufferEndYAML(emitter->dst);
+		case CRONSH_FORMAT_NDJSON:
+			rv += emitterClose(emitter, 0);
+			rv += bufferAppendBytes(emitter->dst, "}\n", 2);
+			return rv;
+	}
+
+	return 0;
+}
+
+// the level tells JSON which object the member belongs to
+static int emitterMember(emitter_t *emitter, unsigned int level, const char *key) {
+	int rv = 0;
+
+	rv += emitterClose(emitter, level);
+
+	if(emitter->first == 0) {
+		rv += bufferAppendBytes(emitter->dst, ",", 1);
+	}
+	emitter->first = 0;
+
+	rv += bufferAppendJSONString(emitter->dst, key, strlen(key));
+	rv += bufferAppendBytes(emitter->dst, ":", 1);
+
+	return rv;
+}
+
+static int emitterKey(emitter_t *emitter, const char *key) {
+	if(emitter->format == CRONSH_FORMAT_CBOR) {
+		return bufferAppendCBORString(emitter->dst, CRONSH_ITEM_TEXT, key, strlen(key));
+	}
+
+	return bufferAppendMsgpackString(emitter->dst, CRONSH_ITEM_TEXT, key, strlen(key));
+}
+
+int emitterMap(emitter_t *emitter, unsigned int level, const char *key, size_t nitems) {
+	int rv = 0;
+
+	if(key == NULL) {
+		return 0;
+	}
+
+	switch(emitter->format) {
+		case CRONSH_FORMAT_CBOR:
+			rv += emitterKey(emitter, key);
+			rv += bufferAppendCBORHead(emitter->dst, CRONSH_ITEM_MAP, nitems);
+			return rv;
+		case CRONSH_FORMAT_MSGPACK:
+			rv += emitterKey(emitter, key);
+			rv += bufferAppendMsgpackHead(emitter->dst, CRONSH_ITEM_MAP, nitems);
+			return rv;
+		case CRONSH_FORMAT_NDJSON:
+			if(level >= sizeof(emitter->closers)) {
+				return 1;
+			}
+
+			rv += emitterMember(emitter, level, key);
+			rv += bufferAppendBytes(emitter->dst, "{", 1);
+			emitter->closers[level] = '}';
+			emitter->depth = level + 1;
+			emitter->first = 1;
+			return rv;
+	}
+
+	return bufferAppendYAMLKey(emitter->dst, level, key);
+}
+
+int emitterNumber(emitter_t *emitter, unsigned int level, const char *key, long value) {
+	int rv = 0;
+
+	if(key == NULL) {
+		return 0;
+	}
+
+	switch(emitter->format) {
+		case CRONSH_FORMAT_CBOR:
+			rv += emitterKey(emitter, key);
+			rv += bufferAppendCBORNumber(emitter->dst, value);
+			return rv;
+		case CRONSH_FORMAT_MSGPACK:
+			rv += emitterKey(emitter, key);
+			rv += bufferAppendMsgpackNumber(emitter->dst, value);
+			return rv;
+		case CRONSH_FORMAT_NDJSON:
+			rv += emitterMember(emitter, level, key);
+			rv += bufferAppendJSONNumber(emitter->dst, value);
+			return rv;
+	}
+
+	return bufferAppendYAMLNumber(emitter->dst, level, key, value);
+}
 
-	fprintf(stderr, "BUGS\n");
-	fprintf(stderr, "\tNo known bugs (but probably there are some).\n");
-	fprintf(stderr, "\n");
+// text that is expected to be valid UTF-8
+int emitterString(emitter_t *emitter, unsigned int level, const char *key, const char *string, size_t len) {
+	int rv = 0;
 
-	fprintf(stderr, "AUTHOR\n");
-	fprintf(stderr, "\t(c) 2014+ Ingo Oppermann\n");
+	if(key == NULL) {
+		return 0;
+	}
 
-	return;
+	switch(emitter->format) {
+		case CRONSH_FORMAT_CBOR:
+			rv += emitterKey(emitter, key);
+			rv += bufferAppendCBORString(emitter->dst, CRONSH_ITEM_TEXT, string, len);
+			return rv;
+		case CRONSH_FORMAT_MSGPACK:
+			rv += emitterKey(emitter, key);
+			rv += bufferAppendMsgpackString(emitter->dst, CRONSH_ITEM_TEXT, string, len);
+			return rv;
+		case CRONSH_FORMAT_NDJSON:
+			rv += emitterMember(emitter, level, key);
+			rv += bufferAppendJSONString(emitter->dst, string, len);
+			return rv;
+	}
+
+	return bufferAppendYAMLString(emitter->dst, level, key, string, len);
 }
 
-/* buffer facility */
+// arbitrary output of the command, the binary formats copy it as it is
+int emitterBytes(emitter_t *emitter, unsigned int level, const char *key, const char *bytes, size_t len) {
+	int rv = 0;
 
-int bufferInit(buffer_t *buffer, size_t nbytes) {
-	if(buffer == NULL) {
-		return 1;
+	if(key == NULL) {
+		return 0;
 	}
 
-	buffer->data = NULL;
-	buffer->size = 0;
-	buffer->used = 0;
-	buffer->step = nbytes;
+	if(bytes == NULL) {
+		bytes = "";
+		len = 0;
+	}
 
-	buffer->data = (char *)calloc(buffer->step + 1, sizeof(char));
-	if(buffer->data == NULL) {
-		return 1;
+	switch(emitter->format) {
+		case CRONSH_FORMAT_CBOR:
+			rv += emitterKey(emitter, key);
+			rv += bufferAppendCBORString(emitter->dst, CRONSH_ITEM_BYTES, bytes, len);
+			return rv;
+		case CRONSH_FORMAT_MSGPACK:
+			rv += emitterKey(emitter, key);
+			rv += bufferAppendMsgpackString(emitter->dst, CRONSH_ITEM_BYTES, bytes, len);
+			return rv;
+		case CRONSH_FORMAT_NDJSON:
+			rv += emitterMember(emitter, level, key);
+			rv += bufferAppendJSONString(emitter->dst, bytes, len);
+			return rv;
 	}
 
-	buffer->size = buffer->step;
+	return bufferAppendYAMLString(emitter->dst, level, key, bytes, len);
+}
 
-	return 0;
+// compressed output, the text formats carry it as base64
+int emitterBinary(emitter_t *emitter, unsigned int level, const char *key, const char *bytes, size_t len) {
+	int rv = 0;
+
+	if(key == NULL) {
+		return 0;
+	}
+
+	switch(emitter->format) {
+		case CRONSH_FORMAT_YAML:
+			return bufferAppendYAMLBinary(emitter->dst, level, key, bytes, len);
+		case CRONSH_FORMAT_NDJSON:
+			rv += emitterMember(emitter, level, key);
+			rv += bufferAppendBytes(emitter->dst, "\"", 1);
+			if(bytes != NULL) {
+				rv += bufferAppendBase64(emitter->dst, bytes, len, NULL, 0);
+			}
+			rv += bufferAppendBytes(emitter->dst, "\"", 1);
+			return rv;
+	}
+
+	return emitterBytes(emitter, level, key, bytes, len);
 }
 
-int bufferFree(buffer_t *buffer) {
-	if(buffer == NULL) {
-		return 1;
+int emitterList(emitter_t *emitter, unsigned int level, const char *key, char **list) {
+	int rv = 0;
+	size_t l, n;
+
+	if(key == NULL) {
+		return 0;
 	}
 
-	if(buffer->data != NULL) {
-		free(buffer->data);
-		buffer->data = NULL;
-		buffer->size = 0;
-		buffer->used = 0;
+	if(emitter->format == CRONSH_FORMAT_YAML) {
+		return bufferAppendYAMLList(emitter->dst, level, key, CRONSH_YAML_STRING, list);
 	}
 
-	return 0;
+	if(emitter->format == CRONSH_FORMAT_NDJSON) {
+		rv += emitterMember(emitter, level, key);
+		rv += bufferAppendBytes(emitter->dst, "[", 1);
+		for(l = 0; list[l] != NULL; l++) {
+			if(l != 0) {
+				rv += bufferAppendBytes(emitter->dst, ",", 1);
+			}
+			rv += bufferAppendJSONString(emitter->dst, list[l], strlen(list[l]));
+		}
+		rv += bufferAppendBytes(emitter->dst, "]", 1);
+
+		return rv;
+	}
+
+	for(n = 0; list[n] != NULL; n++);
+
+	rv += emitterKey(emitter, key);
+
+	if(emitter->format == CRONSH_FORMAT_CBOR) {
+		rv += bufferAppendCBORHead(emitter->dst, CRONSH_ITEM_ARRAY, n);
+	}
+	else {
+		rv += bufferAppendMsgpackHead(emitter->dst, CRONSH_ITEM_ARRAY, n);
+	}
+
+	for(l = 0; l < n; l++) {
+		if(emitter->format == CRONSH_FORMAT_CBOR) {
+			rv += bufferAppendCBORString(emitter->dst, CRONSH_ITEM_TEXT, list[l], strlen(list[l]));
+		}
+		else {
+			rv += bufferAppendMsgpackString(emitter->dst, CRONSH_ITEM_TEXT, list[l], strlen(list[l]));
+		}
+	}
+
+	return rv;
 }
 
-int bufferReset(buffer_t *buffer) {
-	if(buffer == NULL) {
-		return 1;
+// A list of nitems tuples that follow with emitterTuple() at level + 1
+int emitterSequence(emitter_t *emitter, unsigned int level, const char *key, size_t nitems) {
+	int rv = 0;
+
+	if(key == NULL) {
+		return 0;
 	}
 
-	buffer->used = 0;
+	switch(emitter->format) {
+		case CRONSH_FORMAT_CBOR:
+			rv += emitterKey(emitter, key);
+			rv += bufferAppendCBORHead(emitter->dst, CRONSH_ITEM_ARRAY, nitems);
+			return rv;
+		case CRONSH_FORMAT_MSGPACK:
+			rv += emitterKey(emitter, key);
+			rv += bufferAppendMsgpackHead(emitter->dst, CRONSH_ITEM_ARRAY, nitems);
+			return rv;
+		case CRONSH_FORMAT_NDJSON:
+			if(level >= sizeof(emitter->closers)) {
+				return 1;
+			}
 
-	return 0;
+			rv += emitterMember(emitter, level, key);
+			rv += bufferAppendBytes(emitter->dst, "[", 1);
+			emitter->closers[level] = ']';
+			emitter->depth = level + 1;
+			emitter->first = 1;
+			return rv;
+	}
+
+	if(nitems == 0) {
+		rv += bufferAppendYAMLPrefix(emitter->dst, level, key);
+		rv += bufferAppendBytes(emitter->dst, "[]\n", 3);
+
+		return rv;
+	}
+
+	return bufferAppendYAMLKey(emitter->dst, level, key);
 }
 
-int bufferAppendBytes(buffer_t *dst, const char *bytes, size_t nbytes) {
-	size_t size;
-	char *data;
+// A short list of numbers, written in one line in YAML
+int emitterTuple(emitter_t *emitter, unsigned int level, const long *values, size_t nvalues) {
+	int rv = 0;
+	size_t i;
 
-	if(dst == NULL) {
-		return 1;
+	switch(emitter->format) {
+		case CRONSH_FORMAT_CBOR:
+			rv += bufferAppendCBORHead(emitter->dst, CRONSH_ITEM_ARRAY, nvalues);
+			for(i = 0; i < nvalues; i++) {
+				rv += bufferAppendCBORNumber(emitter->dst, values[i]);
+			}
+			return rv;
+		case CRONSH_FORMAT_MSGPACK:
+			rv += bufferAppendMsgpackHead(emitter->dst, CRONSH_ITEM_ARRAY, nvalues);
+			for(i = 0; i < nvalues; i++) {
+				rv += bufferAppendMsgpackNumber(emitter->dst, values[i]);
+			}
+			return rv;
+		case CRONSH_FORMAT_NDJSON:
+			rv += emitterClose(emitter, level);
+			if(emitter->first == 0) {
+				rv += bufferAppendBytes(emitter->dst, ",", 1);
+			}
+			emitter->first = 0;
+
+			rv += bufferAppendBytes(emitter->dst, "[", 1);
+			for(i = 0; i < nvalues; i++) {
+				if(i != 0) {
+					rv += bufferAppendBytes(emitter->dst, ",", 1);
+				}
+				rv += bufferAppendJSONNumber(emitter->dst, values[i]);
+			}
+			rv += bufferAppendBytes(emitter->dst, "]", 1);
+			return rv;
 	}
 
-	if(bytes == NULL) {
-		return 0;
+	rv += bufferAppendYAMLPrefix(emitter->dst, level, "-");
+	rv += bufferAppendBytes(emitter->dst, "[", 1);
+	for(i = 0; i < nvalues; i++) {
+		if(i != 0) {
+			rv += bufferAppendBytes(emitter->dst, ", ", 2);
+		}
+		rv += bufferAppendJSONNumber(emitter->dst, values[i]);
 	}
+	rv += bufferAppendBytes(emitter->dst, "]\n", 2);
 
-	if(nbytes == 0) {
-		return 0;
+	return rv;
+}
+
+/* event facility */
+
+static int eventSetData(event_t *event, int fd, void *data) {
+	size_t size;
+	void **tdata;
+
+	if(fd < 0) {
+		return 1;
 	}
 
-	// Check if we have to increase the buffer size
-	if((dst->used + nbytes) > dst->size) {
-		// Pre-allocating some memory. Round up to the next step bound
-		size = ((dst->used + nbytes) / dst->step + 1) * dst->step;
+	if((size_t)fd >= event->datasize) {
+		size = event->datasize * 2;
+		if(size <= (size_t)fd) {
+			size = fd + 16;
+		}
 
-		data = (char *)realloc(dst->data, size + 1);
-		if(data == NULL) {
+		tdata = (void **)realloc(event->data, size * sizeof(void *));
+		if(tdata == NULL) {
 			return 1;
 		}
 
-		dst->data = data;
-		dst->size = size;
+		memset(&tdata[event->datasize], 0, (size - event->datasize) * sizeof(void *));
+
+		event->data = tdata;
+		event->datasize = size;
 	}
 
-	// Copy the stuff into the buffer
-	memcpy(&dst->data[dst->used], bytes, nbytes);
+	event->data[fd] = data;
 
-	dst->used += nbytes;
+	return 0;
+}
 
-	dst->data[dst->used] = '\0';
+#ifdef CRONSH_EVENT_EPOLL
+
+int eventInit(event_t *event) {
+	if(event == NULL) {
+		return 1;
+	}
+
+	memset(event, 0, sizeof(event_t));
+
+	event->epollfd = epoll_create1(EPOLL_CLOEXEC);
+	if(event->epollfd == -1) {
+		return 1;
+	}
 
 	return 0;
 }
 
-int bufferAppendString(buffer_t *dst, const char *format, ...) {
-	int rv;
-	char *string;
-	va_list ap;
+int eventFree(event_t *event) {
+	if(event == NULL) {
+		return 1;
+	}
 
-	if(format == NULL) {
-		return 0;
+	if(event->epollfd != -1) {
+		close(event->epollfd);
+		event->epollfd = -1;
 	}
 
-	va_start(ap, format);
-	vasprintf(&string, format, ap);
-	va_end(ap);
+	if(event->data != NULL) {
+		free(event->data);
+		event->data = NULL;
+		event->datasize = 0;
+	}
 
-	if(string == NULL) {
-		return 0;
+	return 0;
+}
+
+static int eventControl(event_t *event, int op, int fd, unsigned int events) {
+	struct epoll_event ev;
+
+	memset(&ev, 0, sizeof(ev));
+
+	if(events & CRONSH_EVENT_READ) {
+		ev.events |= EPOLLIN;
+	}
+	if(events & CRONSH_EVENT_WRITE) {
+		ev.events |= EPOLLOUT;
 	}
 
-	rv = bufferAppendBytes(dst, string, strlen(string));
+	ev.data.fd = fd;
 
-	free(string);
+	if(epoll_ctl(event->epollfd, op, fd, &ev) != 0) {
+		return 1;
+	}
 
-	return rv;
+	return 0;
 }
 
-int bufferAppendBuffer(buffer_t *dst, buffer_t *src) {
-	if(src == NULL) {
-		return 0;
+int eventAdd(event_t *event, int fd, unsigned int events, void *data) {
+	if(eventSetData(event, fd, data) != 0) {
+		return 1;
 	}
 
-	return bufferAppendBytes(dst, src->data, src->used);
+	return eventControl(event, EPOLL_CTL_ADD, fd, events);
 }
 
-int bufferStartYAML(buffer_t *dst) {
-	return bufferAppendString(dst, "---\n");
+int eventModify(event_t *event, int fd, unsigned int events, void *data) {
+	if(eventSetData(event, fd, data) != 0) {
+		return 1;
+	}
+
+	return eventControl(event, EPOLL_CTL_MOD, fd, events);
 }
 
-int bufferEndYAML(buffer_t *dst) {
-	return bufferAppendString(dst, "...\n");
+int eventDelete(event_t *event, int fd) {
+	struct epoll_event ev;
+
+	eventSetData(event, fd, NULL);
+
+	if(epoll_ctl(event->epollfd, EPOLL_CTL_DEL, fd, &ev) != 0) {
+		return 1;
+	}
+
+	return 0;
 }
 
-int bufferAppendYAML(buffer_t *dst, unsigned int level, const char *key, const char *format, int type, ...) {
-	int rv = 0;
-	unsigned int n;
-	char *string, *t, *p;
-	va_list ap;
+int eventWait(event_t *event, eventitem_t *items, int nitems, int timeout) {
+	int i, n;
+	struct epoll_event ev[CRONSH_EVENT_MAXITEMS];
 
-	if(key == NULL || format == NULL) {
-		return 0;
+	if(nitems > CRONSH_EVENT_MAXITEMS) {
+		nitems = CRONSH_EVENT_MAXITEMS;
 	}
 
-	va_start(ap, type);
-	vasprintf(&string, format, ap);
-	va_end(ap);
+	n = epoll_wait(event->epollfd, ev, nitems, timeout);
+	if(n == -1) {
+		return -1;
+	}
 
-	if(string == NULL) {
-		return 0;
+	for(i = 0; i < n; i++) {
+		items[i].fd = ev[i].data.fd;
+		items[i].data = event->data[items[i].fd];
+		items[i].events = 0;
+
+		if(ev[i].events & EPOLLIN) { items[i].events |= CRONSH_EVENT_READ; }
+		if(ev[i].events & EPOLLOUT) { items[i].events |= CRONSH_EVENT_WRITE; }
+		if(ev[i].events & EPOLLHUP) { items[i].events |= CRONSH_EVENT_HANGUP; }
+		if(ev[i].events & EPOLLERR) { items[i].events |= CRONSH_EVENT_ERROR; }
 	}
 
-	for(n = 0; n < level; n++) {
-		rv += bufferAppendBytes(dst, "  ", 2);
+	return n;
+}
+
+#else
+
+int eventInit(event_t *event) {
+	if(event == NULL) {
+		return 1;
 	}
-	rv += bufferAppendBytes(dst, key, strlen(key));
 
-	if(strcmp(key, "-")) {
-		rv += bufferAppendBytes(dst, ": ", 2);
+	memset(event, 0, sizeof(event_t));
+
+	return 0;
+}
+
+int eventFree(event_t *event) {
+	if(event == NULL) {
+		return 1;
 	}
-	else {
-		rv += bufferAppendBytes(dst, " ", 1);
+
+	if(event->pollfds != NULL) {
+		free(event->pollfds);
+		event->pollfds = NULL;
 	}
 
-	if(type == CRONSH_YAML_NUMBER) {
-		rv += bufferAppendBytes(dst, string, strlen(string));
+	if(event->index != NULL) {
+		free(event->index);
+		event->index = NULL;
 	}
-	else if(type == CRONSH_YAML_STRING && strlen(string) != 0) {
-		t = string;
-		n = 0;
-		int literal = 0;
 
-		while(*t != '\0') {
-			if(*t == '\r') {
-				*t = '\n';
-			}
+	if(event->data != NULL) {
+		free(event->data);
+		event->data = NULL;
+	}
 
-			if(iscntrl(*t)) {
-				literal = 1;
-				break;
-			}
+	event->nfds = 0;
+	event->size = 0;
+	event->datasize = 0;
 
-			t++;
-		}
+	return 0;
+}
 
-		if(literal != 0) {
-			rv += bufferAppendBytes(dst, "|-\n", 3);
+static short eventPollEvents(unsigned int events) {
+	short pevents = 0;
 
-			for(n = 0; n < (level + 1); n++) {
-				rv += bufferAppendBytes(dst, "  ", 2);
-			}
+	if(events & CRONSH_EVENT_READ) {
+		pevents |= POLLIN;
+	}
+	if(events & CRONSH_EVENT_WRITE) {
+		pevents |= POLLOUT;
+	}
 
-			size_t len = 0;
-			t = p = string;
-			while(*t != '\0') {
-				len++;
-				if(*t == '\n') {
-					rv += bufferAppendBytes(dst, p, len);
-					for(n = 0; n < (level + 1); n++) {
-						rv += bufferAppendBytes(dst, "  ", 2);
-					}
+	return pevents;
+}
 
-					len = 0;
-					p = t + 1;
-				}
-				else if(iscntrl(*t)) {
-					rv += bufferAppendBytes(dst, p, len - 1);
-					rv += bufferAppendString(dst, "\\x%x", *t);
+int eventAdd(event_t *event, int fd, unsigned int events, void *data) {
+	size_t size;
+	struct pollfd *tpollfds;
+	size_t *tindex;
 
-					len = 0;
-					p = t + 1;
-				}
+	if(eventSetData(event, fd, data) != 0) {
+		return 1;
+	}
 
-				t++;
-			}
-			rv += bufferAppendBytes(dst, p, len);
+	// the index has the same layout as the data and is kept at the same size
+	if(event->indexsize < event->datasize) {
+		tindex = (size_t *)realloc(event->index, event->datasize * sizeof(size_t));
+		if(tindex == NULL) {
+			return 1;
 		}
-		else {
-			rv += bufferAppendBytes(dst, "'", 1);
-			size_t len = 0;
-			t = p = string;
-			while(*t != '\0') {
-				len++;
-				if(*t == '\'') {
-					rv += bufferAppendBytes(dst, p, len);
-					rv += bufferAppendBytes(dst, "'", 1);
 
-					len = 0;
-					p = t + 1;
-	                        }
+		event->index = tindex;
+		event->indexsize = event->datasize;
+	}
+
+	if(event->nfds == event->size) {
+		size = (event->size == 0) ? 16 : event->size * 2;
 
-				t++;
-			}
-			rv += bufferAppendBytes(dst, p, len);
-			rv += bufferAppendBytes(dst, "'", 1);
+		tpollfds = (struct pollfd *)realloc(event->pollfds, size * sizeof(struct pollfd));
+		if(tpollfds == NULL) {
+			return 1;
 		}
+
+		event->pollfds = tpollfds;
+		event->size = size;
 	}
 
-	rv += bufferAppendBytes(dst, "\n", 1);
+	event->pollfds[event->nfds].fd = fd;
+	event->pollfds[event->nfds].events = eventPollEvents(events);
+	event->pollfds[event->nfds].revents = 0;
 
-	free(string);
+	event->index[fd] = event->nfds;
+	event->nfds++;
 
-	return rv;
+	return 0;
 }
 
-int bufferAppendYAMLList(buffer_t *dst, unsigned int level, const char *key, int type, char **list) {
-	int rv = 0;
-	unsigned int l;
+int eventModify(event_t *event, int fd, unsigned int events, void *data) {
+	if(eventSetData(event, fd, data) != 0) {
+		return 1;
+	}
 
-	if(key == NULL) {
-		return 0;
+	event->pollfds[event->index[fd]].events = eventPollEvents(events);
+
+	return 0;
+}
+
+int eventDelete(event_t *event, int fd) {
+	size_t i;
+
+	if(fd < 0 || (size_t)fd >= event->indexsize || event->nfds == 0) {
+		return 1;
+	}
+
+	eventSetData(event, fd, NULL);
+
+	// move the last descriptor into the free slot
+	i = event->index[fd];
+	event->nfds--;
+
+	if(i != event->nfds) {
+		event->pollfds[i] = event->pollfds[event->nfds];
+		event->index[event->pollfds[i].fd] = i;
 	}
 
-	for(l = 0; l < level; l++) {
-		rv += bufferAppendBytes(dst, "  ", 2);
+	return 0;
+}
+
+int eventWait(event_t *event, eventitem_t *items, int nitems, int timeout) {
+	int n;
+	size_t i;
+
+	n = poll(event->pollfds, event->nfds, timeout);
+	if(n <= 0) {
+		return n;
 	}
-	rv += bufferAppendBytes(dst, key, strlen(key));
 
-	rv += bufferAppendBytes(dst, ":\n", 2);
+	n = 0;
+	for(i = 0; i < event->nfds && n < nitems; i++) {
+		if(event->pollfds[i].revents == 0) {
+			continue;
+		}
 
-	for(l = 0; list[l] != NULL; l++) {
-		rv += bufferAppendYAML(dst, level + 1, "-", "%s", type, list[l]);
+		items[n].fd = event->pollfds[i].fd;
+		items[n].data = event->data[items[n].fd];
+		items[n].events = 0;
+
+		if(event->pollfds[i].revents & POLLIN) { items[n].events |= CRONSH_EVENT_READ; }
+		if(event->pollfds[i].revents & POLLOUT) { items[n].events |= CRONSH_EVENT_WRITE; }
+		if(event->pollfds[i].revents & POLLHUP) { items[n].events |= CRONSH_EVENT_HANGUP | CRONSH_EVENT_READ; }
+		if(event->pollfds[i].revents & (POLLERR | POLLNVAL)) { items[n].events |= CRONSH_EVENT_ERROR; }
+
+		n++;
 	}
 
-	return rv;
+	return n;
 }
 
+#endif